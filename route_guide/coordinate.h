@@ -0,0 +1,56 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_COORDINATE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_COORDINATE_H_
+
+#include <cstdint>
+
+namespace routeguide {
+
+// A compact, trivially copyable stand-in for 'Point' used wherever we
+// keep many locations around (8 bytes vs. a full protobuf message).
+// Latitude and longitude are in degrees multiplied by 10^7, exactly
+// like 'Point'.
+struct Coordinate {
+  int32_t latitude = 0;
+  int32_t longitude = 0;
+};
+
+inline bool operator==(const Coordinate& a, const Coordinate& b) {
+  return a.latitude == b.latitude && a.longitude == b.longitude;
+}
+
+inline bool operator!=(const Coordinate& a, const Coordinate& b) {
+  return !(a == b);
+}
+
+// Packs a coordinate into a single 64-bit key (latitude in the high
+// bits) suitable for hashing and ordering.
+inline uint64_t PackCoordinate(int32_t latitude, int32_t longitude) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(latitude)) << 32)
+      | static_cast<uint32_t>(longitude);
+}
+
+inline uint64_t PackCoordinate(const Coordinate& coordinate) {
+  return PackCoordinate(coordinate.latitude, coordinate.longitude);
+}
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_COORDINATE_H_
@@ -0,0 +1,112 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// libFuzzer target for the db parsers: whatever the input, neither
+// 'ParseDb()' nor 'DbChunkParser' may crash, a strict parse must keep
+// nothing unless it succeeds and parsing in chunks (sized by the first
+// byte of the input) must give exactly what parsing the whole db does.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "helper.h"
+#include "protos/route_guide.grpc.pb.h"
+
+using routeguide::DbChunkParser;
+using routeguide::DbParseMode;
+using routeguide::Feature;
+
+namespace {
+
+bool SameFeatures(
+    const std::vector<Feature>& a,
+    const std::vector<Feature>& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].location().latitude() != b[i].location().latitude()
+        || a[i].location().longitude() != b[i].location().longitude()
+        || a[i].name() != b[i].name()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Check(bool condition) {
+  if (!condition) {
+    std::abort();
+  }
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  const size_t chunk_size = data[0] % 32 + 1;
+  const std::string db(reinterpret_cast<const char*>(data) + 1, size - 1);
+
+  std::vector<Feature> strict;
+  std::string strict_error;
+  bool strict_ok =
+      routeguide::ParseDb(db, &strict, DbParseMode::kStrict, &strict_error);
+  Check(strict_ok || strict.empty());
+  Check(strict_ok == strict_error.empty());
+
+  std::vector<Feature> lenient;
+  std::string lenient_error;
+  bool lenient_ok = routeguide::ParseDb(
+      db,
+      &lenient,
+      DbParseMode::kLenient,
+      &lenient_error);
+  // Only malformed records are dropped, so a db that is fine in strict
+  // mode is the same in lenient mode.
+  Check(!strict_ok || (lenient_ok && SameFeatures(strict, lenient)));
+
+  for (DbParseMode mode : {DbParseMode::kStrict, DbParseMode::kLenient}) {
+    DbChunkParser parser(mode);
+    std::vector<Feature> features;
+    bool ok = true;
+    for (size_t position = 0; ok && position < db.size();
+         position += chunk_size) {
+      ok = parser.Add(
+          std::string_view(db).substr(position, chunk_size),
+          &features);
+    }
+    ok = parser.Finish(&features) && ok;
+    if (!ok && mode == DbParseMode::kStrict) {
+      features.clear();
+    }
+    bool whole_ok = mode == DbParseMode::kStrict ? strict_ok : lenient_ok;
+    Check(ok == whole_ok);
+    Check(parser.error()
+          == (mode == DbParseMode::kStrict ? strict_error : lenient_error));
+    Check(SameFeatures(
+        features,
+        mode == DbParseMode::kStrict ? strict : lenient));
+  }
+  return 0;
+}
@@ -0,0 +1,481 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Checks the db parsers against each other on generated dbs: the
+// original 'std::stol' based parser (kept here as a reference), 'ParseDb()'
+// and 'DbChunkParser' fed the same db in randomly sized chunks, in both
+// strict and lenient mode, with and without malformed records.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "helper.h"
+#include "protos/route_guide.grpc.pb.h"
+
+using routeguide::DbChunkParser;
+using routeguide::DbParseMode;
+using routeguide::Feature;
+
+namespace {
+
+// The parser the server started with, unchanged but for taking
+// 'unsigned char' in 'isspace()'. It only accepts the exact layout of
+// route_guide_db.json, strips every space (those in names included)
+// and throws on a malformed coordinate.
+class OldParser {
+ public:
+  explicit OldParser(const std::string& db) : db_(db) {
+    db_.erase(std::remove_if(db_.begin(), db_.end(), IsSpace), db_.end());
+    if (!Match("[")) {
+      SetFailedAndReturnFalse();
+    }
+  }
+
+  bool Finished() { return current_ >= db_.size(); }
+
+  bool TryParseOne(Feature* feature) {
+    if (failed_ || Finished() || !Match("{")) {
+      return SetFailedAndReturnFalse();
+    }
+    if (!Match(location_) || !Match("{") || !Match(latitude_)) {
+      return SetFailedAndReturnFalse();
+    }
+    long temp = 0;
+    ReadLong(&temp);
+    feature->mutable_location()->set_latitude(temp);
+    if (!Match(",") || !Match(longitude_)) {
+      return SetFailedAndReturnFalse();
+    }
+    ReadLong(&temp);
+    feature->mutable_location()->set_longitude(temp);
+    if (!Match("},") || !Match(name_) || !Match("\"")) {
+      return SetFailedAndReturnFalse();
+    }
+    size_t name_start = current_;
+    while (current_ != db_.size() && db_[current_++] != '"') {
+    }
+    if (current_ == db_.size()) {
+      return SetFailedAndReturnFalse();
+    }
+    feature->set_name(db_.substr(name_start, current_ - name_start - 1));
+    if (!Match("},")) {
+      if (db_[current_ - 1] == ']' && current_ == db_.size()) {
+        return true;
+      }
+      return SetFailedAndReturnFalse();
+    }
+    return true;
+  }
+
+  static bool IsSpace(char c) {
+    return isspace(static_cast<unsigned char>(c));
+  }
+
+ private:
+  bool SetFailedAndReturnFalse() {
+    failed_ = true;
+    return false;
+  }
+
+  bool Match(const std::string& prefix) {
+    bool eq = db_.substr(current_, prefix.size()) == prefix;
+    current_ += prefix.size();
+    return eq;
+  }
+
+  void ReadLong(long* l) {
+    size_t start = current_;
+    while (current_ != db_.size() && db_[current_] != ','
+           && db_[current_] != '}') {
+      current_++;
+    }
+    *l = std::stol(db_.substr(start, current_ - start));
+  }
+
+  bool failed_ = false;
+  std::string db_;
+  size_t current_ = 0;
+  const std::string location_ = "\"location\":";
+  const std::string latitude_ = "\"latitude\":";
+  const std::string longitude_ = "\"longitude\":";
+  const std::string name_ = "\"name\":";
+};
+
+bool OldParseDb(const std::string& db, std::vector<Feature>* feature_list) {
+  feature_list->clear();
+  try {
+    OldParser parser(db);
+    while (!parser.Finished()) {
+      feature_list->push_back(Feature());
+      if (!parser.TryParseOne(&feature_list->back())) {
+        feature_list->clear();
+        return false;
+      }
+    }
+  } catch (const std::exception&) {
+    feature_list->clear();
+    return false;
+  }
+  return true;
+}
+
+struct Result {
+  bool ok = false;
+  std::vector<Feature> features;
+  std::string error;
+};
+
+Result Parse(const std::string& db, DbParseMode mode) {
+  Result result;
+  result.ok = routeguide::ParseDb(db, &result.features, mode, &result.error);
+  return result;
+}
+
+Result ParseChunked(
+    const std::string& db,
+    DbParseMode mode,
+    std::mt19937* random) {
+  Result result;
+  DbChunkParser parser(mode);
+  bool ok = true;
+  size_t position = 0;
+  while (ok && position < db.size()) {
+    // Mostly tiny chunks, so that records are cut everywhere.
+    size_t size = std::uniform_int_distribution<size_t>(1, 16)(*random);
+    if ((*random)() % 8 == 0) {
+      size *= 64;
+    }
+    size = std::min(size, db.size() - position);
+    ok = parser.Add(
+        std::string_view(db).substr(position, size),
+        &result.features);
+    position += size;
+  }
+  result.ok = parser.Finish(&result.features) && ok;
+  result.error = parser.error();
+  if (!result.ok && mode == DbParseMode::kStrict) {
+    result.features.clear();
+  }
+  return result;
+}
+
+bool SameFeatures(
+    const std::vector<Feature>& a,
+    const std::vector<Feature>& b) {
+  return std::equal(
+      a.begin(),
+      a.end(),
+      b.begin(),
+      b.end(),
+      [](const Feature& x, const Feature& y) {
+        return x.location().latitude() == y.location().latitude()
+            && x.location().longitude() == y.location().longitude()
+            && x.name() == y.name();
+      });
+}
+
+// A generated db and what a lenient parse of it must return.
+struct Db {
+  std::string json;
+  std::vector<Feature> features;
+  size_t malformed = 0;
+};
+
+class DbGenerator {
+ public:
+  explicit DbGenerator(uint32_t seed) : random_(seed) {}
+
+  // In the 'canonical' layout (that of route_guide_db.json, which the
+  // old parser requires) keys are in order and names are plain.
+  Db Generate(size_t records, bool canonical, size_t malformed) {
+    Db db;
+    std::vector<size_t> bad(records);
+    for (size_t i = 0; i < records; i++) {
+      bad[i] = i < malformed;
+    }
+    std::shuffle(bad.begin(), bad.end(), random_);
+    db.json = "[";
+    for (size_t i = 0; i < records; i++) {
+      db.json += i == 0 ? Space() : "," + Space();
+      if (bad[i]) {
+        db.json += MalformedRecord();
+        db.malformed++;
+        continue;
+      }
+      Feature feature;
+      db.json += Record(canonical, &feature);
+      db.features.push_back(std::move(feature));
+    }
+    db.json += Space() + "]" + Space();
+    return db;
+  }
+
+  std::mt19937* random() { return &random_; }
+
+ private:
+  size_t Uniform(size_t n) {
+    return std::uniform_int_distribution<size_t>(0, n - 1)(random_);
+  }
+
+  std::string Space() {
+    static const char* kSpaces[] = {"", "", " ", "\n  ", "\t", "\r\n"};
+    return kSpaces[Uniform(6)];
+  }
+
+  int32_t Coordinate(int32_t limit) {
+    return std::uniform_int_distribution<int32_t>(-limit, limit)(random_);
+  }
+
+  // Returns the json for 'name', which is also set on 'feature'.
+  std::string Name(bool canonical, Feature* feature) {
+    std::string json;
+    std::string name;
+    size_t length = Uniform(24);
+    for (size_t i = 0; i < length; i++) {
+      switch (Uniform(canonical ? 3 : 5)) {
+        case 0:
+          name.push_back('a' + Uniform(26));
+          json.push_back(name.back());
+          break;
+        case 1:
+          name.push_back(' ');
+          json.push_back(' ');
+          break;
+        case 2:
+          // A two byte UTF-8 character, both bytes negative as 'char's.
+          name.push_back(static_cast<char>(0xc2 + Uniform(0x1e)));
+          name.push_back(static_cast<char>(0x80 + Uniform(0x40)));
+          json.append(name.end() - 2, name.end());
+          break;
+        case 3:
+          name.push_back('"');
+          json += "\\\"";
+          break;
+        case 4:
+          name.push_back('\n');
+          json += "\\n";
+          break;
+      }
+    }
+    feature->set_name(name);
+    return "\"" + json + "\"";
+  }
+
+  std::string Record(bool canonical, Feature* feature) {
+    int32_t latitude = Coordinate(900000000);
+    int32_t longitude = Coordinate(1800000000);
+    feature->mutable_location()->set_latitude(latitude);
+    feature->mutable_location()->set_longitude(longitude);
+    std::string location = "\"location\":" + Space() + "{" + Space()
+        + "\"latitude\":" + Space() + std::to_string(latitude) + ","
+        + Space() + "\"longitude\":" + Space() + std::to_string(longitude)
+        + Space() + "}";
+    if (canonical) {
+      return "{" + Space() + location + "," + Space() + "\"name\":" + Space()
+          + Name(true, feature) + Space() + "}";
+    }
+    switch (Uniform(3)) {
+      case 0:
+        return "{" + location + "}";
+      case 1:
+        return "{" + Space() + "\"name\":" + Space() + Name(false, feature)
+            + "," + Space() + location + Space() + "}";
+      default:
+        return "{" + location + "," + Space() + "\"name\":"
+            + Name(false, feature) + "}";
+    }
+  }
+
+  // A record that a lenient parse must skip, and can (its braces and
+  // quotes are balanced).
+  std::string MalformedRecord() {
+    std::string latitude = std::to_string(Coordinate(900000000));
+    std::string longitude = std::to_string(Coordinate(1800000000));
+    switch (Uniform(7)) {
+      case 0:
+        return "{\"location\": {\"latitude\": " + latitude
+            + ", \"longitude\": " + longitude + "}, \"extra\": 1}";
+      case 1:
+        return "{\"location\": {\"latitude\": 900000001, \"longitude\": "
+            + longitude + "}, \"name\": \"x\"}";
+      case 2:
+        return "{\"location\": {\"latitude\": " + latitude
+            + "}, \"name\": \"x\"}";
+      case 3:
+        return "{\"location\": {\"latitude\": " + latitude
+            + "x, \"longitude\": " + longitude + "}}";
+      case 4:
+        return "{\"name\": \"no location\"}";
+      case 5:
+        return "42";
+      default:
+        return "{\"location\": {\"latitude\": \"" + latitude
+            + "\", \"longitude\": " + longitude + "}}";
+    }
+  }
+
+  std::mt19937 random_;
+};
+
+int failures = 0;
+
+void Check(bool condition, uint32_t seed, const std::string& what) {
+  if (!condition) {
+    std::cerr << "seed " << seed << ": " << what << std::endl;
+    failures++;
+  }
+}
+
+std::string StripSpaces(std::string s) {
+  s.erase(std::remove_if(s.begin(), s.end(), OldParser::IsSpace), s.end());
+  return s;
+}
+
+// Both modes of 'ParseDb()' and 'DbChunkParser' on a well formed db.
+void CheckWellFormed(uint32_t seed, bool canonical) {
+  DbGenerator generator(seed);
+  Db db = generator.Generate((*generator.random())() % 64, canonical, 0);
+  for (DbParseMode mode : {DbParseMode::kStrict, DbParseMode::kLenient}) {
+    Result whole = Parse(db.json, mode);
+    Check(whole.ok && whole.error.empty(), seed, "rejected: " + whole.error);
+    Check(SameFeatures(whole.features, db.features), seed, "features differ");
+    Result chunked = ParseChunked(db.json, mode, generator.random());
+    Check(chunked.ok, seed, "chunked parse rejected: " + chunked.error);
+    Check(
+        SameFeatures(chunked.features, db.features),
+        seed,
+        "chunked features differ");
+  }
+  if (!canonical || db.features.empty()) {
+    return;
+  }
+  // The old parser drops every space, so it only agrees up to those.
+  std::vector<Feature> old;
+  Check(OldParseDb(db.json, &old), seed, "old parser rejected the db");
+  std::vector<Feature> expected = db.features;
+  for (Feature& feature : expected) {
+    feature.set_name(StripSpaces(feature.name()));
+  }
+  Check(SameFeatures(old, expected), seed, "old parser features differ");
+}
+
+// Malformed records fail a strict parse and are skipped by a lenient
+// one, the same whether the db is parsed whole or in chunks.
+void CheckMalformed(uint32_t seed) {
+  DbGenerator generator(seed);
+  size_t records = 1 + (*generator.random())() % 64;
+  size_t malformed = 1 + (*generator.random())() % records;
+  Db db = generator.Generate(records, seed % 2 == 0, malformed);
+
+  Result strict = Parse(db.json, DbParseMode::kStrict);
+  Check(!strict.ok, seed, "strict parse accepted a malformed db");
+  Check(strict.features.empty(), seed, "strict parse kept features");
+  Check(!strict.error.empty(), seed, "strict parse has no error");
+
+  Result lenient = Parse(db.json, DbParseMode::kLenient);
+  Check(!lenient.ok, seed, "lenient parse reported no error");
+  Check(
+      SameFeatures(lenient.features, db.features),
+      seed,
+      "lenient parse didn't keep exactly the well formed records");
+  std::string suffix =
+      "(skipped " + std::to_string(db.malformed) + " malformed records)";
+  Check(
+      lenient.error.size() >= suffix.size()
+          && lenient.error.compare(
+                 lenient.error.size() - suffix.size(),
+                 suffix.size(),
+                 suffix) == 0,
+      seed,
+      "lenient error '" + lenient.error + "' doesn't end with " + suffix);
+
+  for (const Result* whole : {&strict, &lenient}) {
+    DbParseMode mode =
+        whole == &strict ? DbParseMode::kStrict : DbParseMode::kLenient;
+    Result chunked = ParseChunked(db.json, mode, generator.random());
+    Check(chunked.ok == whole->ok, seed, "chunked result differs");
+    Check(chunked.error == whole->error, seed,
+          "chunked error '" + chunked.error + "' vs '" + whole->error + "'");
+    Check(
+        SameFeatures(chunked.features, whole->features),
+        seed,
+        "chunked features differ");
+  }
+}
+
+// Anything else (cut off, garbage around the array) must be parsed the
+// same whole and in chunks.
+void CheckDamaged(uint32_t seed) {
+  DbGenerator generator(seed);
+  std::mt19937* random = generator.random();
+  Db db = generator.Generate((*random)() % 16, false, (*random)() % 2);
+  std::string json = db.json;
+  switch ((*random)() % 4) {
+    case 0:
+      json.resize((*random)() % (json.size() + 1));
+      break;
+    case 1:
+      json += "x";
+      break;
+    case 2:
+      json.insert(0, "{");
+      break;
+    default:
+      json[(*random)() % json.size()] = "{}[],:\"\\x"[(*random)() % 9];
+      break;
+  }
+  for (DbParseMode mode : {DbParseMode::kStrict, DbParseMode::kLenient}) {
+    Result whole = Parse(json, mode);
+    Result chunked = ParseChunked(json, mode, random);
+    Check(chunked.ok == whole.ok, seed, "chunked result differs");
+    Check(chunked.error == whole.error, seed,
+          "chunked error '" + chunked.error + "' vs '" + whole.error + "'");
+    Check(
+        SameFeatures(chunked.features, whole.features),
+        seed,
+        "chunked features differ");
+    if (mode == DbParseMode::kStrict && !whole.ok) {
+      Check(whole.features.empty(), seed, "strict parse kept features");
+    }
+  }
+}
+
+}  // namespace
+
+int main() {
+  const uint32_t kSeeds = 500;
+  for (uint32_t seed = 0; seed < kSeeds; seed++) {
+    CheckWellFormed(seed, true);
+    CheckWellFormed(seed, false);
+    CheckMalformed(seed);
+    CheckDamaged(seed);
+  }
+  if (failures > 0) {
+    std::cerr << failures << " checks failed" << std::endl;
+    return 1;
+  }
+  std::cout << "Checked " << 4 * kSeeds << " generated dbs" << std::endl;
+  return 0;
+}
@@ -0,0 +1,470 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "feature_db.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "metrics.h"
+#include "protos/route_guide.grpc.pb.h"
+
+namespace routeguide {
+
+namespace {
+
+const char kMagic[] = "RGFDB001";
+const uint32_t kVersion = 4;
+const uint32_t kNamesPerBlock = 64;
+// Lookups of different blocks rarely contend on a shard's lock with
+// this many (unless there are fewer cache blocks than that).
+const size_t kMaxNameCacheShards = 16;
+
+void PutVarint(std::string* buffer, uint64_t value) {
+  while (value >= 0x80) {
+    buffer->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  buffer->push_back(static_cast<char>(value));
+}
+
+bool GetVarint(const char** position, const char* end, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *position < end; shift += 7) {
+    uint8_t byte = *(*position)++;
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Sections start 8 byte aligned so they can be used in place.
+uint64_t Align(uint64_t offset) {
+  return (offset + 7) & ~uint64_t(7);
+}
+
+uint64_t GetOffset(const char* section, uint64_t index) {
+  uint64_t offset;
+  std::memcpy(&offset, section + index * sizeof(offset), sizeof(offset));
+  return offset;
+}
+
+}  // namespace
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 || status.st_size == 0) {
+    close(fd);
+    return nullptr;
+  }
+  size_t size = status.st_size;
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file.
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  return std::unique_ptr<MappedFile>(
+      new MappedFile(static_cast<const char*>(data), size));
+}
+
+MappedFile::~MappedFile() {
+  munmap(const_cast<char*>(data_), size_);
+}
+
+MappedFeatureNames::MappedFeatureNames(
+    std::shared_ptr<const MappedFile> file,
+    const FeatureDbHeader& header,
+    size_t cache_blocks)
+  : file_(std::move(file)),
+    header_(header),
+    section_(file_->data() + header.names_offset),
+    section_size_(header.names_size),
+    names_per_block_(header.names_per_block),
+    block_count_(
+        (header.feature_count + header.names_per_block - 1)
+        / header.names_per_block),
+    cache_blocks_(std::max<size_t>(cache_blocks, 1)),
+    shard_count_(std::min(cache_blocks_, kMaxNameCacheShards)),
+    shards_(new CacheShard[shard_count_]) {
+  for (size_t i = 0; i < shard_count_; i++) {
+    shards_[i].capacity = cache_blocks_ / shard_count_
+        + (i < cache_blocks_ % shard_count_ ? 1 : 0);
+    shards_[i].slots.reserve(shards_[i].capacity);
+  }
+  // Names are looked up in no particular order, don't read ahead.
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = reinterpret_cast<uintptr_t>(section_) & ~(page - 1);
+  madvise(
+      reinterpret_cast<void*>(start),
+      reinterpret_cast<uintptr_t>(section_) + section_size_ - start,
+      MADV_RANDOM);
+}
+
+std::string MappedFeatureNames::Get(uint32_t id) const {
+  std::shared_ptr<const Block> block = Lookup(id);
+  uint64_t position = id % names_per_block_;
+  return position < block->size() ? (*block)[position] : "";
+}
+
+std::string_view MappedFeatureNames::View(
+    uint32_t id,
+    NameBuffer* buffer) const {
+  std::shared_ptr<const Block> block = Lookup(id);
+  uint64_t position = id % names_per_block_;
+  std::string_view name =
+      position < block->size() ? std::string_view((*block)[position]) : "";
+  buffer->pinned = std::move(block);
+  return name;
+}
+
+std::shared_ptr<const MappedFeatureNames::Block> MappedFeatureNames::Lookup(
+    uint32_t id) const {
+  static Counter& hits =
+      Metrics::Default().GetCounter("feature_name_cache_hits_total");
+  static Counter& misses =
+      Metrics::Default().GetCounter("feature_name_cache_misses_total");
+
+  uint64_t index = id / names_per_block_;
+  CacheShard& shard = shards_[index % shard_count_];
+
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto cached = shard.cached.find(index);
+    if (cached != shard.cached.end()) {
+      hits.Increment();
+      CacheSlot& slot = shard.slots[cached->second];
+      slot.referenced = true;
+      return slot.block;
+    }
+  }
+
+  misses.Increment();
+
+  // Decode without holding the lock, if another thread raced us to the
+  // same block the first one inserted wins.
+  std::shared_ptr<const Block> block = Decode(index);
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.cached.count(index) != 0) {
+    return block;
+  }
+  if (shard.slots.size() < shard.capacity) {
+    shard.cached.emplace(index, shard.slots.size());
+    shard.slots.push_back(CacheSlot{index, block, false});
+    return block;
+  }
+  // Give each referenced block a second chance, evicting the first
+  // one that isn't (there is one within a turn of the clock).
+  while (shard.slots[shard.hand].referenced) {
+    shard.slots[shard.hand].referenced = false;
+    shard.hand = (shard.hand + 1) % shard.slots.size();
+  }
+  CacheSlot& slot = shard.slots[shard.hand];
+  shard.cached.erase(slot.index);
+  shard.cached.emplace(index, shard.hand);
+  slot = CacheSlot{index, block, false};
+  shard.hand = (shard.hand + 1) % shard.slots.size();
+  return block;
+}
+
+std::shared_ptr<const MappedFeatureNames::Block> MappedFeatureNames::Decode(
+    uint64_t index) const {
+  auto block = std::make_shared<Block>();
+
+  // Offsets were validated when loading but a corrupt block just
+  // decodes to fewer names (looked up as "") rather than failing.
+  const char* position = section_ + GetOffset(section_, index);
+  const char* end = section_ + GetOffset(section_, index + 1);
+
+  std::string previous;
+  while (position < end && block->size() < names_per_block_) {
+    uint64_t shared = 0;
+    uint64_t size = 0;
+    if (!GetVarint(&position, end, &shared)
+        || !GetVarint(&position, end, &size)
+        || shared > previous.size()
+        || size > static_cast<uint64_t>(end - position)) {
+      break;
+    }
+    previous.resize(shared);
+    previous.append(position, size);
+    position += size;
+    block->push_back(previous);
+  }
+
+  return block;
+}
+
+size_t MappedFeatureNames::MemoryUsage() const {
+  size_t usage = 0;
+  for (size_t i = 0; i < shard_count_; i++) {
+    std::lock_guard<std::mutex> lock(shards_[i].mutex);
+    for (const CacheSlot& slot : shards_[i].slots) {
+      usage += slot.block->capacity() * sizeof(std::string);
+      for (const std::string& name : *slot.block) {
+        usage += name.capacity() + 1;
+      }
+    }
+  }
+  return usage;
+}
+
+bool WriteFeatureDb(
+    const std::string& path,
+    const std::vector<Feature>& features,
+    std::string* error) {
+  FeatureDbHeader header = {};
+  std::memcpy(header.magic, kMagic, sizeof(header.magic));
+  header.version = kVersion;
+  header.names_per_block = kNamesPerBlock;
+  header.feature_count = features.size();
+  header.coordinates_offset = sizeof(header);
+  header.names_offset =
+      header.coordinates_offset + features.size() * sizeof(Coordinate);
+
+  HugePageVector<Coordinate> built;
+  built.reserve(features.size());
+  for (const Feature& feature : features) {
+    built.push_back(
+        Coordinate{
+            feature.location().latitude(),
+            feature.location().longitude()});
+  }
+  FlatArray<Coordinate> coordinates(std::move(built));
+
+  uint64_t block_count =
+      (features.size() + kNamesPerBlock - 1) / kNamesPerBlock;
+
+  std::vector<uint64_t> offsets;
+  offsets.reserve(block_count + 1);
+  std::string blocks;
+  uint64_t start = (block_count + 1) * sizeof(uint64_t);
+  for (size_t i = 0; i < features.size(); i++) {
+    const std::string& name = features[i].name();
+    size_t shared = 0;
+    if (i % kNamesPerBlock == 0) {
+      // Blocks are decoded independently so each starts from scratch.
+      offsets.push_back(start + blocks.size());
+    } else {
+      const std::string& previous = features[i - 1].name();
+      size_t limit = std::min(name.size(), previous.size());
+      while (shared < limit && name[shared] == previous[shared]) {
+        shared++;
+      }
+    }
+    PutVarint(&blocks, shared);
+    PutVarint(&blocks, name.size() - shared);
+    blocks.append(name, shared, std::string::npos);
+  }
+  offsets.push_back(start + blocks.size());
+
+  header.names_size = start + blocks.size();
+
+  std::string index;
+  PerfectHashIndex(coordinates).Serialize(&index);
+  header.index_offset = Align(header.names_offset + header.names_size);
+  header.index_size = index.size();
+
+  HugePageVector<FeatureStore::SpatialEntry> spatial_index =
+      FeatureStore::BuildSpatialIndex(coordinates);
+  header.spatial_offset = Align(header.index_offset + header.index_size);
+  header.spatial_size =
+      spatial_index.size() * sizeof(FeatureStore::SpatialEntry);
+
+  // Write to a temporary file and rename it into place so that a server
+  // never maps a partially written db.
+  std::string temporary_path = path + ".tmp";
+  std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    *error = "failed to open '" + temporary_path + "' for writing";
+    return false;
+  }
+  auto pad = [&file](uint64_t offset) {
+    static const char zeros[8] = {};
+    file.write(zeros, offset - static_cast<uint64_t>(file.tellp()));
+  };
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(
+      reinterpret_cast<const char*>(coordinates.data()),
+      coordinates.size() * sizeof(Coordinate));
+  file.write(
+      reinterpret_cast<const char*>(offsets.data()),
+      offsets.size() * sizeof(uint64_t));
+  file.write(blocks.data(), blocks.size());
+  pad(header.index_offset);
+  file.write(index.data(), index.size());
+  pad(header.spatial_offset);
+  file.write(
+      reinterpret_cast<const char*>(spatial_index.data()),
+      header.spatial_size);
+  file.close();
+  if (!file) {
+    *error = "failed to write '" + temporary_path + "'";
+    std::remove(temporary_path.c_str());
+    return false;
+  }
+  if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    *error = "failed to rename '" + temporary_path + "' to '" + path + "'";
+    std::remove(temporary_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<FeatureStore> LoadFeatureDb(
+    const std::string& path,
+    size_t name_cache_blocks,
+    FeatureDbLoad load,
+    std::string* error) {
+  std::shared_ptr<const MappedFile> file = MappedFile::Open(path);
+  if (!file) {
+    *error = "failed to map '" + path + "'";
+    return nullptr;
+  }
+
+  FeatureDbHeader header;
+  if (file->size() < sizeof(header)) {
+    *error = "'" + path + "' is too small to be a feature db";
+    return nullptr;
+  }
+  std::memcpy(&header, file->data(), sizeof(header));
+
+  if (std::memcmp(header.magic, kMagic, sizeof(header.magic)) != 0
+      || header.version != kVersion) {
+    *error = "'" + path + "' is not a version " + std::to_string(kVersion)
+        + " feature db";
+    return nullptr;
+  }
+
+  // Check every section (and every block offset) is within the file so
+  // that nothing read later can run off the mapping.
+  uint64_t size = file->size();
+  uint64_t block_count = header.names_per_block == 0
+      ? 0
+      : (header.feature_count + header.names_per_block - 1)
+          / header.names_per_block;
+  if (header.names_per_block == 0
+      || header.feature_count > PointIndex::kNotFound
+      || header.coordinates_offset > size
+      || header.feature_count * sizeof(Coordinate)
+          > size - header.coordinates_offset
+      || header.names_offset > size
+      || header.names_size > size - header.names_offset
+      || (block_count + 1) * sizeof(uint64_t) > header.names_size
+      || header.index_offset > size
+      || header.index_size > size - header.index_offset
+      || header.spatial_offset > size
+      || header.spatial_size > size - header.spatial_offset
+      || header.spatial_size
+          != header.feature_count * sizeof(FeatureStore::SpatialEntry)
+      || header.coordinates_offset % 8 != 0
+      || header.index_offset % 8 != 0
+      || header.spatial_offset % 8 != 0) {
+    *error = "'" + path + "' is truncated or corrupt";
+    return nullptr;
+  }
+
+  const char* names = file->data() + header.names_offset;
+  uint64_t previous = (block_count + 1) * sizeof(uint64_t);
+  for (uint64_t i = 0; i <= block_count; i++) {
+    uint64_t offset = GetOffset(names, i);
+    if (offset < previous || offset > header.names_size) {
+      *error = "'" + path + "' has a corrupt names section";
+      return nullptr;
+    }
+    previous = offset;
+  }
+
+  using SpatialEntry = FeatureStore::SpatialEntry;
+  const char* spatial = file->data() + header.spatial_offset;
+  for (uint64_t i = 0; i < header.feature_count; i++) {
+    uint32_t id;
+    std::memcpy(
+        &id,
+        spatial + i * sizeof(SpatialEntry) + offsetof(SpatialEntry, id),
+        sizeof(id));
+    if (id >= header.feature_count) {
+      *error = "'" + path + "' has a corrupt spatial index section";
+      return nullptr;
+    }
+  }
+
+  // Either view the sections in place, sharing the mapping's pages
+  // with every other process that maps the same file, or copy them.
+  FlatArray<Coordinate> coordinates;
+  FlatArray<SpatialEntry> spatial_index;
+  std::shared_ptr<const void> owner;
+  if (load == FeatureDbLoad::kAttach) {
+    owner = file;
+    coordinates = FlatArray<Coordinate>(
+        reinterpret_cast<const Coordinate*>(
+            file->data() + header.coordinates_offset),
+        header.feature_count,
+        owner);
+    spatial_index = FlatArray<SpatialEntry>(
+        reinterpret_cast<const SpatialEntry*>(spatial),
+        header.feature_count,
+        owner);
+  } else {
+    HugePageVector<Coordinate> copied_coordinates(header.feature_count);
+    std::memcpy(
+        copied_coordinates.data(),
+        file->data() + header.coordinates_offset,
+        header.feature_count * sizeof(Coordinate));
+    HugePageVector<SpatialEntry> copied_spatial_index(header.feature_count);
+    std::memcpy(
+        static_cast<void*>(copied_spatial_index.data()),
+        spatial,
+        header.spatial_size);
+    coordinates = std::move(copied_coordinates);
+    spatial_index = std::move(copied_spatial_index);
+  }
+
+  PerfectHashIndex perfect_hash;
+  if (!PerfectHashIndex::Deserialize(
+          file->data() + header.index_offset,
+          header.index_size,
+          std::move(owner),
+          &perfect_hash)) {
+    *error = "'" + path + "' has a corrupt index section";
+    return nullptr;
+  }
+
+  return std::make_unique<FeatureStore>(
+      std::move(coordinates),
+      std::make_unique<MappedFeatureNames>(file, header, name_cache_blocks),
+      std::move(perfect_hash),
+      std::move(spatial_index));
+}
+
+}  // namespace routeguide
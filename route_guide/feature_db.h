@@ -0,0 +1,179 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_DB_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_DB_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "feature_store.h"
+
+namespace routeguide {
+class Feature;
+
+// Binary feature db, produced from the json db by
+// 'route_guide_db_converter':
+//
+//   FeatureDbHeader
+//   Coordinate[feature_count]
+//   names section
+//   index section, a serialized 'PerfectHashIndex' over the coordinates
+//   FeatureStore::SpatialEntry[feature_count]
+//
+// The names section starts with (block_count + 1) uint64_t offsets,
+// relative to the section, followed by the blocks. Each block front
+// codes 'names_per_block' consecutive names as (varint length of the
+// prefix shared with the previous name, varint suffix length, suffix
+// bytes). Integers are stored in host (little endian) byte order and
+// every section but the names starts 8 byte aligned.
+//
+// The file is mmap'ed: coordinates and indexes (built once, by the
+// converter) are either copied or used in place (see 'FeatureDbLoad')
+// while names stay on disk (paged in by the kernel only when touched)
+// and are decoded a block at a time when a response needs them.
+struct FeatureDbHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t names_per_block;
+  uint64_t feature_count;
+  uint64_t coordinates_offset;
+  uint64_t names_offset;
+  uint64_t names_size;
+  uint64_t index_offset;
+  uint64_t index_size;
+  uint64_t spatial_offset;
+  uint64_t spatial_size;
+};
+
+enum class FeatureDbLoad {
+  // Copy coordinates and indexes into memory of this process, where
+  // they can be backed by huge pages.
+  kCopy,
+  // Use them in place. Every process attached to the same file (e.g.,
+  // one in /dev/shm written once by the converter) then shares a single
+  // copy of its pages.
+  kAttach,
+};
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  // Returns nullptr if 'path' can't be opened or mapped.
+  static std::unique_ptr<MappedFile> Open(const std::string& path);
+
+  ~MappedFile();
+
+  const char* data() const { return data_; }
+
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile(const char* data, size_t size) : data_(data), size_(size) {}
+
+  const char* data_;
+  size_t size_;
+};
+
+// Names decoded on demand from the names section of a mapped feature
+// db, keeping up to 'cache_blocks' decoded blocks. The cache is split
+// into shards (by block) that each evict with CLOCK, so a hit only
+// takes its shard's lock to mark the block referenced.
+class MappedFeatureNames final : public FeatureNames {
+ public:
+  MappedFeatureNames(
+      std::shared_ptr<const MappedFile> file,
+      const FeatureDbHeader& header,
+      size_t cache_blocks);
+
+  std::string Get(uint32_t id) const override;
+
+  // Points into the cached block, which 'buffer' pins.
+  std::string_view View(uint32_t id, NameBuffer* buffer) const override;
+
+  // Only the decoded blocks are resident, the mapping is paged.
+  size_t MemoryUsage() const override;
+
+  // Shares the mapping but not the cache.
+  std::unique_ptr<FeatureNames> Clone() const override {
+    return std::make_unique<MappedFeatureNames>(
+        file_,
+        header_,
+        cache_blocks_);
+  }
+
+ private:
+  using Block = std::vector<std::string>;
+
+  struct CacheSlot {
+    uint64_t index;
+    std::shared_ptr<const Block> block;
+    // Set by hits, cleared as the clock hand passes.
+    bool referenced;
+  };
+
+  struct CacheShard {
+    std::mutex mutex;
+    size_t capacity = 0;
+    std::vector<CacheSlot> slots;
+    // Next slot the clock hand looks at.
+    size_t hand = 0;
+    // Slot of each cached block.
+    std::unordered_map<uint64_t, size_t> cached;
+  };
+
+  // Returns the (cached or just decoded) block holding 'id'.
+  std::shared_ptr<const Block> Lookup(uint32_t id) const;
+
+  std::shared_ptr<const Block> Decode(uint64_t block) const;
+
+  const std::shared_ptr<const MappedFile> file_;
+  const FeatureDbHeader header_;
+  const char* const section_;
+  const uint64_t section_size_;
+  const uint64_t names_per_block_;
+  const uint64_t block_count_;
+  const size_t cache_blocks_;
+  const size_t shard_count_;
+  const std::unique_ptr<CacheShard[]> shards_;
+};
+
+// Writes 'features' to 'path' atomically (through a temporary file
+// that is renamed into place).
+bool WriteFeatureDb(
+    const std::string& path,
+    const std::vector<Feature>& features,
+    std::string* error);
+
+// Maps the feature db at 'path' and builds a 'FeatureStore' from it,
+// returning nullptr (and setting 'error') if that fails.
+std::unique_ptr<FeatureStore> LoadFeatureDb(
+    const std::string& path,
+    size_t name_cache_blocks,
+    FeatureDbLoad load,
+    std::string* error);
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_DB_H_
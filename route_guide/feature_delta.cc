@@ -0,0 +1,157 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "feature_delta.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <sstream>
+
+namespace routeguide {
+
+namespace {
+
+// Parses the next space separated integer of 'line' in [-limit, limit].
+bool ParseCoordinate(
+    std::string_view* line,
+    int64_t limit,
+    int32_t* coordinate) {
+  size_t start = line->find_first_not_of(' ');
+  if (start == std::string_view::npos) {
+    return false;
+  }
+  line->remove_prefix(start);
+  int64_t value = 0;
+  auto [end, error] = std::from_chars(
+      line->data(),
+      line->data() + line->size(),
+      value);
+  if (error != std::errc() || value < -limit || value > limit) {
+    return false;
+  }
+  line->remove_prefix(end - line->data());
+  if (!line->empty() && line->front() != ' ') {
+    return false;
+  }
+  *coordinate = static_cast<int32_t>(value);
+  return true;
+}
+
+bool ParseChange(std::string_view line, FeatureChange* change) {
+  size_t end = line.find(' ');
+  std::string_view kind = line.substr(0, end);
+  line.remove_prefix(kind.size());
+  if (kind == "add") {
+    change->kind = FeatureChange::kAdd;
+  } else if (kind == "remove") {
+    change->kind = FeatureChange::kRemove;
+  } else if (kind == "rename") {
+    change->kind = FeatureChange::kRename;
+  } else {
+    return false;
+  }
+  if (!ParseCoordinate(&line, 900000000, &change->coordinate.latitude)
+      || !ParseCoordinate(&line, 1800000000, &change->coordinate.longitude)) {
+    return false;
+  }
+  if (change->kind == FeatureChange::kRemove) {
+    return line.find_first_not_of(' ') == std::string_view::npos;
+  }
+  // The name is everything after the separating space.
+  if (!line.empty()) {
+    line.remove_prefix(1);
+  }
+  change->name = std::string(line);
+  return true;
+}
+
+}  // namespace
+
+bool ParseFeatureDelta(
+    std::string_view text,
+    std::vector<FeatureChange>* delta,
+    std::string* error) {
+  delta->clear();
+  size_t number = 0;
+  while (!text.empty()) {
+    number++;
+    size_t end = text.find('\n');
+    std::string_view line = text.substr(0, end);
+    text.remove_prefix(
+        end == std::string_view::npos ? text.size() : end + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    if (line.find_first_not_of(' ') == std::string_view::npos
+        || line.front() == '#') {
+      continue;
+    }
+    FeatureChange change;
+    if (!ParseChange(line, &change)) {
+      *error = "line " + std::to_string(number) + ": malformed change '"
+          + std::string(line) + "'";
+      delta->clear();
+      return false;
+    }
+    delta->push_back(std::move(change));
+  }
+  return true;
+}
+
+bool ReadFeatureDelta(
+    const std::string& path,
+    std::vector<FeatureChange>* delta,
+    std::string* error) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    *error = "failed to open '" + path + "'";
+    return false;
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+  if (!ParseFeatureDelta(text.str(), delta, error)) {
+    *error = path + ": " + *error;
+    return false;
+  }
+  return true;
+}
+
+std::vector<std::string> ListFeatureDeltas(const std::string& directory) {
+  std::vector<std::string> paths;
+  DIR* dir = opendir(directory.c_str());
+  if (dir == nullptr) {
+    return paths;
+  }
+  const std::string suffix = ".delta";
+  while (struct dirent* entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.size() > suffix.size()
+        && name.compare(name.size() - suffix.size(), suffix.size(), suffix)
+            == 0) {
+      paths.push_back(directory + "/" + name);
+    }
+  }
+  closedir(dir);
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+}  // namespace routeguide
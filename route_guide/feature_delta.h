@@ -0,0 +1,72 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_DELTA_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_DELTA_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "coordinate.h"
+
+namespace routeguide {
+
+// A change to the features of a 'FeatureStore'. Features are identified
+// by their coordinate, removing or renaming one applies to every feature
+// at that coordinate.
+struct FeatureChange {
+  enum Kind {
+    kAdd,
+    kRemove,
+    kRename,
+  };
+
+  Kind kind = kAdd;
+  Coordinate coordinate;
+  // New name, for 'kAdd' and 'kRename'.
+  std::string name;
+};
+
+// Parses a delta file, which lists changes one per line as
+//
+//   add <latitude> <longitude> <name>
+//   remove <latitude> <longitude>
+//   rename <latitude> <longitude> <name>
+//
+// with coordinates as in the json db and the name being the rest of the
+// line (possibly empty). Blank lines and lines starting with '#' are
+// ignored. Returns false, with 'error' naming the offending line, if any
+// line is malformed.
+bool ParseFeatureDelta(
+    std::string_view text,
+    std::vector<FeatureChange>* delta,
+    std::string* error);
+
+bool ReadFeatureDelta(
+    const std::string& path,
+    std::vector<FeatureChange>* delta,
+    std::string* error);
+
+// Returns the paths of the '*.delta' files in 'directory', sorted by
+// name (the order to apply them in).
+std::vector<std::string> ListFeatureDeltas(const std::string& directory);
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_DELTA_H_
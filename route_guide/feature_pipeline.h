@@ -0,0 +1,202 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_PIPELINE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_PIPELINE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "eventuals/loop.h"
+#include "eventuals/stream.h"
+#include "feature_store.h"
+#include "file_io.h"
+#include "helper.h"
+#include "metrics.h"
+#include "protos/route_guide.grpc.pb.h"
+
+namespace routeguide {
+
+// Stages for loading the json db as a pipeline,
+//
+//   ReadFile(io, path, &error) | ParseAndIndex(parser)
+//
+// where the file is parsed as it's read, a chunk at a time, rather than
+// read whole and then parsed. Reading the next chunk overlaps parsing
+// the current one and only the features, not the db, are ever all in
+// memory. Errors are reported through 'error' and 'parser' instead of
+// failing the pipeline, like the rest of the server.
+//
+// 'ReadFile()' emits on whichever thread completes a read (the I/O
+// layer's, or the event loop's when its completions are polled there)
+// so 'ParseAndIndex()' moves the parsing and index building to a thread
+// of its own, leaving that one free for other I/O (e.g., log flushes).
+// Its result is started on that thread too, '*' on the pipeline is the
+// way to run it.
+
+const size_t kReadFileChunkSize = 1 << 20;
+
+// Streams the contents of the file at 'path' in chunks of up to
+// 'chunk_size' bytes. Ends early, setting 'error', if the file can't be
+// read to the end.
+inline auto ReadFile(
+    FileIo* io,
+    std::string path,
+    std::string* error,
+    size_t chunk_size = kReadFileChunkSize) {
+  return eventuals::Stream<std::string>()
+      .context(std::unique_ptr<FileChunkReader>())
+      .next([io, path = std::move(path), error, chunk_size](
+                std::unique_ptr<FileChunkReader>& reader,
+                auto& k) {
+        if (!reader) {
+          reader = FileChunkReader::Open(io, path, chunk_size, error);
+          if (!reader) {
+            k.Ended();
+            return;
+          }
+        }
+        reader->Next([&reader, &k, error](std::string&& chunk) {
+          if (!chunk.empty()) {
+            k.Emit(std::move(chunk));
+            return;
+          }
+          *error = reader->error();
+          k.Ended();
+        });
+      })
+      .done([](std::unique_ptr<FileChunkReader>&, auto& k) {
+        k.Ended();
+      });
+}
+
+// Runs tasks one at a time, in the order they're posted, on a thread
+// of its own. Destroying it runs the tasks still posted and joins the
+// thread, which a task must therefore not do.
+class PipelineWorker {
+ public:
+  PipelineWorker() : thread_([this]() { Run(); }) {}
+
+  PipelineWorker(const PipelineWorker&) = delete;
+  PipelineWorker& operator=(const PipelineWorker&) = delete;
+
+  ~PipelineWorker() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    posted_.notify_one();
+    thread_.join();
+  }
+
+  // May be called from any thread, including the worker's.
+  void Post(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+    }
+    posted_.notify_one();
+  }
+
+ private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      posted_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      std::function<void()> task = std::move(tasks_.front());
+      tasks_.pop_front();
+      lock.unlock();
+      task();
+      lock.lock();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable posted_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+  // Last, so it starts once the above are initialized.
+  std::thread thread_;
+};
+
+// Parses each chunk of the db with 'parser' (see 'DbChunkParser') and,
+// once they've all been parsed, builds a 'FeatureStore' from the
+// features, both on a 'PipelineWorker'. The next chunk is only asked
+// for once the current one is parsed, so at most two are in memory.
+// Once 'parser' stops (on a malformed record in strict mode) the
+// remaining chunks are skipped, and the result is nullptr. Times the
+// phases with 'timer', if any.
+inline auto ParseAndIndex(
+    std::shared_ptr<DbChunkParser> parser,
+    PhaseTimer* timer = nullptr) {
+  // What the worker's tasks use, which the worker (destroyed first)
+  // can't outlive.
+  struct State {
+    std::vector<Feature> features;
+    PipelineWorker worker;
+  };
+  return eventuals::Loop<std::unique_ptr<FeatureStore>>()
+      .context(std::unique_ptr<State>())
+      .body([parser](
+                std::unique_ptr<State>& state,
+                auto& stream,
+                std::string&& chunk) {
+        if (!state) {
+          state = std::make_unique<State>();
+        }
+        state->worker.Post(
+            [parser, &state = *state, &stream, chunk = std::move(chunk)]() {
+              parser->Add(chunk, &state.features);
+              stream.Next();
+            });
+      })
+      .ended([parser, timer](std::unique_ptr<State>& state, auto& k) {
+        if (!state) {
+          state = std::make_unique<State>();
+        }
+        state->worker.Post([parser, timer, &state = *state, &k]() {
+          if (!parser->Finish(&state.features)
+              && parser->mode() == DbParseMode::kStrict) {
+            k.Start(std::unique_ptr<FeatureStore>());
+            return;
+          }
+          if (timer != nullptr) {
+            timer->Lap("parse_db");
+          }
+          auto store =
+              std::make_unique<FeatureStore>(std::move(state.features));
+          if (timer != nullptr) {
+            timer->Lap("build_indexes");
+          }
+          k.Start(std::move(store));
+        });
+      });
+}
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_PIPELINE_H_
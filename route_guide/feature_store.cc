@@ -0,0 +1,532 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "feature_store.h"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "protos/route_guide.grpc.pb.h"
+
+namespace routeguide {
+
+InternedFeatureNames::InternedFeatureNames(std::vector<std::string>&& names)
+  : names_(names.size()) {
+  // Visit names in descending order of their reverse, a name that is a
+  // suffix of any other name is then a suffix of the one visited right
+  // before it (which has already been placed in the arena).
+  std::vector<uint32_t> order(names.size());
+  for (uint32_t id = 0; id < order.size(); id++) {
+    order[id] = id;
+  }
+  std::sort(
+      order.begin(),
+      order.end(),
+      [&names](uint32_t a, uint32_t b) {
+        return std::lexicographical_compare(
+            names[b].rbegin(),
+            names[b].rend(),
+            names[a].rbegin(),
+            names[a].rend());
+      });
+
+  const std::string* previous = nullptr;
+  Name placed;
+  for (uint32_t id : order) {
+    const std::string& name = names[id];
+    if (previous != nullptr
+        && name.size() <= previous->size()
+        && std::equal(name.rbegin(), name.rend(), previous->rbegin())) {
+      names_[id].offset = placed.offset + placed.size - name.size();
+      names_[id].size = name.size();
+    } else {
+      names_[id].offset = arena_.size();
+      names_[id].size = name.size();
+      arena_.append(name);
+      stored_++;
+    }
+    previous = &name;
+    placed = names_[id];
+  }
+
+  arena_.shrink_to_fit();
+  names.clear();
+  names.shrink_to_fit();
+}
+
+size_t InternedFeatureNames::MemoryUsage() const {
+  return arena_.capacity() + names_.capacity() * sizeof(Name);
+}
+
+size_t StringsMemoryUsage(const std::vector<std::string>& names) {
+  size_t usage = names.capacity() * sizeof(std::string);
+  // Names that don't fit the small string buffer are on the heap.
+  const size_t inline_capacity = std::string().capacity();
+  for (const std::string& name : names) {
+    if (name.capacity() > inline_capacity) {
+      usage += name.capacity() + 1;
+    }
+  }
+  return usage;
+}
+
+// Changes applied by deltas since the db was loaded, split into chunks
+// shared (never changed once published) between the overlays of stores
+// derived from one another: 'ApplyDelta()' copies the pointers and only
+// the chunks its changes touch, not every change made so far. Changes
+// by id and the added features at a coordinate (by its packed key) are
+// kept in one of 'kShards' shards, added features in chunks of
+// 'kAddedPerChunk'.
+struct FeatureStore::Overlay {
+  static constexpr size_t kShards = 64;
+  static constexpr size_t kAddedPerChunk = 1024;
+
+  struct Shard {
+    // Removed features, from the db or added.
+    std::unordered_set<uint32_t> removed;
+    // Current names of renamed features from the db.
+    std::unordered_map<uint32_t, std::string> renamed;
+    // Ids of added features by 'PackCoordinate()', in id order.
+    std::unordered_map<uint64_t, std::vector<uint32_t>> added_ids;
+  };
+
+  // Features added by deltas, the i-th with id (db size + i).
+  struct AddedChunk {
+    std::vector<Coordinate> coordinates;
+    std::vector<std::string> names;
+  };
+
+  Overlay() {
+    static const std::shared_ptr<Shard> empty = std::make_shared<Shard>();
+    shards.fill(empty);
+  }
+
+  // Shares every chunk of 'that', until changed.
+  Overlay(const Overlay& that)
+    : shards(that.shards),
+      added(that.added),
+      added_count(that.added_count),
+      removed_count(that.removed_count) {}
+
+  const Shard& ById(uint32_t id) const { return *shards[id % kShards]; }
+
+  const Shard& ByKey(uint64_t key) const { return *shards[key % kShards]; }
+
+  bool Removed(uint32_t id) const { return ById(id).removed.count(id) != 0; }
+
+  // Returns the current name of a renamed feature from the db, or
+  // nullptr.
+  const std::string* Renamed(uint32_t id) const {
+    const Shard& shard = ById(id);
+    auto renamed = shard.renamed.find(id);
+    return renamed != shard.renamed.end() ? &renamed->second : nullptr;
+  }
+
+  const Coordinate& added_coordinate(size_t i) const {
+    return added[i / kAddedPerChunk]->coordinates[i % kAddedPerChunk];
+  }
+
+  const std::string& added_name(size_t i) const {
+    return added[i / kAddedPerChunk]->names[i % kAddedPerChunk];
+  }
+
+  // Only while 'ApplyDelta()' builds this overlay: the shard or chunk
+  // to change, copied the first time if it's shared.
+  Shard* MutableShard(size_t i);
+  AddedChunk* MutableAdded(size_t chunk);
+
+  // Appends an added feature, returning its index.
+  size_t Add(const Coordinate& coordinate, const std::string& name);
+
+  size_t MemoryUsage() const;
+
+  std::array<std::shared_ptr<Shard>, kShards> shards;
+  std::vector<std::shared_ptr<AddedChunk>> added;
+  size_t added_count = 0;
+  size_t removed_count = 0;
+
+  // Chunks copied (or created) for this overlay, see 'MutableShard()'.
+  std::bitset<kShards> owned_shards;
+  std::vector<bool> owned_added;
+};
+
+FeatureStore::Overlay::Shard* FeatureStore::Overlay::MutableShard(size_t i) {
+  if (!owned_shards[i]) {
+    shards[i] = std::make_shared<Shard>(*shards[i]);
+    owned_shards[i] = true;
+  }
+  return shards[i].get();
+}
+
+FeatureStore::Overlay::AddedChunk* FeatureStore::Overlay::MutableAdded(
+    size_t chunk) {
+  owned_added.resize(added.size(), false);
+  if (!owned_added[chunk]) {
+    added[chunk] = std::make_shared<AddedChunk>(*added[chunk]);
+    owned_added[chunk] = true;
+  }
+  return added[chunk].get();
+}
+
+size_t FeatureStore::Overlay::Add(
+    const Coordinate& coordinate,
+    const std::string& name) {
+  if (added_count % kAddedPerChunk == 0) {
+    added.push_back(std::make_shared<AddedChunk>());
+    owned_added.resize(added.size(), false);
+    owned_added.back() = true;
+  }
+  AddedChunk* chunk = MutableAdded(added.size() - 1);
+  chunk->coordinates.push_back(coordinate);
+  chunk->names.push_back(name);
+  return added_count++;
+}
+
+size_t FeatureStore::Overlay::MemoryUsage() const {
+  // Hash table nodes are counted as their payload plus a pointer. Chunks
+  // shared with other stores count towards each of them.
+  size_t usage = 0;
+  for (const std::shared_ptr<Shard>& shard : shards) {
+    usage += shard->removed.size() * (sizeof(uint32_t) + sizeof(void*));
+    for (const auto& [id, name] : shard->renamed) {
+      usage += sizeof(id) + sizeof(name) + sizeof(void*) + name.capacity();
+    }
+    for (const auto& [key, ids] : shard->added_ids) {
+      usage += sizeof(key) + sizeof(ids) + sizeof(void*)
+          + ids.capacity() * sizeof(uint32_t);
+    }
+  }
+  for (const std::shared_ptr<AddedChunk>& chunk : added) {
+    usage += chunk->coordinates.capacity() * sizeof(Coordinate)
+        + StringsMemoryUsage(chunk->names);
+  }
+  return usage;
+}
+
+FeatureStore::Base::Base(const Base& that)
+  : coordinates(that.coordinates),
+    names(that.names->Clone()),
+    perfect_hash(that.perfect_hash),
+    point_index(that.point_index),
+    spatial_index(that.spatial_index) {}
+
+FeatureStore::FeatureStore(std::vector<Feature>&& features) {
+  HugePageVector<Coordinate> coordinates;
+  std::vector<std::string> names;
+  coordinates.reserve(features.size());
+  names.reserve(features.size());
+  for (Feature& feature : features) {
+    coordinates.push_back(
+        Coordinate{
+            feature.location().latitude(),
+            feature.location().longitude()});
+    names.push_back(std::move(*feature.mutable_name()));
+  }
+  features.clear();
+  features.shrink_to_fit();
+
+  auto base = std::make_shared<Base>();
+  base->coordinates = std::move(coordinates);
+  base->names = std::make_unique<InternedFeatureNames>(std::move(names));
+
+  BuildIndexes(base.get());
+  base_ = std::move(base);
+}
+
+FeatureStore::FeatureStore(
+    FlatArray<Coordinate>&& coordinates,
+    std::unique_ptr<FeatureNames> names,
+    PerfectHashIndex&& perfect_hash,
+    FlatArray<SpatialEntry>&& spatial_index) {
+  auto base = std::make_shared<Base>();
+  base->coordinates = std::move(coordinates);
+  base->names = std::move(names);
+  base->perfect_hash = std::move(perfect_hash);
+  base->spatial_index = std::move(spatial_index);
+
+  BuildIndexes(base.get());
+  base_ = std::move(base);
+}
+
+FeatureStore::FeatureStore(const FeatureStore& that)
+  : base_(std::make_shared<Base>(*that.base_)),
+    overlay_(that.overlay_) {}
+
+FeatureStore::FeatureStore(
+    std::shared_ptr<const Base> base,
+    std::shared_ptr<const Overlay> overlay)
+  : base_(std::move(base)),
+    overlay_(std::move(overlay)) {}
+
+FeatureStore::~FeatureStore() {}
+
+std::unique_ptr<FeatureStore> FeatureStore::Clone() const {
+  return std::unique_ptr<FeatureStore>(new FeatureStore(*this));
+}
+
+HugePageVector<FeatureStore::SpatialEntry> FeatureStore::BuildSpatialIndex(
+    const FlatArray<Coordinate>& coordinates) {
+  HugePageVector<SpatialEntry> spatial_index;
+  spatial_index.reserve(coordinates.size());
+  for (uint32_t id = 0; id < coordinates.size(); id++) {
+    spatial_index.push_back(SpatialEntry{coordinates[id], id});
+  }
+  std::sort(
+      spatial_index.begin(),
+      spatial_index.end(),
+      [](const SpatialEntry& a, const SpatialEntry& b) {
+        return a.coordinate.latitude < b.coordinate.latitude;
+      });
+  return spatial_index;
+}
+
+void FeatureStore::BuildIndexes(Base* base) {
+  if (base->perfect_hash.empty()) {
+    base->point_index = PointIndex(base->coordinates);
+  }
+
+  if (base->spatial_index.empty()) {
+    base->spatial_index = BuildSpatialIndex(base->coordinates);
+  }
+}
+
+size_t FeatureStore::size() const {
+  size_t size = base_->coordinates.size();
+  if (overlay_ != nullptr) {
+    size += overlay_->added_count - overlay_->removed_count;
+  }
+  return size;
+}
+
+uint32_t FeatureStore::FindInOverlay(
+    const Coordinate& coordinate,
+    uint32_t id) const {
+  // Removing a coordinate removes every feature there, so if the first
+  // one from the db is gone so are the rest.
+  if (id != kNotFound && !overlay_->Removed(id)) {
+    return id;
+  }
+  const uint64_t key = PackCoordinate(coordinate);
+  const Overlay::Shard& shard = overlay_->ByKey(key);
+  auto added = shard.added_ids.find(key);
+  if (added != shard.added_ids.end()) {
+    for (uint32_t added_id : added->second) {
+      if (!overlay_->Removed(added_id)) {
+        return added_id;
+      }
+    }
+  }
+  return kNotFound;
+}
+
+const Coordinate& FeatureStore::AddedCoordinate(uint32_t id) const {
+  return overlay_->added_coordinate(id - base_->coordinates.size());
+}
+
+std::string FeatureStore::OverlayName(uint32_t id) const {
+  if (id >= base_->coordinates.size()) {
+    return overlay_->added_name(id - base_->coordinates.size());
+  }
+  const std::string* renamed = overlay_->Renamed(id);
+  return renamed != nullptr ? *renamed : base_->names->Get(id);
+}
+
+std::string_view FeatureStore::NameView(
+    uint32_t id,
+    NameBuffer* buffer) const {
+  if (overlay_ != nullptr) {
+    if (id >= base_->coordinates.size()) {
+      return overlay_->added_name(id - base_->coordinates.size());
+    }
+    if (const std::string* renamed = overlay_->Renamed(id)) {
+      return *renamed;
+    }
+  }
+  return base_->names->View(id, buffer);
+}
+
+std::unique_ptr<FeatureStore> FeatureStore::ApplyDelta(
+    const std::vector<FeatureChange>& delta,
+    std::string* error) const {
+  // Shares the chunks of the current overlay, only those changed below
+  // are copied.
+  auto overlay = overlay_ != nullptr
+      ? std::make_shared<Overlay>(*overlay_)
+      : std::make_shared<Overlay>();
+  const uint32_t base_size = base_->coordinates.size();
+
+  std::vector<uint32_t> ids;
+  for (size_t i = 0; i < delta.size(); i++) {
+    const FeatureChange& change = delta[i];
+    const uint64_t key = PackCoordinate(change.coordinate);
+
+    if (change.kind == FeatureChange::kAdd) {
+      uint32_t id = base_size + overlay->Add(change.coordinate, change.name);
+      overlay->MutableShard(key % Overlay::kShards)
+          ->added_ids[key]
+          .push_back(id);
+      continue;
+    }
+
+    // Every feature still at the coordinate, from the db and added.
+    ids.clear();
+    auto entry = std::lower_bound(
+        base_->spatial_index.begin(),
+        base_->spatial_index.end(),
+        change.coordinate.latitude,
+        [](const SpatialEntry& entry, int32_t latitude) {
+          return entry.coordinate.latitude < latitude;
+        });
+    for (; entry != base_->spatial_index.end()
+         && entry->coordinate.latitude == change.coordinate.latitude;
+         ++entry) {
+      if (entry->coordinate.longitude == change.coordinate.longitude) {
+        ids.push_back(entry->id);
+      }
+    }
+    const Overlay::Shard& shard = overlay->ByKey(key);
+    auto added = shard.added_ids.find(key);
+    if (added != shard.added_ids.end()) {
+      ids.insert(ids.end(), added->second.begin(), added->second.end());
+    }
+    ids.erase(
+        std::remove_if(
+            ids.begin(),
+            ids.end(),
+            [&overlay](uint32_t id) { return overlay->Removed(id); }),
+        ids.end());
+    if (ids.empty()) {
+      *error = "change " + std::to_string(i + 1) + ": no feature at "
+          + std::to_string(change.coordinate.latitude) + ", "
+          + std::to_string(change.coordinate.longitude);
+      return nullptr;
+    }
+
+    for (uint32_t id : ids) {
+      if (change.kind == FeatureChange::kRemove) {
+        overlay->MutableShard(id % Overlay::kShards)->removed.insert(id);
+        overlay->removed_count++;
+      } else if (id < base_size) {
+        overlay->MutableShard(id % Overlay::kShards)->renamed[id] =
+            change.name;
+      } else {
+        size_t i = id - base_size;
+        overlay->MutableAdded(i / Overlay::kAddedPerChunk)
+            ->names[i % Overlay::kAddedPerChunk] = change.name;
+      }
+    }
+  }
+
+  return std::unique_ptr<FeatureStore>(
+      new FeatureStore(base_, std::move(overlay)));
+}
+
+void FeatureStore::FindInRectangle(
+    const Coordinate& lo,
+    const Coordinate& hi,
+    std::vector<uint32_t>* ids) const {
+  int32_t left = std::min(lo.longitude, hi.longitude);
+  int32_t right = std::max(lo.longitude, hi.longitude);
+  int32_t top = std::max(lo.latitude, hi.latitude);
+  int32_t bottom = std::min(lo.latitude, hi.latitude);
+
+  size_t first = ids->size();
+
+  auto entry = std::lower_bound(
+      base_->spatial_index.begin(),
+      base_->spatial_index.end(),
+      bottom,
+      [](const SpatialEntry& entry, int32_t latitude) {
+        return entry.coordinate.latitude < latitude;
+      });
+
+  for (; entry != base_->spatial_index.end()
+       && entry->coordinate.latitude <= top;
+       ++entry) {
+    if (entry->coordinate.longitude >= left
+        && entry->coordinate.longitude <= right) {
+      ids->push_back(entry->id);
+    }
+  }
+
+  if (overlay_ != nullptr) {
+    ids->erase(
+        std::remove_if(
+            ids->begin() + first,
+            ids->end(),
+            [this](uint32_t id) { return overlay_->Removed(id); }),
+        ids->end());
+    // Deltas only add a few features, they're scanned rather than
+    // indexed.
+    const uint32_t base_size = base_->coordinates.size();
+    for (uint32_t i = 0; i < overlay_->added_count; i++) {
+      const Coordinate& coordinate = overlay_->added_coordinate(i);
+      if (coordinate.latitude >= bottom
+          && coordinate.latitude <= top
+          && coordinate.longitude >= left
+          && coordinate.longitude <= right
+          && !overlay_->Removed(base_size + i)) {
+        ids->push_back(base_size + i);
+      }
+    }
+  }
+
+  std::sort(ids->begin() + first, ids->end());
+}
+
+std::string FeatureStore::GetFeatureName(const Coordinate& coordinate) const {
+  uint32_t id = Find(coordinate);
+  return id == kNotFound ? "" : name(id);
+}
+
+void FeatureStore::CopyName(uint32_t id, Feature* feature) const {
+  if (id == kNotFound) {
+    feature->clear_name();
+    return;
+  }
+  NameBuffer buffer;
+  std::string_view name = NameView(id, &buffer);
+  if (name.data() == buffer.name.data()) {
+    feature->set_name(std::move(buffer.name));
+  } else {
+    feature->mutable_name()->assign(name.data(), name.size());
+  }
+}
+
+Feature FeatureStore::GetFeature(uint32_t id) const {
+  Feature feature;
+  CopyName(id, &feature);
+  feature.mutable_location()->set_latitude(coordinate(id).latitude);
+  feature.mutable_location()->set_longitude(coordinate(id).longitude);
+  return feature;
+}
+
+size_t FeatureStore::MemoryUsage() const {
+  // Arrays used in place from a mapping count as zero.
+  return base_->coordinates.MemoryUsage()
+      + base_->names->MemoryUsage()
+      + base_->perfect_hash.MemoryUsage()
+      + base_->point_index.MemoryUsage()
+      + base_->spatial_index.MemoryUsage()
+      + (overlay_ != nullptr ? overlay_->MemoryUsage() : 0);
+}
+
+}  // namespace routeguide
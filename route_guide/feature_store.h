@@ -0,0 +1,294 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_STORE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "coordinate.h"
+#include "feature_delta.h"
+#include "flat_array.h"
+#include "huge_pages.h"
+#include "perfect_hash_index.h"
+#include "point_index.h"
+
+namespace routeguide {
+class Feature;
+
+// What a name returned by 'FeatureNames::View()' may point into when
+// it isn't resident: a copy decoded into 'name' or whatever 'pinned'
+// keeps alive (e.g., a cached block of names).
+struct NameBuffer {
+  std::string name;
+  std::shared_ptr<const void> pinned;
+};
+
+// Source of feature names by feature id. Names are only needed for
+// responses so implementations may trade lookup speed for memory.
+class FeatureNames {
+ public:
+  virtual ~FeatureNames() = default;
+
+  virtual std::string Get(uint32_t id) const = 0;
+
+  // Returns the name without copying it if it's resident, e.g.,
+  // interned or cached, and otherwise decodes it into 'buffer'. Valid
+  // for as long as these names and 'buffer' are (and 'buffer' isn't
+  // changed).
+  virtual std::string_view View(uint32_t id, NameBuffer* buffer) const {
+    buffer->name = Get(id);
+    return buffer->name;
+  }
+
+  // Resident bytes used for names.
+  virtual size_t MemoryUsage() const = 0;
+
+  // Returns a copy in memory allocated by the calling thread.
+  virtual std::unique_ptr<FeatureNames> Clone() const = 0;
+};
+
+// Every name decoded in memory, interned into a single arena: equal
+// names are stored once and a name that is a suffix of another (e.g.,
+// "USA" of "..., NJ 07945, USA") points into it, so each feature only
+// costs an offset and a length on top of its distinct characters
+// (of which there may be at most 4GiB).
+class InternedFeatureNames final : public FeatureNames {
+ public:
+  explicit InternedFeatureNames(std::vector<std::string>&& names);
+
+  std::string Get(uint32_t id) const override {
+    return std::string(View(id));
+  }
+
+  // Valid for as long as this is.
+  std::string_view View(uint32_t id) const {
+    return std::string_view(arena_.data() + names_[id].offset,
+                            names_[id].size);
+  }
+
+  std::string_view View(uint32_t id, NameBuffer*) const override {
+    return View(id);
+  }
+
+  size_t MemoryUsage() const override;
+
+  std::unique_ptr<FeatureNames> Clone() const override {
+    return std::make_unique<InternedFeatureNames>(*this);
+  }
+
+  // Number of names that weren't a duplicate or suffix of another one.
+  size_t stored() const { return stored_; }
+
+ private:
+  struct Name {
+    uint32_t offset = 0;
+    uint32_t size = 0;
+  };
+
+  std::string arena_;
+  std::vector<Name> names_;
+  size_t stored_ = 0;
+};
+
+// Returns the memory 'names' use as separate strings, i.e., without
+// interning, to report what 'InternedFeatureNames' saves.
+size_t StringsMemoryUsage(const std::vector<std::string>& names);
+
+// Immutable, indexed set of features. Coordinates and names are kept
+// separately, indexed by a feature's id (its position in the db), and
+// 'Feature' messages are only materialized for responses.
+//
+// Lookups by exact coordinate go through a 'PerfectHashIndex' if one
+// was built with the db, a 'PointIndex' otherwise, and rectangle
+// queries through a spatial index of coordinates sorted by latitude.
+// Coordinates and indexes are either allocated according to
+// 'GetHugePages()' or, when attached to a feature db mapping that
+// other processes share, used in place.
+//
+// Changes to the db are applied by deriving a new store, see
+// 'ApplyDelta()', which shares all of the above with this one and keeps
+// the changes (since the db was loaded) in an overlay that lookups
+// consult after the indexes. The overlay is split into shards and
+// chunks that derived stores share, so a delta only copies those it
+// changes.
+class FeatureStore {
+ public:
+  static constexpr uint32_t kNotFound = PointIndex::kNotFound;
+
+  struct SpatialEntry {
+    Coordinate coordinate;
+    uint32_t id;
+  };
+
+  // Returns the spatial index of 'coordinates', for a feature db to
+  // store it prebuilt.
+  static HugePageVector<SpatialEntry> BuildSpatialIndex(
+      const FlatArray<Coordinate>& coordinates);
+
+  explicit FeatureStore(std::vector<Feature>&& features);
+
+  // Uses 'perfect_hash' and 'spatial_index' (which must be over
+  // 'coordinates') unless they're empty, building a 'PointIndex' and a
+  // spatial index otherwise.
+  FeatureStore(
+      FlatArray<Coordinate>&& coordinates,
+      std::unique_ptr<FeatureNames> names,
+      PerfectHashIndex&& perfect_hash = PerfectHashIndex(),
+      FlatArray<SpatialEntry>&& spatial_index = FlatArray<SpatialEntry>());
+
+  ~FeatureStore();
+
+  // Number of features, ids of features added by deltas may exceed it.
+  size_t size() const;
+
+  // Returns the id of the first feature at 'coordinate' or 'kNotFound'.
+  uint32_t Find(const Coordinate& coordinate) const {
+    uint32_t id = base_->perfect_hash.empty()
+        ? base_->point_index.Find(coordinate)
+        : base_->perfect_hash.Find(coordinate, base_->coordinates);
+    return overlay_ == nullptr ? id : FindInOverlay(coordinate, id);
+  }
+
+  // Batched 'Find()', see 'PointIndex::FindBatch()'.
+  void FindBatch(
+      const Coordinate* coordinates,
+      size_t count,
+      uint32_t* ids) const {
+    if (base_->perfect_hash.empty()) {
+      base_->point_index.FindBatch(coordinates, count, ids);
+    } else {
+      base_->perfect_hash.FindBatch(
+          coordinates,
+          count,
+          ids,
+          base_->coordinates);
+    }
+    if (overlay_ != nullptr) {
+      for (size_t i = 0; i < count; i++) {
+        ids[i] = FindInOverlay(coordinates[i], ids[i]);
+      }
+    }
+  }
+
+  // See 'PointIndex::Prefetch()'. Changes made by deltas aren't.
+  void Prefetch(const Coordinate& coordinate) const {
+    if (base_->perfect_hash.empty()) {
+      base_->point_index.Prefetch(coordinate);
+    } else {
+      base_->perfect_hash.Prefetch(coordinate);
+    }
+  }
+
+  // Appends the ids of all features within the rectangle spanned by
+  // 'lo' and 'hi' (inclusive) to 'ids', in db order.
+  void FindInRectangle(
+      const Coordinate& lo,
+      const Coordinate& hi,
+      std::vector<uint32_t>* ids) const;
+
+  const Coordinate& coordinate(uint32_t id) const {
+    return id < base_->coordinates.size()
+        ? base_->coordinates[id]
+        : AddedCoordinate(id);
+  }
+
+  std::string name(uint32_t id) const {
+    return overlay_ == nullptr ? base_->names->Get(id) : OverlayName(id);
+  }
+
+  // Like 'name()' but only copies the name into 'buffer' if it isn't
+  // resident, see 'FeatureNames::View()'.
+  std::string_view NameView(uint32_t id, NameBuffer* buffer) const;
+
+  // Returns the name of the feature at 'coordinate' or "".
+  std::string GetFeatureName(const Coordinate& coordinate) const;
+
+  // Sets the name of 'feature' to that of 'id' or, if it's 'kNotFound',
+  // to "", copying it once.
+  void CopyName(uint32_t id, Feature* feature) const;
+
+  // Returns whether 'id' (which may be 'kNotFound') is a feature with a
+  // name, i.e., one that 'RecordRoute' counts: the db has unnamed points.
+  bool IsNamed(uint32_t id) const {
+    NameBuffer buffer;
+    return id != kNotFound && !NameView(id, &buffer).empty();
+  }
+
+  Feature GetFeature(uint32_t id) const;
+
+  size_t MemoryUsage() const;
+
+  // Returns a deep copy, e.g., to place one on each NUMA node. Changes
+  // applied by deltas are shared rather than copied.
+  std::unique_ptr<FeatureStore> Clone() const;
+
+  // Returns a store with the changes of 'delta' applied in order or
+  // nullptr, setting 'error', if any of them doesn't apply (removing or
+  // renaming where there is no feature). This store is left as is, so
+  // readers can keep using it until the result is published.
+  std::unique_ptr<FeatureStore> ApplyDelta(
+      const std::vector<FeatureChange>& delta,
+      std::string* error) const;
+
+ private:
+  // Everything loaded or built from the db, which deltas don't change.
+  struct Base {
+    Base() = default;
+
+    Base(const Base& that);
+
+    FlatArray<Coordinate> coordinates;
+    std::unique_ptr<FeatureNames> names;
+    PerfectHashIndex perfect_hash;
+    PointIndex point_index;
+    // Every feature sorted by latitude.
+    FlatArray<SpatialEntry> spatial_index;
+  };
+
+  // Changes applied by deltas, defined in the .cc.
+  struct Overlay;
+
+  FeatureStore(const FeatureStore& that);
+
+  FeatureStore(
+      std::shared_ptr<const Base> base,
+      std::shared_ptr<const Overlay> overlay);
+
+  static void BuildIndexes(Base* base);
+
+  // Resolves the id 'Find()' got from the indexes against the overlay.
+  uint32_t FindInOverlay(const Coordinate& coordinate, uint32_t id) const;
+
+  const Coordinate& AddedCoordinate(uint32_t id) const;
+
+  std::string OverlayName(uint32_t id) const;
+
+  std::shared_ptr<const Base> base_;
+  // Null until a delta is applied.
+  std::shared_ptr<const Overlay> overlay_;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_STORE_H_
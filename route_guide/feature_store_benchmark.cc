@@ -0,0 +1,542 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Benchmarks of the feature store on a synthetic store, far larger
+// than route_guide_db.json, without a server in the way. Each prints a
+// before/after report:
+//
+//   --benchmark=names: the allocations and time of reading a feature's
+//     name for 'GetFeature' and 'RecordRoute', copied out of the names
+//     through 'name()' versus viewed through 'NameView()' (a response
+//     still owns a copy, so only 'RecordRoute' saves allocations).
+//   --benchmark=huge_pages: the time and data TLB misses of
+//     'GetFeature' lookups with the store allocated as --huge_pages
+//     says (run once per setting to compare them), and how much of the
+//     process is backed by huge pages.
+//   --benchmark=numa: the 'GetFeature' lookups per second of --threads
+//     threads spread over the NUMA nodes, reading a single store versus
+//     a 'ReplicatedFeatureStore' (a copy per node).
+//   --benchmark=find_batch: the lookups per second of a 'PointIndex'
+//     and a 'PerfectHashIndex' over the store's coordinates (half the
+//     lookups hits, half misses), one 'Find()' at a time versus
+//     'FindBatch()' and versus 'Prefetch()' a batch ahead of 'Find()'
+//     (as 'GetFeatureCallPool' does). Only an index larger than the
+//     last level cache shows a difference, e.g., --features=10000000.
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "coordinate.h"
+#include "feature_store.h"
+#include "flat_array.h"
+#include "helper.h"
+#include "huge_pages.h"
+#include "numa.h"
+#include "perfect_hash_index.h"
+#include "point_index.h"
+#include "protos/route_guide.grpc.pb.h"
+#include "replicated_feature_store.h"
+
+using routeguide::Coordinate;
+using routeguide::Feature;
+using routeguide::FeatureStore;
+using routeguide::FlatArray;
+using routeguide::HugePages;
+using routeguide::HugePageVector;
+using routeguide::InternedFeatureNames;
+using routeguide::NumaTopology;
+using routeguide::PerfectHashIndex;
+using routeguide::PointIndex;
+using routeguide::ReplicatedFeatureStore;
+
+namespace {
+
+// Every allocation made through 'operator new', counted so that a
+// benchmark can report how many a lookup makes.
+std::atomic<size_t> allocations{0};
+std::atomic<size_t> allocated_bytes{0};
+
+}  // namespace
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void* pointer = std::malloc(size == 0 ? 1 : size)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+// g++ 12 takes 'std::free()' of what it assumes came from the
+// (replaced) 'operator new' for a mismatch, though both use malloc.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  std::free(pointer);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace {
+
+// Keeps the results of the measured loops from being optimized away.
+volatile size_t sink = 0;
+
+// Counts the data TLB misses of the calling thread (in user space)
+// through 'perf_event_open()', if the kernel allows it (see
+// /proc/sys/kernel/perf_event_paranoid).
+class TlbMisses {
+ public:
+  TlbMisses() {
+    perf_event_attr attr = {};
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  ~TlbMisses() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  bool available() const { return fd_ >= 0; }
+
+  void Start() {
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+
+  uint64_t Stop() {
+    uint64_t count = 0;
+    if (fd_ < 0
+        || ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0) != 0
+        || read(fd_, &count, sizeof(count)) != sizeof(count)) {
+      return 0;
+    }
+    return count;
+  }
+
+ private:
+  int fd_ = -1;
+};
+
+// Prints the lines of /proc/self/smaps_rollup about huge pages.
+void PrintHugePageUsage() {
+  std::ifstream smaps("/proc/self/smaps_rollup");
+  std::string line;
+  while (std::getline(smaps, line)) {
+    if (line.find("Huge") != std::string::npos) {
+      std::cout << line << std::endl;
+    }
+  }
+}
+
+// Returns a store of 'count' features at random coordinates, named like
+// those of route_guide_db.json (one in ten unnamed, like its bare
+// points) if 'named', all unnamed otherwise.
+std::unique_ptr<FeatureStore> SyntheticStore(size_t count, bool named) {
+  static const char* kStreets[] = {
+      "Main Street", "Pine Road", "Lakeview Drive", "Route 23",
+      "Mountain Avenue", "Hickory Lane", "Ridge Road", "Sunset Boulevard"};
+  static const char* kTowns[] = {
+      "Newark, NJ", "Kinnelon, NJ", "Wallkill, NY", "Mahwah, NJ",
+      "Tuxedo, NY", "Sparta, NJ", "Warwick, NY", "Chester, NY"};
+  std::mt19937_64 random(count);
+  std::uniform_int_distribution<int32_t> latitude(-900000000, 900000000);
+  std::uniform_int_distribution<int32_t> longitude(
+      -1800000000,
+      1800000000);
+  HugePageVector<Coordinate> coordinates;
+  coordinates.reserve(count);
+  std::vector<std::string> names;
+  names.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    coordinates.push_back(Coordinate{latitude(random), longitude(random)});
+    if (!named || random() % 10 == 0) {
+      names.emplace_back();
+    } else {
+      names.push_back(
+          std::to_string(random() % 2000) + " " + kStreets[random() % 8]
+          + ", " + kTowns[random() % 8] + " "
+          + std::to_string(random() % 100000) + ", USA");
+    }
+  }
+  return std::make_unique<FeatureStore>(
+      FlatArray<Coordinate>(std::move(coordinates)),
+      std::make_unique<InternedFeatureNames>(std::move(names)));
+}
+
+// Runs 'lookup' on each of 'keys' and prints its time, allocations
+// and data TLB misses per call.
+template <typename Key, typename F>
+void Measure(const std::string& what, const std::vector<Key>& keys, F lookup) {
+  static TlbMisses tlb_misses;
+  size_t allocations_before = allocations.load();
+  size_t bytes_before = allocated_bytes.load();
+  tlb_misses.Start();
+  auto start = std::chrono::steady_clock::now();
+  size_t result = 0;
+  for (const Key& key : keys) {
+    result += lookup(key);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  uint64_t misses = tlb_misses.Stop();
+  sink = sink + result;
+  double count = keys.size();
+  double nanos = std::chrono::duration<double, std::nano>(elapsed).count();
+  std::cout << what << ": " << nanos / count << " ns, "
+            << (allocations.load() - allocations_before) / count
+            << " allocations, "
+            << (allocated_bytes.load() - bytes_before) / count
+            << " bytes allocated, ";
+  if (tlb_misses.available()) {
+    std::cout << misses / count << " dTLB misses";
+  } else {
+    std::cout << "(dTLB misses not available)";
+  }
+  std::cout << " per lookup" << std::endl;
+}
+
+int BenchmarkNames(
+    const FeatureStore& store,
+    const std::vector<uint32_t>& ids) {
+  Measure("GetFeature, before (name())", ids, [&](uint32_t id) {
+    Feature feature;
+    feature.set_name(store.name(id));
+    return feature.name().size();
+  });
+  Measure("GetFeature, after (CopyName())", ids, [&](uint32_t id) {
+    Feature feature;
+    store.CopyName(id, &feature);
+    return feature.name().size();
+  });
+  Measure("RecordRoute, before (!name().empty())", ids, [&](uint32_t id) {
+    return size_t(!store.name(id).empty());
+  });
+  Measure("RecordRoute, after (IsNamed())", ids, [&](uint32_t id) {
+    return size_t(store.IsNamed(id));
+  });
+  return 0;
+}
+
+int BenchmarkHugePages(
+    const FeatureStore& store,
+    const std::vector<uint32_t>& ids,
+    const std::string& huge_pages) {
+  std::vector<Coordinate> points;
+  points.reserve(ids.size());
+  for (uint32_t id : ids) {
+    points.push_back(store.coordinate(id));
+  }
+  Measure(
+      "GetFeature, --huge_pages=" + huge_pages,
+      points,
+      [&](const Coordinate& point) {
+        uint32_t id = store.Find(point);
+        Feature feature;
+        store.CopyName(id, &feature);
+        return size_t(id != FeatureStore::kNotFound);
+      });
+  PrintHugePageUsage();
+  return 0;
+}
+
+// Returns the 'GetFeature' lookups per second of 'threads' threads,
+// thread i pinned to node i % nodes, each looking up every point of
+// 'points' in the store 'store()' returns on it.
+template <typename F>
+double LookupsPerSecond(
+    const NumaTopology& topology,
+    size_t threads,
+    const std::vector<Coordinate>& points,
+    F store) {
+  std::atomic<size_t> unpinned{0};
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < threads; i++) {
+    workers.emplace_back([&, i]() {
+      if (!topology.PinToNode(i % topology.nodes())) {
+        unpinned++;
+      }
+      const FeatureStore& local = store();
+      size_t found = 0;
+      for (const Coordinate& point : points) {
+        uint32_t id = local.Find(point);
+        Feature feature;
+        local.CopyName(id, &feature);
+        found += id != FeatureStore::kNotFound;
+      }
+      sink = sink + found;
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  if (unpinned > 0) {
+    std::cerr << unpinned << " threads couldn't be pinned" << std::endl;
+  }
+  return threads * points.size()
+      / std::chrono::duration<double>(elapsed).count();
+}
+
+int BenchmarkNuma(
+    const FeatureStore& store,
+    const std::vector<uint32_t>& ids,
+    size_t threads) {
+  NumaTopology topology = NumaTopology::Detect();
+  std::cout << topology.nodes() << " NUMA nodes, " << threads
+            << " threads" << std::endl;
+  std::vector<Coordinate> points;
+  points.reserve(ids.size());
+  for (uint32_t id : ids) {
+    points.push_back(store.coordinate(id));
+  }
+
+  double single = LookupsPerSecond(topology, threads, points, [&]() {
+    return std::cref(store);
+  });
+  std::cout << "GetFeature, before (one store): " << single
+            << " lookups/s" << std::endl;
+
+  std::string error;
+  std::unique_ptr<ReplicatedFeatureStore> replicated =
+      ReplicatedFeatureStore::Replicate(store.Clone(), topology, &error);
+  if (!error.empty()) {
+    std::cerr << error << std::endl;
+  }
+  double local = LookupsPerSecond(topology, threads, points, [&]() {
+    return std::cref(replicated->Local());
+  });
+  std::cout << "GetFeature, after (" << replicated->replicas()
+            << " replicas): " << local << " lookups/s" << std::endl;
+  return 0;
+}
+
+// Returns how many of 'queries' per second 'lookup' looks up, given
+// all of them and an array for their ids.
+template <typename F>
+double FindRate(const std::vector<Coordinate>& queries, F lookup) {
+  std::vector<uint32_t> ids(queries.size());
+  auto start = std::chrono::steady_clock::now();
+  lookup(queries.data(), queries.size(), ids.data());
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  sink = sink + std::count(ids.begin(), ids.end(), PointIndex::kNotFound);
+  return queries.size() / std::chrono::duration<double>(elapsed).count();
+}
+
+// A 'PerfectHashIndex' with the coordinates it confirms lookups
+// against, to benchmark it like a 'PointIndex'. Only the index counts
+// towards its memory, the coordinates are the store's.
+class ConfirmedPerfectHashIndex {
+ public:
+  explicit ConfirmedPerfectHashIndex(const FlatArray<Coordinate>& indexed)
+    : index_(indexed),
+      indexed_(indexed) {}
+
+  uint32_t Find(const Coordinate& coordinate) const {
+    return index_.Find(coordinate, indexed_);
+  }
+
+  void FindBatch(
+      const Coordinate* coordinates,
+      size_t count,
+      uint32_t* ids) const {
+    index_.FindBatch(coordinates, count, ids, indexed_);
+  }
+
+  void Prefetch(const Coordinate& coordinate) const {
+    index_.Prefetch(coordinate);
+  }
+
+  size_t MemoryUsage() const { return index_.MemoryUsage(); }
+
+ private:
+  const PerfectHashIndex index_;
+  const FlatArray<Coordinate>& indexed_;
+};
+
+template <typename Index>
+void BenchmarkIndex(
+    const std::string& what,
+    const Index& index,
+    const std::vector<Coordinate>& queries) {
+  std::cout << what << " uses " << index.MemoryUsage() << " bytes"
+            << std::endl;
+  double find = FindRate(
+      queries,
+      [&](const Coordinate* coordinates, size_t count, uint32_t* ids) {
+        for (size_t i = 0; i < count; i++) {
+          ids[i] = index.Find(coordinates[i]);
+        }
+      });
+  std::cout << what << ", before (Find()): " << find << " lookups/s"
+            << std::endl;
+  double batch = FindRate(
+      queries,
+      [&](const Coordinate* coordinates, size_t count, uint32_t* ids) {
+        index.FindBatch(coordinates, count, ids);
+      });
+  std::cout << what << ", after (FindBatch()): " << batch << " lookups/s"
+            << std::endl;
+  double prefetch = FindRate(
+      queries,
+      [&](const Coordinate* coordinates, size_t count, uint32_t* ids) {
+        for (size_t i = 0; i < count; i += PointIndex::kBatchSize) {
+          size_t end = std::min(count, i + PointIndex::kBatchSize);
+          for (size_t j = i; j < end; j++) {
+            index.Prefetch(coordinates[j]);
+          }
+          for (size_t j = i; j < end; j++) {
+            ids[j] = index.Find(coordinates[j]);
+          }
+        }
+      });
+  std::cout << what << ", after (Prefetch() then Find()): " << prefetch
+            << " lookups/s" << std::endl;
+}
+
+int BenchmarkFindBatch(
+    const FeatureStore& store,
+    const std::vector<uint32_t>& ids) {
+  HugePageVector<Coordinate> coordinates;
+  coordinates.reserve(store.size());
+  for (uint32_t id = 0; id < store.size(); id++) {
+    coordinates.push_back(store.coordinate(id));
+  }
+  FlatArray<Coordinate> indexed(std::move(coordinates));
+
+  // Odd lookups are at random coordinates, which (almost) always miss.
+  std::vector<Coordinate> queries;
+  queries.reserve(ids.size());
+  std::mt19937 random(ids.size());
+  for (size_t i = 0; i < ids.size(); i++) {
+    queries.push_back(
+        i % 2 == 0
+            ? store.coordinate(ids[i])
+            : Coordinate{int32_t(random()), int32_t(random())});
+  }
+
+  BenchmarkIndex("PointIndex", PointIndex(indexed), queries);
+  BenchmarkIndex(
+      "PerfectHashIndex",
+      ConfirmedPerfectHashIndex(indexed),
+      queries);
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  // Expect args: --benchmark=names (or huge_pages, numa or find_batch),
+  // --features=1000000, --lookups=10000000, --huge_pages=none (or
+  // transparent or hugetlb), --threads=<number of cpus>.
+  std::string benchmark = routeguide::GetFlagValue(argc, argv, "benchmark");
+  HugePages huge_pages;
+  std::string huge_pages_flag =
+      routeguide::GetFlagValue(argc, argv, "huge_pages", "none");
+  if (!routeguide::ParseHugePages(huge_pages_flag, &huge_pages)) {
+    std::cerr << "Invalid --huge_pages=" << huge_pages_flag << std::endl;
+    return -1;
+  }
+  routeguide::SetHugePages(huge_pages);
+  size_t features = 0;
+  size_t lookups = 0;
+  size_t threads = 0;
+  if (!routeguide::GetFlagValue(argc, argv, "features", size_t(1000000),
+                                &features)
+      || !routeguide::GetFlagValue(argc, argv, "lookups", size_t(10000000),
+                                   &lookups)
+      || !routeguide::GetFlagValue(
+          argc,
+          argv,
+          "threads",
+          size_t(std::max(1u, std::thread::hardware_concurrency())),
+          &threads)) {
+    return -1;
+  }
+  if (benchmark != "names" && benchmark != "huge_pages"
+      && benchmark != "numa" && benchmark != "find_batch") {
+    std::cerr << "Invalid --benchmark=" << benchmark
+              << ", expected names, huge_pages, numa or find_batch"
+              << std::endl;
+    return -1;
+  }
+  if (features == 0 || threads == 0) {
+    std::cerr << "Invalid --features=0 or --threads=0, expected at least one"
+              << std::endl;
+    return -1;
+  }
+
+  // Names (which aren't allocated in huge pages) are left out when
+  // they're not measured, so that large stores fit in memory.
+  std::unique_ptr<FeatureStore> store =
+      SyntheticStore(features, benchmark == "names");
+  std::cout << "Built a store of " << features << " features using "
+            << store->MemoryUsage() << " bytes" << std::endl;
+
+  std::vector<uint32_t> ids(lookups);
+  std::mt19937 random(lookups);
+  for (uint32_t& id : ids) {
+    id = random() % features;
+  }
+
+  if (benchmark == "names") {
+    return BenchmarkNames(*store, ids);
+  } else if (benchmark == "huge_pages") {
+    return BenchmarkHugePages(*store, ids, huge_pages_flag);
+  } else if (benchmark == "find_batch") {
+    return BenchmarkFindBatch(*store, ids);
+  }
+  return BenchmarkNuma(*store, ids, threads);
+}
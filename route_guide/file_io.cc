@@ -0,0 +1,1069 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "file_io.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace routeguide {
+
+namespace {
+
+// Reads of the db are issued in chunks of this size, at offsets that
+// are multiples of it.
+const size_t kReadChunkSize = 1 << 20;
+
+// Runs the completions of 'io' (whose completions are polled) until
+// 'idle()', for its destructor.
+void RunCompletionsUntil(FileIo* io, const std::function<bool()>& idle) {
+  while (!idle()) {
+    pollfd ready = {io->completion_fd(), POLLIN, 0};
+    // The timeout only guards against a missed wakeup.
+    poll(&ready, 1, 100);
+    io->RunCompletions();
+  }
+}
+
+// Clears an eventfd, before running the completions it signaled so
+// that one signaled meanwhile sets it again.
+void ClearEventFd(int fd) {
+  uint64_t count = 0;
+  while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+  }
+}
+
+// io_uring through its raw syscalls (no liburing dependency). Requests
+// are submitted by the calling thread and completions are reaped, and
+// their callbacks run, by a single thread blocked in 'io_uring_enter()'
+// or, when polled, by 'RunCompletions()' once the eventfd registered
+// with the ring is signaled.
+//
+// Submitting never waits: a request made while every slot is taken
+// waits in a queue, and the reaper submits it into the first slot that
+// frees up. So callbacks (which run on the reaper) may submit requests.
+class IoUringFileIo final : public FileIo {
+ public:
+  static std::unique_ptr<FileIo> Create(
+      size_t queue_depth,
+      Completions completions);
+
+  ~IoUringFileIo() override;
+
+  void Read(
+      int fd,
+      uint64_t offset,
+      char* buffer,
+      size_t size,
+      FileIoCallback callback) override {
+    Submit(IORING_OP_READ, fd, offset, buffer, size, 0, std::move(callback));
+  }
+
+  void Write(
+      int fd,
+      uint64_t offset,
+      const char* buffer,
+      size_t size,
+      FileIoCallback callback) override {
+    Submit(
+        IORING_OP_WRITE,
+        fd,
+        offset,
+        buffer,
+        size,
+        0,
+        std::move(callback));
+  }
+
+  void Sync(int fd, FileIoCallback callback) override {
+    Submit(
+        IORING_OP_FSYNC,
+        fd,
+        0,
+        nullptr,
+        0,
+        IORING_FSYNC_DATASYNC,
+        std::move(callback));
+  }
+
+  int completion_fd() const override { return event_fd_; }
+
+  void RunCompletions() override;
+
+  const char* name() const override { return "io_uring"; }
+
+ private:
+  IoUringFileIo() = default;
+
+  struct Request {
+    uint8_t opcode;
+    int fd;
+    uint64_t offset;
+    const void* buffer;
+    size_t size;
+    uint32_t flags;
+    FileIoCallback callback;
+  };
+
+  void Submit(
+      uint8_t opcode,
+      int fd,
+      uint64_t offset,
+      const void* buffer,
+      size_t size,
+      uint32_t flags,
+      FileIoCallback callback);
+
+  // Submits 'request' into a free slot. Returns false, setting 'error'
+  // and leaving the request's callback to the caller (to call once
+  // 'mutex_' is released), if the kernel doesn't take it. Requires
+  // 'mutex_' and a free slot.
+  bool SubmitLocked(Request* request, int* error);
+
+  // Tells the reaper to stop, with a request that has no slot.
+  void SubmitStop();
+
+  void Reap();
+
+  // Runs the callbacks of the completions in the ring, returning true
+  // if one of them stops the reaper. Only one thread at a time reaps.
+  bool ReapReady();
+
+  // Whether nothing is in flight or waiting, with 'mutex_' held.
+  bool Idle() const {
+    return free_slots_.size() == callbacks_.size() && waiting_.empty();
+  }
+
+  // Fails every request in flight or waiting with 'error', for a ring
+  // that can't be reaped anymore, as well as every later request.
+  void Fail(int error);
+
+  int ring_fd_ = -1;
+  void* sq_ring_ = MAP_FAILED;
+  size_t sq_ring_size_ = 0;
+  void* cq_ring_ = MAP_FAILED;
+  size_t cq_ring_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_mask_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_mask_ = nullptr;
+  io_uring_cqe* cqes_ = nullptr;
+
+  // Registered with the ring when its completions are polled.
+  int event_fd_ = -1;
+  // Serializes 'RunCompletions()' (and a polled destructor's reaping).
+  std::mutex reap_mutex_;
+
+  std::mutex mutex_;
+  std::condition_variable idle_;
+  // The callbacks of the requests in flight, by slot (their 'user_data'
+  // less one, a 'user_data' of 0 stops the reaper).
+  std::vector<FileIoCallback> callbacks_;
+  std::vector<uint32_t> free_slots_;
+  // Requests made while every slot was taken, oldest first.
+  std::deque<Request> waiting_;
+  // The errno the ring failed with, if it did.
+  int error_ = 0;
+
+  std::thread reaper_;
+};
+
+std::unique_ptr<FileIo> IoUringFileIo::Create(
+    size_t queue_depth,
+    Completions completions) {
+  io_uring_params params = {};
+  int ring_fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+  if (ring_fd < 0) {
+    return nullptr;
+  }
+
+  std::unique_ptr<IoUringFileIo> io(new IoUringFileIo());
+  io->ring_fd_ = ring_fd;
+
+  // Plain reads and writes need Linux 5.6, as does probing for them.
+  std::vector<char> probe_buffer(
+      sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op));
+  auto* probe = reinterpret_cast<io_uring_probe*>(probe_buffer.data());
+  if (syscall(
+          __NR_io_uring_register,
+          ring_fd,
+          IORING_REGISTER_PROBE,
+          probe,
+          IORING_OP_LAST)
+          < 0
+      || probe->last_op < IORING_OP_WRITE
+      || !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+      || !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)) {
+    return nullptr;
+  }
+
+  // Never more in flight than submission entries, the completion
+  // queue (twice as large) then can't overflow.
+  io->callbacks_.resize(params.sq_entries);
+  for (uint32_t slot = params.sq_entries; slot > 0; slot--) {
+    io->free_slots_.push_back(slot - 1);
+  }
+
+  io->sq_ring_size_ =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  io->cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    io->sq_ring_size_ = io->cq_ring_size_ =
+        std::max(io->sq_ring_size_, io->cq_ring_size_);
+  }
+
+  io->sq_ring_ = mmap(
+      nullptr,
+      io->sq_ring_size_,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      ring_fd,
+      IORING_OFF_SQ_RING);
+  if (io->sq_ring_ == MAP_FAILED) {
+    return nullptr;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    io->cq_ring_ = io->sq_ring_;
+  } else {
+    io->cq_ring_ = mmap(
+        nullptr,
+        io->cq_ring_size_,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        ring_fd,
+        IORING_OFF_CQ_RING);
+    if (io->cq_ring_ == MAP_FAILED) {
+      return nullptr;
+    }
+  }
+  io->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(
+      nullptr,
+      io->sqes_size_,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      ring_fd,
+      IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return nullptr;
+  }
+  io->sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  char* sq = static_cast<char*>(io->sq_ring_);
+  io->sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  io->sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  io->sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  char* cq = static_cast<char*>(io->cq_ring_);
+  io->cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  io->cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  io->cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  io->cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  if (completions == Completions::kPolled) {
+    io->event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (io->event_fd_ < 0
+        || syscall(
+               __NR_io_uring_register,
+               ring_fd,
+               IORING_REGISTER_EVENTFD,
+               &io->event_fd_,
+               1)
+            < 0) {
+      return nullptr;
+    }
+  } else {
+    io->reaper_ = std::thread([io = io.get()]() { io->Reap(); });
+  }
+
+  return io;
+}
+
+IoUringFileIo::~IoUringFileIo() {
+  if (reaper_.joinable()) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      idle_.wait(lock, [this]() { return error_ != 0 || Idle(); });
+      // A failed ring's reaper has already stopped.
+      if (error_ == 0) {
+        SubmitStop();
+      }
+    }
+    reaper_.join();
+  } else if (event_fd_ >= 0) {
+    RunCompletionsUntil(this, [this]() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return Idle();
+    });
+  }
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != MAP_FAILED) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+  if (event_fd_ >= 0) {
+    close(event_fd_);
+  }
+}
+
+void IoUringFileIo::Submit(
+    uint8_t opcode,
+    int fd,
+    uint64_t offset,
+    const void* buffer,
+    size_t size,
+    uint32_t flags,
+    FileIoCallback callback) {
+  Request request{opcode, fd, offset, buffer, size, flags, std::move(callback)};
+  int error = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    error = error_;
+    if (error == 0 && free_slots_.empty()) {
+      waiting_.push_back(std::move(request));
+      return;
+    }
+    if (error == 0 && SubmitLocked(&request, &error)) {
+      return;
+    }
+  }
+  request.callback(-error);
+}
+
+bool IoUringFileIo::SubmitLocked(Request* request, int* error) {
+  // Only submitters (serialized by 'mutex_') write the tail.
+  unsigned tail = *sq_tail_;
+  unsigned index = tail & *sq_mask_;
+  uint32_t slot = free_slots_.back();
+  io_uring_sqe* sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = request->opcode;
+  sqe->fd = request->fd;
+  sqe->off = request->offset;
+  sqe->addr = reinterpret_cast<uint64_t>(request->buffer);
+  sqe->len = static_cast<uint32_t>(
+      std::min<size_t>(request->size, std::numeric_limits<int32_t>::max()));
+  sqe->fsync_flags = request->flags;
+  sqe->user_data = slot + 1;
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+  while (syscall(__NR_io_uring_enter, ring_fd_, 1, 0, 0, nullptr, 0) < 0) {
+    if (errno != EINTR) {
+      // Nothing was consumed (without SQPOLL the kernel only reads the
+      // ring in 'io_uring_enter()'), so the entry can be taken back.
+      *error = errno;
+      __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+      return false;
+    }
+  }
+  free_slots_.pop_back();
+  callbacks_[slot] = std::move(request->callback);
+  return true;
+}
+
+void IoUringFileIo::SubmitStop() {
+  unsigned tail = *sq_tail_;
+  unsigned index = tail & *sq_mask_;
+  io_uring_sqe* sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_NOP;
+  sqe->fd = -1;
+  sqe->user_data = 0;
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  // Only the destructor stops the reaper, so it can wait for the kernel
+  // to take the entry.
+  while (syscall(__NR_io_uring_enter, ring_fd_, 1, 0, 0, nullptr, 0) < 0
+         && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+    std::this_thread::yield();
+  }
+}
+
+void IoUringFileIo::Reap() {
+  while (true) {
+    if (syscall(
+            __NR_io_uring_enter,
+            ring_fd_,
+            0,
+            1,
+            IORING_ENTER_GETEVENTS,
+            nullptr,
+            0)
+            < 0
+        && errno != EINTR
+        && errno != EAGAIN
+        && errno != EBUSY) {
+      Fail(errno);
+      return;
+    }
+    if (ReapReady()) {
+      return;
+    }
+  }
+}
+
+void IoUringFileIo::RunCompletions() {
+  if (event_fd_ < 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> reap(reap_mutex_);
+  ClearEventFd(event_fd_);
+  ReapReady();
+}
+
+bool IoUringFileIo::ReapReady() {
+  // Only the reaper (or 'RunCompletions()') writes the head.
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  bool stop = false;
+  for (; head != tail; head++) {
+    const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+    uint64_t user_data = cqe.user_data;
+    int result = cqe.res;
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    if (user_data == 0) {
+      stop = true;
+      continue;
+    }
+
+    // Free the slot, and hand it to a waiting request, before running
+    // the callback (which may well submit the next request).
+    FileIoCallback callback;
+    std::vector<std::pair<FileIoCallback, int>> failed;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      callback = std::move(callbacks_[user_data - 1]);
+      callbacks_[user_data - 1] = nullptr;
+      free_slots_.push_back(user_data - 1);
+      while (!waiting_.empty() && !free_slots_.empty()) {
+        Request request = std::move(waiting_.front());
+        waiting_.pop_front();
+        int error = 0;
+        if (!SubmitLocked(&request, &error)) {
+          failed.emplace_back(std::move(request.callback), error);
+        }
+      }
+      if (Idle()) {
+        idle_.notify_all();
+      }
+    }
+
+    callback(result);
+    for (auto& [failed_callback, error] : failed) {
+      failed_callback(-error);
+    }
+  }
+  return stop;
+}
+
+void IoUringFileIo::Fail(int error) {
+  std::vector<FileIoCallback> failed;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    error_ = error;
+    for (FileIoCallback& callback : callbacks_) {
+      if (callback) {
+        failed.push_back(std::move(callback));
+        callback = nullptr;
+      }
+    }
+    for (Request& request : waiting_) {
+      failed.push_back(std::move(request.callback));
+    }
+    waiting_.clear();
+  }
+  idle_.notify_all();
+  for (FileIoCallback& callback : failed) {
+    callback(-error);
+  }
+}
+
+// Blocking 'pread()'/'pwrite()' on a pool of threads, for kernels
+// without io_uring (or where it's disabled, e.g., by seccomp). Requests
+// queue up for the threads, so submitting never waits either. When
+// polled, the threads queue up the completions instead of running them
+// and signal an eventfd.
+class ThreadPoolFileIo final : public FileIo {
+ public:
+  ThreadPoolFileIo(size_t queue_depth, Completions completions)
+    : queue_depth_(std::max<size_t>(queue_depth, 1)) {
+    if (completions == Completions::kPolled) {
+      event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (event_fd_ < 0) {
+        return;  // 'Create()' checks.
+      }
+    }
+    size_t threads = std::min<size_t>(queue_depth_, 8);
+    for (size_t i = 0; i < threads; i++) {
+      threads_.emplace_back([this]() { Work(); });
+    }
+  }
+
+  ~ThreadPoolFileIo() override {
+    if (event_fd_ >= 0) {
+      RunCompletionsUntil(this, [this]() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return in_flight_ == 0;
+      });
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      idle_.wait(lock, [this]() { return in_flight_ == 0; });
+      stopping_ = true;
+    }
+    work_.notify_all();
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+    if (event_fd_ >= 0) {
+      close(event_fd_);
+    }
+  }
+
+  void Read(
+      int fd,
+      uint64_t offset,
+      char* buffer,
+      size_t size,
+      FileIoCallback callback) override {
+    Submit([fd, offset, buffer, size]() {
+      return pread(fd, buffer, size, offset);
+    }, std::move(callback));
+  }
+
+  void Write(
+      int fd,
+      uint64_t offset,
+      const char* buffer,
+      size_t size,
+      FileIoCallback callback) override {
+    Submit([fd, offset, buffer, size]() {
+      return pwrite(fd, buffer, size, offset);
+    }, std::move(callback));
+  }
+
+  void Sync(int fd, FileIoCallback callback) override {
+    Submit([fd]() -> ssize_t { return fdatasync(fd); }, std::move(callback));
+  }
+
+  int completion_fd() const override { return event_fd_; }
+
+  void RunCompletions() override {
+    if (event_fd_ < 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> reap(reap_mutex_);
+    ClearEventFd(event_fd_);
+    std::deque<std::pair<FileIoCallback, ssize_t>> completed;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      completed.swap(completed_);
+    }
+    for (auto& [callback, result] : completed) {
+      callback(result);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      in_flight_ -= completed.size();
+    }
+    idle_.notify_all();
+  }
+
+  const char* name() const override { return "threads"; }
+
+ private:
+  struct Request {
+    std::function<ssize_t()> operation;
+    FileIoCallback callback;
+  };
+
+  void Submit(std::function<ssize_t()> operation, FileIoCallback callback) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      in_flight_++;
+      requests_.push_back(Request{std::move(operation), std::move(callback)});
+    }
+    work_.notify_one();
+  }
+
+  void Work() {
+    while (true) {
+      Request request;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_.wait(lock, [this]() { return stopping_ || !requests_.empty(); });
+        if (requests_.empty()) {
+          return;
+        }
+        request = std::move(requests_.front());
+        requests_.pop_front();
+      }
+      ssize_t result = request.operation();
+      if (result < 0) {
+        result = -errno;
+      }
+      if (event_fd_ >= 0) {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          completed_.emplace_back(std::move(request.callback), result);
+        }
+        uint64_t one = 1;
+        while (write(event_fd_, &one, sizeof(one)) < 0 && errno == EINTR) {
+        }
+        continue;
+      }
+      request.callback(result);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        in_flight_--;
+      }
+      idle_.notify_all();
+    }
+  }
+
+  const size_t queue_depth_;
+  // Signaled as completions are queued when they're polled.
+  int event_fd_ = -1;
+  std::mutex reap_mutex_;
+  std::mutex mutex_;
+  std::condition_variable work_;
+  std::condition_variable idle_;
+  std::deque<Request> requests_;
+  // Completed requests' callbacks (and results) waiting to be run.
+  std::deque<std::pair<FileIoCallback, ssize_t>> completed_;
+  // Including the completed ones whose callbacks haven't run yet.
+  size_t in_flight_ = 0;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace
+
+bool FileIo::ParseBackend(const std::string& value, Backend* backend) {
+  if (value == "auto") {
+    *backend = Backend::kAuto;
+  } else if (value == "io_uring") {
+    *backend = Backend::kIoUring;
+  } else if (value == "threads") {
+    *backend = Backend::kThreadPool;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<FileIo> FileIo::Create(
+    Backend backend,
+    size_t queue_depth,
+    Completions completions) {
+  if (backend != Backend::kThreadPool) {
+    std::unique_ptr<FileIo> io =
+        IoUringFileIo::Create(queue_depth, completions);
+    if (io || backend == Backend::kIoUring) {
+      return io;
+    }
+  }
+  auto io = std::make_unique<ThreadPoolFileIo>(queue_depth, completions);
+  if (completions == Completions::kPolled && io->completion_fd() < 0) {
+    return nullptr;
+  }
+  return io;
+}
+
+bool ReadFileContents(
+    FileIo* io,
+    const std::string& path,
+    std::string* contents,
+    std::string* error,
+    size_t parallelism) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    *error = "failed to open '" + path + "': " + std::strerror(errno);
+    return false;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    *error = "failed to stat '" + path + "': " + std::strerror(errno);
+    close(fd);
+    return false;
+  }
+  contents->resize(status.st_size);
+
+  struct State {
+    std::mutex mutex;
+    std::condition_variable done;
+    uint64_t next = 0;
+    size_t pending = 0;
+    int error = 0;
+  } state;
+
+  // Reads [offset, end) of the current chunk, continuing after short
+  // reads and moving on to the next chunk when done.
+  std::function<void(uint64_t, uint64_t)> read;
+  read = [&](uint64_t offset, uint64_t end) {
+    io->Read(
+        fd,
+        offset,
+        contents->data() + offset,
+        end - offset,
+        [&, offset, end](ssize_t result) {
+          std::unique_lock<std::mutex> lock(state.mutex);
+          if (result == 0) {
+            result = -EIO;  // The file shrank while being read.
+          }
+          if (result < 0 || state.error != 0) {
+            state.error = state.error != 0 ? state.error : -result;
+          } else if (offset + result < end) {
+            lock.unlock();
+            read(offset + result, end);
+            return;
+          } else if (state.next < contents->size()) {
+            uint64_t next = state.next;
+            state.next = std::min<uint64_t>(
+                next + kReadChunkSize,
+                contents->size());
+            uint64_t next_end = state.next;
+            lock.unlock();
+            read(next, next_end);
+            return;
+          }
+          if (--state.pending == 0) {
+            state.done.notify_one();
+          }
+        });
+  };
+
+  {
+    std::unique_lock<std::mutex> lock(state.mutex);
+    while (state.pending < std::max<size_t>(parallelism, 1)
+           && state.next < contents->size()) {
+      uint64_t offset = state.next;
+      state.next = std::min<uint64_t>(
+          offset + kReadChunkSize,
+          contents->size());
+      state.pending++;
+      uint64_t end = state.next;
+      lock.unlock();
+      read(offset, end);
+      lock.lock();
+    }
+    state.done.wait(lock, [&state]() { return state.pending == 0; });
+  }
+
+  close(fd);
+
+  if (state.error != 0) {
+    *error = "failed to read '" + path + "': " + std::strerror(state.error);
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<FileChunkReader> FileChunkReader::Open(
+    FileIo* io,
+    const std::string& path,
+    size_t chunk_size,
+    std::string* error) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    *error = "failed to open '" + path + "': " + std::strerror(errno);
+    return nullptr;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    *error = "failed to stat '" + path + "': " + std::strerror(errno);
+    close(fd);
+    return nullptr;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  return std::unique_ptr<FileChunkReader>(new FileChunkReader(
+      io,
+      path,
+      fd,
+      status.st_size,
+      std::max<size_t>(chunk_size, 1)));
+}
+
+FileChunkReader::~FileChunkReader() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return !reading_ && !dispatching_; });
+  }
+  close(fd_);
+}
+
+void FileChunkReader::Next(Callback callback) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  callback_ = std::move(callback);
+  if (!ready_ && !reading_ && StartRead(lock)) {
+    lock.unlock();
+    IssueRead();
+    lock.lock();
+  }
+  Dispatch(lock);
+}
+
+std::string FileChunkReader::error() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return error_;
+}
+
+bool FileChunkReader::StartRead(std::unique_lock<std::mutex>&) {
+  if (!error_.empty() || offset_ >= size_) {
+    ready_chunk_.clear();
+    ready_ = true;
+    return false;
+  }
+  reading_chunk_.resize(std::min<uint64_t>(chunk_size_, size_ - offset_));
+  reading_ = true;
+  return true;
+}
+
+void FileChunkReader::IssueRead() {
+  // Nothing else touches the chunk being read (or 'offset_') until
+  // 'OnRead()' clears 'reading_'.
+  io_->Read(
+      fd_,
+      offset_,
+      reading_chunk_.data(),
+      reading_chunk_.size(),
+      [this](ssize_t result) { OnRead(result); });
+}
+
+void FileChunkReader::OnRead(ssize_t result) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (result == 0) {
+    result = -EIO;  // The file shrank while being read.
+  }
+  if (result < 0) {
+    error_ = "failed to read '" + path_ + "': " + std::strerror(-result);
+    ready_chunk_.clear();
+  } else {
+    // A short read just makes for a shorter chunk.
+    reading_chunk_.resize(result);
+    offset_ += result;
+    ready_chunk_ = std::move(reading_chunk_);
+    reading_chunk_ = std::string();
+  }
+  reading_ = false;
+  ready_ = true;
+  Dispatch(lock);
+  idle_.notify_all();
+}
+
+void FileChunkReader::Dispatch(std::unique_lock<std::mutex>& lock) {
+  if (dispatching_) {
+    return;
+  }
+  dispatching_ = true;
+  while (callback_ && ready_) {
+    Callback callback = std::move(callback_);
+    callback_ = nullptr;
+    std::string chunk = std::move(ready_chunk_);
+    ready_chunk_ = std::string();
+    ready_ = false;
+    // Read ahead while 'callback' consumes this chunk.
+    bool issue = !chunk.empty() && StartRead(lock);
+    lock.unlock();
+    if (issue) {
+      IssueRead();
+    }
+    callback(std::move(chunk));
+    lock.lock();
+  }
+  dispatching_ = false;
+  idle_.notify_all();
+}
+
+std::unique_ptr<AppendLog> AppendLog::Open(
+    FileIo* io,
+    const std::string& path,
+    uint64_t size,
+    bool sync,
+    size_t buffer_limit,
+    std::string* error) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    *error = "failed to open '" + path + "': " + std::strerror(errno);
+    return nullptr;
+  }
+  if (ftruncate(fd, size) != 0) {
+    *error = "failed to truncate '" + path + "': " + std::strerror(errno);
+    close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<AppendLog>(new AppendLog(
+      io,
+      path,
+      fd,
+      size,
+      sync,
+      std::max<size_t>(buffer_limit, 1)));
+}
+
+AppendLog::~AppendLog() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return !busy_ && finishing_ == 0; });
+  }
+  close(fd_);
+}
+
+char* AppendLog::Reserve(size_t size) {
+  if (!error_.empty() || appended_.size() + size > buffer_limit_) {
+    return nullptr;
+  }
+  size_t offset = appended_.size();
+  appended_.resize(offset + size);
+  appended_bytes_ += size;
+  return appended_.data() + offset;
+}
+
+void AppendLog::Flush(FlushCallback callback) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!error_.empty() || written_bytes_ == appended_bytes_) {
+    bool ok = error_.empty();
+    lock.unlock();
+    callback(ok);
+    return;
+  }
+  flushes_.emplace_back(appended_bytes_, std::move(callback));
+}
+
+std::string AppendLog::error() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return error_;
+}
+
+void AppendLog::StartWrite(std::unique_lock<std::mutex>& lock) {
+  writing_.swap(appended_);
+  appended_.clear();
+  busy_ = true;
+  lock.unlock();
+  IssueWrite(0);
+  lock.lock();
+}
+
+void AppendLog::IssueWrite(size_t written) {
+  // Nothing else touches 'writing_' (or 'offset_') until 'Finish()'.
+  io_->Write(
+      fd_,
+      offset_ + written,
+      writing_.data() + written,
+      writing_.size() - written,
+      [this, written](ssize_t result) { OnWritten(written, result); });
+}
+
+void AppendLog::OnWritten(size_t written, ssize_t result) {
+  if (result == 0) {
+    result = -EIO;  // No progress, e.g., the disk is full.
+  }
+  if (result > 0 && written + result < writing_.size()) {
+    IssueWrite(written + result);
+    return;
+  }
+  if (result > 0 && sync_) {
+    io_->Sync(fd_, [this](ssize_t result) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      Finish(lock, result < 0 ? -result : 0);
+    });
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  Finish(lock, result < 0 ? -result : 0);
+}
+
+void AppendLog::Finish(std::unique_lock<std::mutex>& lock, int error) {
+  bool ok = error == 0;
+  std::vector<FlushCallback> settled;
+  if (ok) {
+    offset_ += writing_.size();
+    written_bytes_ += writing_.size();
+    // Flushes are ordered by the bytes they wait for.
+    auto last = std::find_if(
+        flushes_.begin(),
+        flushes_.end(),
+        [this](const auto& flush) { return flush.first > written_bytes_; });
+    for (auto flush = flushes_.begin(); flush != last; ++flush) {
+      settled.push_back(std::move(flush->second));
+    }
+    flushes_.erase(flushes_.begin(), last);
+  } else {
+    if (error_.empty()) {
+      error_ = "failed to write '" + path_ + "': " + std::strerror(error);
+    }
+    appended_.clear();
+    for (auto& flush : flushes_) {
+      settled.push_back(std::move(flush.second));
+    }
+    flushes_.clear();
+  }
+  writing_.clear();
+  bool next = ok && !appended_.empty();
+  if (next) {
+    writing_.swap(appended_);
+  } else {
+    busy_ = false;
+  }
+  finishing_++;
+  lock.unlock();
+
+  if (next) {
+    IssueWrite(0);
+  }
+  for (FlushCallback& callback : settled) {
+    callback(ok);
+  }
+
+  lock.lock();
+  finishing_--;
+  idle_.notify_all();
+  lock.unlock();
+}
+
+}  // namespace routeguide
@@ -0,0 +1,315 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_FILE_IO_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_FILE_IO_H_
+
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace routeguide {
+
+// Called with the number of bytes transferred (zero for a sync) or
+// -errno. Runs on one of the I/O layer's own threads (or, see
+// 'FileIo::Completions', the thread running its completions), or right
+// away on the calling one if the request can't be submitted at all, so
+// it must not block. It may make further requests, which never wait.
+using FileIoCallback = std::function<void(ssize_t result)>;
+
+// Asynchronous positional file reads and writes, so that callers (RPC
+// threads in particular) never block in a file syscall. Like 'pread()'
+// and 'pwrite()' a request may complete short.
+class FileIo {
+ public:
+  enum class Backend {
+    // io_uring if the kernel supports it, otherwise a thread pool.
+    kAuto,
+    kIoUring,
+    kThreadPool,
+  };
+
+  // Where callbacks run.
+  enum class Completions {
+    // On threads of the I/O layer's own.
+    kOwnThreads,
+    // On whichever thread calls 'RunCompletions()', e.g., an event
+    // loop's once 'completion_fd()' is readable (see 'FileIoWatcher').
+    kPolled,
+  };
+
+  // Parses "auto", "io_uring" or "threads".
+  static bool ParseBackend(const std::string& value, Backend* backend);
+
+  // Returns nullptr if 'backend' is 'kIoUring' and io_uring isn't
+  // available, or if polled completions can't be set up (no eventfd).
+  // 'queue_depth' bounds the requests in flight, further ones are queued
+  // until one completes. If io_uring fails (other than for a single
+  // request) the requests in flight and queued, and any made later,
+  // fail.
+  static std::unique_ptr<FileIo> Create(
+      Backend backend,
+      size_t queue_depth = 64,
+      Completions completions = Completions::kOwnThreads);
+
+  // Waits for the requests in flight, running their completions itself
+  // if they're polled.
+  virtual ~FileIo() = default;
+
+  virtual void Read(
+      int fd,
+      uint64_t offset,
+      char* buffer,
+      size_t size,
+      FileIoCallback callback) = 0;
+
+  virtual void Write(
+      int fd,
+      uint64_t offset,
+      const char* buffer,
+      size_t size,
+      FileIoCallback callback) = 0;
+
+  // Flushes the data written to 'fd' (not necessarily its metadata,
+  // like 'fdatasync()') to storage.
+  virtual void Sync(int fd, FileIoCallback callback) = 0;
+
+  // With 'Completions::kPolled', an eventfd that's readable while
+  // there are completions to run, otherwise -1.
+  virtual int completion_fd() const = 0;
+
+  // With 'Completions::kPolled', runs the callbacks of the requests
+  // completed so far without waiting for any others. Calls are
+  // serialized, so it must not be called from a callback.
+  virtual void RunCompletions() = 0;
+
+  virtual const char* name() const = 0;
+};
+
+// Reads all of the file at 'path' into 'contents' with up to
+// 'parallelism' large, aligned reads in flight at once. Blocks the
+// calling thread (but no other) until done.
+bool ReadFileContents(
+    FileIo* io,
+    const std::string& path,
+    std::string* contents,
+    std::string* error,
+    size_t parallelism = 8);
+
+// Reads a file front to back a chunk at a time, reading the next chunk
+// while the current one is being consumed so at most two chunks are in
+// memory at once.
+class FileChunkReader {
+ public:
+  // Called with the next chunk, which is empty at the end of the file
+  // or after an error.
+  using Callback = std::function<void(std::string&& chunk)>;
+
+  // Returns nullptr (and sets 'error') if 'path' can't be opened.
+  static std::unique_ptr<FileChunkReader> Open(
+      FileIo* io,
+      const std::string& path,
+      size_t chunk_size,
+      std::string* error);
+
+  // Waits for the read in flight, if any.
+  ~FileChunkReader();
+
+  // Calls 'callback' with the next chunk, right away if it has already
+  // been read and otherwise from the I/O layer's thread. Calling 'Next()'
+  // again from within 'callback' is fine, it doesn't recurse.
+  void Next(Callback callback);
+
+  // Set once the file couldn't be read to the end.
+  std::string error() const;
+
+ private:
+  FileChunkReader(
+      FileIo* io,
+      const std::string& path,
+      int fd,
+      uint64_t size,
+      size_t chunk_size)
+    : io_(io),
+      path_(path),
+      fd_(fd),
+      size_(size),
+      chunk_size_(chunk_size) {}
+
+  // Starts reading the chunk after the one being handed out, returning
+  // false if nothing is left to read (the end of the file is "read"
+  // right away).
+  bool StartRead(std::unique_lock<std::mutex>& lock);
+
+  void IssueRead();
+
+  void OnRead(ssize_t result);
+
+  // Hands out ready chunks while there are callbacks waiting for them,
+  // unless a call further up the stack is already doing that.
+  void Dispatch(std::unique_lock<std::mutex>& lock);
+
+  FileIo* const io_;
+  const std::string path_;
+  const int fd_;
+  const uint64_t size_;
+  const size_t chunk_size_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable idle_;
+  uint64_t offset_ = 0;
+  std::string reading_chunk_;
+  bool reading_ = false;
+  std::string ready_chunk_;
+  bool ready_ = false;
+  Callback callback_;
+  bool dispatching_ = false;
+  std::string error_;
+};
+
+// Appends records to a file through 'FileIo', one write at a time: the
+// records appended while a write is in flight all go out together in
+// the next one (and, if the log syncs, are made durable by a single
+// sync), so any number of appenders cost one write per round trip to
+// storage. Appending only copies into memory, never waiting on the
+// file, so it's fine from RPC handlers and 'FileIo' callbacks alike.
+class AppendLog {
+ public:
+  // Called once everything appended before the 'Flush()' is written
+  // (and synced), with false if any of it couldn't be.
+  using FlushCallback = std::function<void(bool ok)>;
+
+  // Opens 'path' for appending after its first 'size' bytes, creating
+  // it if needed and truncating anything after them (e.g., a record
+  // torn by a crash). If 'sync' every write is followed by a sync. At
+  // most 'buffer_limit' bytes wait for the write in flight, see
+  // 'Append()'. Returns nullptr (and sets 'error') if 'path' can't be
+  // opened.
+  static std::unique_ptr<AppendLog> Open(
+      FileIo* io,
+      const std::string& path,
+      uint64_t size,
+      bool sync,
+      size_t buffer_limit,
+      std::string* error);
+
+  // Writes whatever was appended, waiting for it. Must not be called
+  // from the thread that runs the 'FileIo' callbacks.
+  ~AppendLog();
+
+  // Returns false, appending nothing, if 'record' doesn't fit in the
+  // 'buffer_limit' bytes waiting or after a write failed.
+  bool Append(const std::string& record) {
+    return Append(record.size(), [&record](char* buffer) {
+      record.copy(buffer, record.size());
+    });
+  }
+
+  // Same, for a 'size' byte record that 'encode' writes straight into
+  // the buffer. It runs with the log's lock held, so it should only
+  // copy.
+  template <typename Encode>
+  bool Append(size_t size, Encode&& encode) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    char* buffer = Reserve(size);
+    if (buffer == nullptr) {
+      return false;
+    }
+    encode(buffer);
+    // Otherwise the write in flight starts the next one once it's done.
+    if (!busy_) {
+      StartWrite(lock);
+    }
+    return true;
+  }
+
+  // Calls 'callback' once the records appended so far are written,
+  // right away if they already are.
+  void Flush(FlushCallback callback);
+
+  // Set once a write (or sync) failed, nothing is written after that.
+  std::string error() const;
+
+ private:
+  AppendLog(
+      FileIo* io,
+      const std::string& path,
+      int fd,
+      uint64_t size,
+      bool sync,
+      size_t buffer_limit)
+    : io_(io),
+      path_(path),
+      fd_(fd),
+      sync_(sync),
+      buffer_limit_(buffer_limit),
+      offset_(size) {}
+
+  // Returns where to encode 'size' more bytes in the buffer, or nullptr
+  // if they don't fit or a write failed. Requires 'mutex_'.
+  char* Reserve(size_t size);
+
+  // Moves the appended records into the write buffer and writes them,
+  // with 'mutex_' held (and released while the write is issued).
+  void StartWrite(std::unique_lock<std::mutex>& lock);
+
+  // Writes what's left of the write buffer from 'written' on.
+  void IssueWrite(size_t written);
+
+  void OnWritten(size_t written, ssize_t result);
+
+  // Moves on once the write buffer is on file, or a write failed with
+  // 'error', and runs the flushes that settles. Takes 'mutex_' held and
+  // leaves it released.
+  void Finish(std::unique_lock<std::mutex>& lock, int error);
+
+  FileIo* const io_;
+  const std::string path_;
+  const int fd_;
+  const bool sync_;
+  const size_t buffer_limit_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable idle_;
+  // Appended but not yet being written.
+  std::string appended_;
+  // Being written at 'offset_', only touched by the write in flight.
+  std::string writing_;
+  bool busy_ = false;
+  uint64_t offset_;
+  // Bytes ever appended, and of those the ones written.
+  uint64_t appended_bytes_ = 0;
+  uint64_t written_bytes_ = 0;
+  // Flushes waiting for the bytes appended before them to be written.
+  std::vector<std::pair<uint64_t, FlushCallback>> flushes_;
+  // 'Finish()' calls still running flushes, which may use the log.
+  size_t finishing_ = 0;
+  std::string error_;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_FILE_IO_H_
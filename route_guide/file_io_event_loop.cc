@@ -0,0 +1,51 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "file_io_event_loop.h"
+
+namespace routeguide {
+
+FileIoWatcher::FileIoWatcher(FileIo* io, ::eventuals::EventLoop& loop)
+  : io_(io) {
+  poll_.data = this;
+  stop_.data = this;
+  uv_poll_init(loop, &poll_, io_->completion_fd());
+  uv_poll_start(&poll_, UV_READABLE, [](uv_poll_t* poll, int, int) {
+    static_cast<FileIoWatcher*>(poll->data)->io_->RunCompletions();
+  });
+  uv_async_init(loop, &stop_, [](uv_async_t* stop) {
+    auto* watcher = static_cast<FileIoWatcher*>(stop->data);
+    auto closed = [](uv_handle_t* handle) {
+      auto* watcher = static_cast<FileIoWatcher*>(handle->data);
+      if (--watcher->open_handles_ == 0) {
+        watcher->closed_.set_value();
+      }
+    };
+    uv_poll_stop(&watcher->poll_);
+    uv_close(reinterpret_cast<uv_handle_t*>(&watcher->poll_), closed);
+    uv_close(reinterpret_cast<uv_handle_t*>(&watcher->stop_), closed);
+  });
+}
+
+FileIoWatcher::~FileIoWatcher() {
+  std::future<void> closed = closed_.get_future();
+  uv_async_send(&stop_);
+  closed.wait();
+}
+
+}  // namespace routeguide
@@ -0,0 +1,61 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_FILE_IO_EVENT_LOOP_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_FILE_IO_EVENT_LOOP_H_
+
+#include <future>
+
+#include "eventuals/event-loop.h"
+#include "file_io.h"
+#include "uv.h"
+
+namespace routeguide {
+
+// Runs the callbacks of a 'FileIo' created with polled completions on
+// an eventuals event loop, whenever its 'completion_fd()' is readable,
+// rather than on threads of the I/O layer's own. Callbacks then run on
+// the same thread as the rest of the loop's work, so they must not
+// block it either.
+class FileIoWatcher {
+ public:
+  // Starts watching 'io', which must outlive the watcher. libuv handles
+  // can only be started on the loop's thread, so this has to be called
+  // before 'loop' runs.
+  FileIoWatcher(FileIo* io, ::eventuals::EventLoop& loop);
+
+  FileIoWatcher(const FileIoWatcher&) = delete;
+  FileIoWatcher& operator=(const FileIoWatcher&) = delete;
+
+  // Stops watching, waiting for the loop (which must still be running)
+  // to close the handles. Completions after that are left to the
+  // 'FileIo' destructor.
+  ~FileIoWatcher();
+
+ private:
+  FileIo* const io_;
+  uv_poll_t poll_;
+  uv_async_t stop_;
+  // Handles still to be closed once stopping.
+  int open_handles_ = 2;
+  std::promise<void> closed_;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_FILE_IO_EVENT_LOOP_H_
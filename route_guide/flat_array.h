@@ -0,0 +1,91 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_FLAT_ARRAY_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_FLAT_ARRAY_H_
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "huge_pages.h"
+
+namespace routeguide {
+
+// Immutable array that either owns its elements or views elements in
+// memory owned by something else (e.g., a shared mapping of a feature
+// db) kept alive by 'owner'. Copies always own their elements.
+template <typename T>
+class FlatArray {
+ public:
+  FlatArray() = default;
+
+  FlatArray(HugePageVector<T>&& elements)
+    : owned_(std::move(elements)),
+      data_(owned_.data()),
+      size_(owned_.size()) {}
+
+  FlatArray(const T* data, size_t size, std::shared_ptr<const void> owner)
+    : owner_(std::move(owner)),
+      data_(data),
+      size_(size) {}
+
+  FlatArray(const FlatArray& that)
+    : owned_(that.begin(), that.end()),
+      data_(owned_.data()),
+      size_(owned_.size()) {}
+
+  FlatArray(FlatArray&& that) noexcept
+    : owned_(std::move(that.owned_)),
+      owner_(std::move(that.owner_)),
+      data_(std::exchange(that.data_, nullptr)),
+      size_(std::exchange(that.size_, 0)) {}
+
+  FlatArray& operator=(FlatArray that) noexcept {
+    owned_.swap(that.owned_);
+    owner_.swap(that.owner_);
+    std::swap(data_, that.data_);
+    std::swap(size_, that.size_);
+    return *this;
+  }
+
+  const T* data() const { return data_; }
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  const T& operator[](size_t i) const { return data_[i]; }
+
+  const T* begin() const { return data_; }
+
+  const T* end() const { return data_ + size_; }
+
+  // Bytes this array allocated, zero for a view.
+  size_t MemoryUsage() const { return owned_.capacity() * sizeof(T); }
+
+ private:
+  HugePageVector<T> owned_;
+  std::shared_ptr<const void> owner_;
+  const T* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_FLAT_ARRAY_H_
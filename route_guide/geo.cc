@@ -0,0 +1,65 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "geo.h"
+
+#include <cmath>
+
+#include "protos/route_guide.grpc.pb.h"
+
+namespace routeguide {
+
+float ConvertToRadians(float num) {
+  return num * 3.1415926 /180;
+}
+
+// The formula is based on http://mathforum.org/library/drmath/view/51879.html
+float GetDistance(const Point& start, const Point& end) {
+  float lat_1 = start.latitude() / float(kCoordFactor);
+  float lat_2 = end.latitude() / float(kCoordFactor);
+  float lon_1 = start.longitude() / float(kCoordFactor);
+  float lon_2 = end.longitude() / float(kCoordFactor);
+  float lat_rad_1 = ConvertToRadians(lat_1);
+  float lat_rad_2 = ConvertToRadians(lat_2);
+  float delta_lat_rad = ConvertToRadians(lat_2-lat_1);
+  float delta_lon_rad = ConvertToRadians(lon_2-lon_1);
+
+  float a = pow(sin(delta_lat_rad/2), 2) + cos(lat_rad_1) * cos(lat_rad_2) *
+            pow(sin(delta_lon_rad/2), 2);
+  float c = 2 * atan2(sqrt(a), sqrt(1-a));
+  int R = kEarthRadius;
+
+  return R * c;
+}
+
+double GreatCircleDistance(const Coordinate& start, const Coordinate& end) {
+  double lat_rad_1 = start.latitude / kCoordFactor * 3.1415926 / 180;
+  double lat_rad_2 = end.latitude / kCoordFactor * 3.1415926 / 180;
+  double delta_lat_rad = lat_rad_2 - lat_rad_1;
+  double delta_lon_rad =
+      (double(end.longitude) - start.longitude) / kCoordFactor
+      * 3.1415926 / 180;
+
+  double a = std::pow(std::sin(delta_lat_rad / 2), 2)
+      + std::cos(lat_rad_1) * std::cos(lat_rad_2)
+          * std::pow(std::sin(delta_lon_rad / 2), 2);
+  double c = 2 * std::atan2(std::sqrt(a), std::sqrt(1 - a));
+  return kEarthRadius * c;
+}
+
+}  // namespace routeguide
@@ -0,0 +1,45 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_GEO_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_GEO_H_
+
+#include "coordinate.h"
+
+namespace routeguide {
+class Point;
+
+// Coordinates are in degrees multiplied by 'kCoordFactor'.
+constexpr double kCoordFactor = 10000000.0;
+
+// Mean radius of the earth, in metres.
+constexpr double kEarthRadius = 6371000;
+
+float ConvertToRadians(float num);
+
+// Great circle distance in metres between two points, as computed by
+// every server for 'RecordRoute' (in single precision, which is what
+// clients have always been sent).
+float GetDistance(const Point& start, const Point& end);
+
+// Same as 'GetDistance()' in double precision.
+double GreatCircleDistance(const Coordinate& start, const Coordinate& end);
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_GEO_H_
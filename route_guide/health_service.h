@@ -0,0 +1,198 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_HEALTH_SERVICE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_HEALTH_SERVICE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "eventuals/stream.h"
+#include "protos/health.eventuals.h"
+#include "protos/health.grpc.pb.h"
+
+namespace routeguide {
+
+// Implements 'grpc.health.v1.Health' for a fixed set of services which
+// all report NOT_SERVING until 'SetServing(true)', e.g., until the
+// feature indexes have been built.
+//
+// Watches stay open, parked until 'SetServing()' changes the status
+// (or the call is cancelled, or 'Shutdown()', which must be called
+// before the server is shut down for its calls to end).
+class HealthImpl final
+  : public ::grpc::health::v1::eventuals::Health::Service<HealthImpl> {
+ public:
+  using HealthCheckRequest = ::grpc::health::v1::HealthCheckRequest;
+  using HealthCheckResponse = ::grpc::health::v1::HealthCheckResponse;
+
+  // "" (the server as a whole) is always included in 'services'.
+  explicit HealthImpl(std::vector<std::string> services)
+    : services_(std::move(services)) {
+    services_.push_back("");
+  }
+
+  void SetServing(bool serving) {
+    std::vector<Watcher> watchers;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (serving_.load(std::memory_order_relaxed) == serving) {
+        return;
+      }
+      serving_.store(serving, std::memory_order_release);
+      watchers.swap(watchers_);
+    }
+    for (Watcher& watcher : watchers) {
+      watcher.resume();
+    }
+  }
+
+  // Ends all watches, now and from now on.
+  void Shutdown() {
+    std::vector<Watcher> watchers;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      shutdown_ = true;
+      watchers.swap(watchers_);
+    }
+    for (Watcher& watcher : watchers) {
+      watcher.resume();
+    }
+  }
+
+  // NOTE: an unknown service is reported as SERVICE_UNKNOWN rather than
+  // by failing the call with NOT_FOUND.
+  auto Check(::grpc::ServerContext* context, HealthCheckRequest&& request) {
+    return Status(request.service());
+  }
+
+  // Sends the current status and then another one each time it
+  // changes, until the call is cancelled or 'Shutdown()'. The call's
+  // interrupt (triggered when it's cancelled) resumes a parked watch
+  // so that it ends right away.
+  auto Watch(::grpc::ServerContext* context, HealthCheckRequest&& request) {
+    return ::eventuals::Stream<HealthCheckResponse>()
+        .context(Watched{request.service()})
+        .interruptible()
+        .begin([this](Watched& watched, auto& k, auto& handler) {
+          handler.Install([this, &watched]() {
+            Interrupted(watched);
+          });
+          k.Begin();
+        })
+        .next([this, context](Watched& watched, auto& k, auto&&...) {
+          Next(context, watched, k);
+        })
+        .done([](Watched&, auto& k, auto&&...) {
+          k.Ended();
+        });
+  }
+
+ private:
+  struct Watched {
+    std::string service;
+    // Status last sent, if any.
+    std::optional<HealthCheckResponse::ServingStatus> sent;
+    // Set (with 'mutex_' held) once the call is interrupted.
+    bool interrupted = false;
+  };
+
+  // A watch waiting for the status to change, 'resume()' calls 'Next()'
+  // again (without 'mutex_' held).
+  struct Watcher {
+    Watched* watched;
+    std::function<void()> resume;
+  };
+
+  // Emits the status of 'watched' if it isn't the one last sent, ends
+  // the watch if it's cancelled or shut down, and parks it otherwise.
+  template <typename K>
+  void Next(::grpc::ServerContext* context, Watched& watched, K& k) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (shutdown_ || watched.interrupted || context->IsCancelled()) {
+      lock.unlock();
+      k.Ended();
+      return;
+    }
+    HealthCheckResponse response = Status(watched.service);
+    if (watched.sent == response.status()) {
+      watchers_.push_back(Watcher{
+          &watched,
+          [this, context, &watched, &k]() {
+            Next(context, watched, k);
+          }});
+      return;
+    }
+    watched.sent = response.status();
+    lock.unlock();
+    k.Emit(std::move(response));
+  }
+
+  // Marks 'watched' as interrupted and resumes it if it's parked, so
+  // 'Next()' ends it. If it isn't, the next 'Next()' will.
+  void Interrupted(Watched& watched) {
+    std::function<void()> resume;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      watched.interrupted = true;
+      auto parked = std::find_if(
+          watchers_.begin(),
+          watchers_.end(),
+          [&watched](const Watcher& watcher) {
+            return watcher.watched == &watched;
+          });
+      if (parked != watchers_.end()) {
+        resume = std::move(parked->resume);
+        watchers_.erase(parked);
+      }
+    }
+    if (resume) {
+      resume();
+    }
+  }
+
+  HealthCheckResponse Status(const std::string& service) const {
+    HealthCheckResponse response;
+    if (std::find(services_.begin(), services_.end(), service)
+        == services_.end()) {
+      response.set_status(HealthCheckResponse::SERVICE_UNKNOWN);
+    } else if (serving_.load(std::memory_order_acquire)) {
+      response.set_status(HealthCheckResponse::SERVING);
+    } else {
+      response.set_status(HealthCheckResponse::NOT_SERVING);
+    }
+    return response;
+  }
+
+  std::vector<std::string> services_;
+  // Written with 'mutex_' held, read without by 'Check()'.
+  std::atomic<bool> serving_{false};
+
+  std::mutex mutex_;
+  bool shutdown_ = false;
+  std::vector<Watcher> watchers_;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_HEALTH_SERVICE_H_
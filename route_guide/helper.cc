@@ -16,37 +16,110 @@
  *
  */
 
-#include <algorithm>
 #include <cctype>
+#include <charconv>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
 #include <vector>
 
+#include "helper.h"
 #include "protos/route_guide.grpc.pb.h"
 
 namespace routeguide {
 
-std::string GetDbFileContent(int argc, char** argv) {
-  std::string db_path;
-  std::string arg_str("--db_path");
-  if (argc > 1) {
-    std::string argv_1 = argv[1];
-    size_t start_position = argv_1.find(arg_str);
-    if (start_position != std::string::npos) {
-      start_position += arg_str.size();
-      if (argv_1[start_position] == ' ' || argv_1[start_position] == '=') {
-        db_path = argv_1.substr(start_position + 1);
-      }
+std::string GetFlagValue(
+    int argc,
+    char** argv,
+    const std::string& flag,
+    const std::string& default_value) {
+  std::string prefix = "--" + flag + "=";
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.compare(0, prefix.size(), prefix) == 0) {
+      return arg.substr(prefix.size());
     }
-  } else {
+  }
+  return default_value;
+}
+
+namespace {
+
+template <typename T>
+bool GetNumericFlagValue(
+    int argc,
+    char** argv,
+    const std::string& flag,
+    T default_value,
+    T* value) {
+  std::string text = GetFlagValue(argc, argv, flag);
+  if (text.empty()) {
+    *value = default_value;
+    return true;
+  }
+  const char* end = text.data() + text.size();
+  auto [parsed, error] = std::from_chars(text.data(), end, *value);
+  if (error != std::errc() || parsed != end) {
+    std::cerr << "Invalid --" << flag << "=" << text << ", expected a "
+              << (std::is_floating_point_v<T> ? "number" : "whole number")
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool GetFlagValue(
+    int argc,
+    char** argv,
+    const std::string& flag,
+    int default_value,
+    int* value) {
+  return GetNumericFlagValue(argc, argv, flag, default_value, value);
+}
+
+bool GetFlagValue(
+    int argc,
+    char** argv,
+    const std::string& flag,
+    size_t default_value,
+    size_t* value) {
+  return GetNumericFlagValue(argc, argv, flag, default_value, value);
+}
+
+bool GetFlagValue(
+    int argc,
+    char** argv,
+    const std::string& flag,
+    double default_value,
+    double* value) {
+  return GetNumericFlagValue(argc, argv, flag, default_value, value);
+}
+
+std::string GetDbPath(int argc, char** argv) {
 #ifdef BAZEL_BUILD
-    db_path = "cpp/route_guide/route_guide_db.json";
+  return GetFlagValue(
+      argc,
+      argv,
+      "db_path",
+      "cpp/route_guide/route_guide_db.json");
 #else
-    db_path = "route_guide_db.json";
+  return GetFlagValue(
+      argc,
+      argv,
+      "db_path",
+      "route_guide_db.json");
 #endif
-  }
+}
+
+std::string GetDbFileContent(int argc, char** argv) {
+  std::string db_path = GetDbPath(argc, argv);
   std::ifstream db_file(db_path);
   if (!db_file.is_open()) {
     std::cout << "Failed to open " << db_path << std::endl;
@@ -57,102 +130,449 @@ std::string GetDbFileContent(int argc, char** argv) {
   return db.str();
 }
 
-// A simple parser for the json db file. It requires the db file to have the
-// exact form of [{"location": { "latitude": 123, "longitude": 456}, "name":
-// "the name can be empty" }, { ... } ... The spaces will be stripped.
+// A parser for the json db file. It requires the db file to have the form
+// of [{"location": { "latitude": 123, "longitude": 456}, "name": "the name
+// can be empty" }, { ... } ... where keys may come in any order and "name"
+// may be omitted. The db is parsed in place (never copied) and malformed
+// input is reported through 'error()' rather than by throwing.
+//
+// Unless 'final' the db may be cut anywhere: 'Next()' returns
+// 'kNeedMore' rather than a record that is cut off and 'Reset()'
+// continues with more of the db.
 class Parser {
  public:
-  explicit Parser(const std::string& db) : db_(db) {
-    // Remove all spaces.
-    db_.erase(std::remove_if(db_.begin(), db_.end(), isspace), db_.end());
-    if (!Match("[")) {
-      SetFailedAndReturnFalse();
+  enum Result {
+    kFeature,
+    kEnd,
+    kNeedMore,
+    kError,
+  };
+
+  explicit Parser(std::string_view db, bool final = true)
+    : db_(db),
+      final_(final) {}
+
+  // Continues parsing 'db', which must start with the bytes from
+  // 'position()' onwards of the previous one.
+  void Reset(std::string_view db, bool final) {
+    base_ += current_;
+    db_ = db;
+    current_ = 0;
+    record_start_ = 0;
+    final_ = final;
+  }
+
+  // Offset in the current db of the first byte not parsed yet.
+  size_t position() const { return current_; }
+
+  // Parses the next record into 'feature' (which must be empty).
+  Result Next(Feature* feature) {
+    SkipSpaces();
+    if (final_) {
+      return NextRecord(feature);
+    }
+    if (current_ == db_.size()) {
+      return kNeedMore;
     }
+    const size_t start = current_;
+    const bool started = started_;
+    const size_t records = records_;
+    Result result = NextRecord(feature);
+    // Records are parsed optimistically, only one that fails is checked
+    // for having been cut off rather than being malformed.
+    if (result == kError
+        && !fatal_
+        && FindRecordEnd(record_start_) == std::string_view::npos) {
+      feature->Clear();
+      current_ = start;
+      started_ = started;
+      records_ = records;
+      return kNeedMore;
+    }
+    return result;
+  }
+
+  // Skips past the record that failed to parse by matching its braces,
+  // returning false if there is nothing left to resynchronize on.
+  bool SkipRecord() {
+    if (fatal_) {
+      return false;
+    }
+    current_ = FindRecordEnd(record_start_);
+    if (current_ == std::string_view::npos) {
+      current_ = db_.size();
+      return false;
+    }
+    return true;
   }
 
-  bool Finished() { return current_ >= db_.size(); }
+  // Number of records seen so far, including malformed ones.
+  size_t records() const { return records_; }
+
+  const std::string& error() const { return error_; }
+
+ private:
+  Result NextRecord(Feature* feature) {
+    if (!started_) {
+      started_ = true;
+      if (!Consume('[')) {
+        fatal_ = true;
+        return Fail("expected '['");
+      }
+      SkipSpaces();
+      if (Consume(']')) {
+        return End();
+      }
+    } else {
+      if (Consume(']')) {
+        return End();
+      }
+      if (!Consume(',')) {
+        record_start_ = current_;
+        return Fail("expected ',' or ']'");
+      }
+      SkipSpaces();
+    }
+    record_start_ = current_;
+    records_++;
+    return ParseRecord(feature) ? kFeature : kError;
+  }
 
-  bool TryParseOne(Feature* feature) {
-    if (failed_ || Finished() || !Match("{")) {
-      return SetFailedAndReturnFalse();
+  // Returns the offset past the closing brace of the record starting at
+  // 'position' (or of the ',' or ']' that ends it if it doesn't start
+  // with a brace) or npos if the db ends first.
+  size_t FindRecordEnd(size_t position) const {
+    int depth = 0;
+    bool in_string = false;
+    for (; position < db_.size(); position++) {
+      char c = db_[position];
+      if (in_string) {
+        if (c == '\\') {
+          position++;
+        } else if (c == '"') {
+          in_string = false;
+        }
+      } else if (c == '"') {
+        in_string = true;
+      } else if (c == '{') {
+        depth++;
+      } else if (c == '}' && depth > 0) {
+        if (--depth == 0) {
+          return position + 1;
+        }
+      } else if (depth == 0 && (c == ',' || c == ']')) {
+        return position;
+      }
     }
-    if (!Match(location_) || !Match("{") || !Match(latitude_)) {
-      return SetFailedAndReturnFalse();
+    return std::string_view::npos;
+  }
+
+  bool SetError(const std::string& message) {
+    std::ostringstream error;
+    error << "record " << records_ << " at byte " << base_ + current_ << ": "
+          << message;
+    error_ = error.str();
+    return false;
+  }
+
+  Result Fail(const std::string& message) {
+    SetError(message);
+    return kError;
+  }
+
+  Result End() {
+    if (!final_) {
+      // Only the end of the db tells whether anything follows ']'.
+      current_--;
+      return kNeedMore;
     }
-    long temp = 0;
-    ReadLong(&temp);
-    feature->mutable_location()->set_latitude(temp);
-    if (!Match(",") || !Match(longitude_)) {
-      return SetFailedAndReturnFalse();
+    SkipSpaces();
+    if (current_ != db_.size()) {
+      fatal_ = true;
+      return Fail("unexpected characters after ']'");
     }
-    ReadLong(&temp);
-    feature->mutable_location()->set_longitude(temp);
-    if (!Match("},") || !Match(name_) || !Match("\"")) {
-      return SetFailedAndReturnFalse();
+    return kEnd;
+  }
+
+  bool ParseRecord(Feature* feature) {
+    bool has_location = false;
+    if (!Consume('{')) {
+      return SetError("expected '{'");
     }
-    size_t name_start = current_;
-    while (current_ != db_.size() && db_[current_++] != '"') {
+    std::string key;
+    do {
+      if (!ParseString(&key) || !ConsumeColon()) {
+        return false;
+      }
+      if (key == "location") {
+        if (!ParseLocation(feature->mutable_location())) {
+          return false;
+        }
+        has_location = true;
+      } else if (key == "name") {
+        if (!ParseString(feature->mutable_name())) {
+          return false;
+        }
+      } else {
+        return SetError("unexpected key \"" + key + "\"");
+      }
+      SkipSpaces();
+    } while (Consume(','));
+    if (!Consume('}')) {
+      return SetError("expected ',' or '}'");
     }
-    if (current_ == db_.size()) {
-      return SetFailedAndReturnFalse();
+    if (!has_location) {
+      return SetError("missing \"location\"");
     }
-    feature->set_name(db_.substr(name_start, current_ - name_start - 1));
-    if (!Match("},")) {
-      if (db_[current_ - 1] == ']' && current_ == db_.size()) {
-        return true;
+    return true;
+  }
+
+  bool ParseLocation(Point* point) {
+    bool has_latitude = false;
+    bool has_longitude = false;
+    SkipSpaces();
+    if (!Consume('{')) {
+      return SetError("expected '{'");
+    }
+    std::string key;
+    do {
+      if (!ParseString(&key) || !ConsumeColon()) {
+        return false;
+      }
+      int32_t value = 0;
+      if (key == "latitude") {
+        if (!ParseCoordinate(900000000, &value)) {
+          return false;
+        }
+        point->set_latitude(value);
+        has_latitude = true;
+      } else if (key == "longitude") {
+        if (!ParseCoordinate(1800000000, &value)) {
+          return false;
+        }
+        point->set_longitude(value);
+        has_longitude = true;
+      } else {
+        return SetError("unexpected key \"" + key + "\"");
       }
-      return SetFailedAndReturnFalse();
+      SkipSpaces();
+    } while (Consume(','));
+    if (!Consume('}')) {
+      return SetError("expected ',' or '}'");
+    }
+    if (!has_latitude || !has_longitude) {
+      return SetError("missing \"latitude\" or \"longitude\"");
     }
     return true;
   }
 
- private:
-  bool SetFailedAndReturnFalse() {
-    failed_ = true;
-    return false;
+  // Parses an integer in [-limit, limit].
+  bool ParseCoordinate(int64_t limit, int32_t* coordinate) {
+    SkipSpaces();
+    int64_t value = 0;
+    auto [end, error] = std::from_chars(
+        db_.data() + current_,
+        db_.data() + db_.size(),
+        value);
+    if (error != std::errc()) {
+      return SetError("expected an integer");
+    }
+    if (value < -limit || value > limit) {
+      return SetError("coordinate out of range");
+    }
+    current_ = end - db_.data();
+    *coordinate = static_cast<int32_t>(value);
+    return true;
+  }
+
+  bool ParseString(std::string* s) {
+    SkipSpaces();
+    if (!Consume('"')) {
+      return SetError("expected '\"'");
+    }
+    s->clear();
+    while (current_ < db_.size()) {
+      // Copy everything up to the next quote or escape at once.
+      size_t start = current_;
+      while (current_ < db_.size()
+             && db_[current_] != '"'
+             && db_[current_] != '\\') {
+        current_++;
+      }
+      s->append(db_.data() + start, current_ - start);
+      if (current_ == db_.size()) {
+        break;
+      }
+      if (db_[current_++] == '"') {
+        return true;
+      }
+      if (current_ == db_.size()) {
+        break;
+      }
+      switch (char c = db_[current_++]) {
+        case 'b': s->push_back('\b'); break;
+        case 'f': s->push_back('\f'); break;
+        case 'n': s->push_back('\n'); break;
+        case 'r': s->push_back('\r'); break;
+        case 't': s->push_back('\t'); break;
+        case '"':
+        case '\\':
+        case '/':
+          s->push_back(c);
+          break;
+        default:
+          // Keep anything else (e.g., \uXXXX) verbatim.
+          s->push_back('\\');
+          s->push_back(c);
+          break;
+      }
+    }
+    return SetError("unterminated string");
   }
 
-  bool Match(const std::string& prefix) {
-    bool eq = db_.substr(current_, prefix.size()) == prefix;
-    current_ += prefix.size();
-    return eq;
+  bool ConsumeColon() {
+    SkipSpaces();
+    if (!Consume(':')) {
+      return SetError("expected ':'");
+    }
+    return true;
   }
 
-  void ReadLong(long* l) {
-    size_t start = current_;
-    while (current_ != db_.size() && db_[current_] != ',' &&
-           db_[current_] != '}') {
+  bool Consume(char c) {
+    if (current_ < db_.size() && db_[current_] == c) {
       current_++;
+      return true;
     }
-    // It will throw an exception if fails.
-    *l = std::stol(db_.substr(start, current_ - start));
+    return false;
   }
 
-  bool failed_ = false;
-  std::string db_;
+  void SkipSpaces() {
+    while (current_ < db_.size()
+           && isspace(static_cast<unsigned char>(db_[current_]))) {
+      current_++;
+    }
+  }
+
+  std::string_view db_;
+  bool final_;
+  // Offset in the whole db of the current one.
+  size_t base_ = 0;
   size_t current_ = 0;
-  const std::string location_ = "\"location\":";
-  const std::string latitude_ = "\"latitude\":";
-  const std::string longitude_ = "\"longitude\":";
-  const std::string name_ = "\"name\":";
+  size_t record_start_ = 0;
+  size_t records_ = 0;
+  bool started_ = false;
+  bool fatal_ = false;
+  std::string error_;
 };
 
-void ParseDb(const std::string& db, std::vector<Feature>* feature_list) {
-  feature_list->clear();
-  std::string db_content(db);
-  db_content.erase(
-      std::remove_if(db_content.begin(), db_content.end(), isspace),
-      db_content.end());
+namespace {
 
-  Parser parser(db_content);
+// Appends records to 'feature_list' until the end of the db or of the
+// available part of it, returning 'kError' if a malformed record stops
+// the parse (always in strict mode).
+Parser::Result ParseRecords(
+    Parser* parser,
+    std::vector<Feature>* feature_list,
+    DbParseMode mode,
+    std::string* error,
+    size_t* skipped) {
   Feature feature;
-  while (!parser.Finished()) {
-    feature_list->push_back(Feature());
-    if (!parser.TryParseOne(&feature_list->back())) {
-      std::cout << "Error parsing the db file";
-      feature_list->clear();
-      break;
+  while (true) {
+    Parser::Result result = parser->Next(&feature);
+    if (result == Parser::kFeature) {
+      feature_list->push_back(std::move(feature));
+      feature.Clear();
+      continue;
+    }
+    if (result != Parser::kError) {
+      return result;
     }
+    if (error->empty()) {
+      *error = parser->error();
+    }
+    if (mode == DbParseMode::kStrict) {
+      return Parser::kError;
+    }
+    feature.Clear();
+    (*skipped)++;
+    if (!parser->SkipRecord()) {
+      return Parser::kError;
+    }
+  }
+}
+
+std::string SkippedSuffix(size_t skipped) {
+  return " (skipped " + std::to_string(skipped) + " malformed records)";
+}
+
+}  // namespace
+
+bool ParseDb(
+    const std::string& db,
+    std::vector<Feature>* feature_list,
+    DbParseMode mode,
+    std::string* error) {
+  feature_list->clear();
+  error->clear();
+
+  Parser parser(db);
+  size_t skipped = 0;
+  Parser::Result result =
+      ParseRecords(&parser, feature_list, mode, error, &skipped);
+  if (result == Parser::kError && mode == DbParseMode::kStrict) {
+    feature_list->clear();
+    return false;
+  }
+  if (skipped > 0) {
+    *error += SkippedSuffix(skipped);
+  }
+  return error->empty();
+}
+
+DbChunkParser::DbChunkParser(DbParseMode mode)
+  : mode_(mode),
+    parser_(std::make_unique<Parser>(std::string_view(), false)) {}
+
+DbChunkParser::~DbChunkParser() {}
+
+bool DbChunkParser::Add(
+    std::string_view chunk,
+    std::vector<Feature>* feature_list) {
+  return Parse(chunk, false, feature_list);
+}
+
+bool DbChunkParser::Finish(std::vector<Feature>* feature_list) {
+  return Parse(std::string_view(), true, feature_list)
+      && error_.empty();
+}
+
+bool DbChunkParser::Parse(
+    std::string_view chunk,
+    bool final,
+    std::vector<Feature>* feature_list) {
+  if (stopped_) {
+    return false;
+  }
+  // Keep only the part of the db that hasn't been parsed yet.
+  buffer_.erase(0, parser_->position());
+  buffer_.append(chunk);
+  parser_->Reset(buffer_, final);
+  Parser::Result result =
+      ParseRecords(parser_.get(), feature_list, mode_, &error_, &skipped_);
+  if (result == Parser::kError) {
+    stopped_ = true;
+  }
+  if ((stopped_ || final) && skipped_ > 0) {
+    error_ += SkippedSuffix(skipped_);
+    skipped_ = 0;
+  }
+  return !stopped_;
+}
+
+void ParseDb(const std::string& db, std::vector<Feature>* feature_list) {
+  std::string error;
+  if (!ParseDb(db, feature_list, DbParseMode::kLenient, &error)) {
+    std::cout << "Error parsing the db file: " << error << std::endl;
   }
   std::cout << "DB parsed, loaded " << feature_list->size() << " features."
             << std::endl;
@@ -19,16 +19,110 @@
 #ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_HELPER_H_
 #define GRPC_COMMON_CPP_ROUTE_GUIDE_HELPER_H_
 
+#include <cstddef>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace routeguide {
 class Feature;
+class Parser;
+
+// Returns the value of '--flag=value' from the command line or
+// 'default_value' if the flag wasn't passed.
+std::string GetFlagValue(
+    int argc,
+    char** argv,
+    const std::string& flag,
+    const std::string& default_value = "");
+
+// Numeric '--flag=value' from the command line, or 'default_value' if
+// the flag wasn't passed. Returns false, after printing a usage error,
+// if the value isn't a number of that type (rather than throwing).
+bool GetFlagValue(
+    int argc,
+    char** argv,
+    const std::string& flag,
+    int default_value,
+    int* value);
+
+bool GetFlagValue(
+    int argc,
+    char** argv,
+    const std::string& flag,
+    size_t default_value,
+    size_t* value);
+
+bool GetFlagValue(
+    int argc,
+    char** argv,
+    const std::string& flag,
+    double default_value,
+    double* value);
+
+// Path of the json db, from '--db_path' or the default location.
+std::string GetDbPath(int argc, char** argv);
 
 std::string GetDbFileContent(int argc, char** argv);
 
+enum class DbParseMode {
+  // Skip malformed records, keeping every well formed one.
+  kLenient,
+  // Stop at the first malformed record, loading nothing.
+  kStrict,
+};
+
+// Parses the json 'db' into 'feature_list'. Returns false if any record
+// is malformed, in which case 'error' describes the first one (its
+// index and byte offset) and, depending on 'mode', 'feature_list'
+// holds either every well formed record or nothing.
+bool ParseDb(
+    const std::string& db,
+    std::vector<Feature>* feature_list,
+    DbParseMode mode,
+    std::string* error);
+
+// Lenient parse that reports errors to stdout.
 void ParseDb(const std::string& db, std::vector<Feature>* feature_list);
 
+// Parses the json db as it arrives in consecutive chunks (e.g., while
+// it's being read), so only the unparsed tail of the chunks seen so far
+// (at most a record) is kept rather than the whole db. Errors are those
+// of 'ParseDb()'.
+class DbChunkParser {
+ public:
+  explicit DbChunkParser(DbParseMode mode);
+
+  ~DbChunkParser();
+
+  // Appends every record completed by 'chunk' to 'feature_list'.
+  // Returns false once parsing has stopped, in which case 'error()' says
+  // why and in strict mode the records parsed so far must be dropped.
+  bool Add(std::string_view chunk, std::vector<Feature>* feature_list);
+
+  // Parses what is left after the last chunk. Returns false if any
+  // record was malformed, like 'ParseDb()'.
+  bool Finish(std::vector<Feature>* feature_list);
+
+  DbParseMode mode() const { return mode_; }
+
+  const std::string& error() const { return error_; }
+
+ private:
+  bool Parse(
+      std::string_view chunk,
+      bool final,
+      std::vector<Feature>* feature_list);
+
+  const DbParseMode mode_;
+  std::unique_ptr<Parser> parser_;
+  std::string buffer_;
+  std::string error_;
+  size_t skipped_ = 0;
+  bool stopped_ = false;
+};
+
 }  // namespace routeguide
 
 #endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_HELPER_H_
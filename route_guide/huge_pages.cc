@@ -0,0 +1,145 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "huge_pages.h"
+
+#include <sys/mman.h>
+
+#include <atomic>
+#include <cstdint>
+
+#include "metrics.h"
+
+namespace routeguide {
+
+namespace {
+
+std::atomic<HugePages> huge_pages{HugePages::kNone};
+
+size_t RoundUp(size_t bytes) {
+  return (bytes + kHugePageSize - 1) & ~(kHugePageSize - 1);
+}
+
+Gauge& LargeAllocationBytes() {
+  static Gauge& gauge =
+      Metrics::Default().GetGauge("large_allocation_bytes");
+  return gauge;
+}
+
+// Maps 'size' bytes aligned to 'kHugePageSize' by over mapping and
+// trimming the excess on either side.
+void* MapAligned(size_t size) {
+  size_t mapped = size + kHugePageSize;
+  void* pointer = mmap(
+      nullptr,
+      mapped,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1,
+      0);
+  if (pointer == MAP_FAILED) {
+    return nullptr;
+  }
+  uintptr_t start = reinterpret_cast<uintptr_t>(pointer);
+  uintptr_t aligned = RoundUp(start);
+  if (aligned > start) {
+    munmap(pointer, aligned - start);
+  }
+  size_t tail = start + mapped - (aligned + size);
+  if (tail > 0) {
+    munmap(reinterpret_cast<void*>(aligned + size), tail);
+  }
+  return reinterpret_cast<void*>(aligned);
+}
+
+}  // namespace
+
+void SetHugePages(HugePages value) {
+  huge_pages.store(value, std::memory_order_relaxed);
+}
+
+HugePages GetHugePages() {
+  return huge_pages.load(std::memory_order_relaxed);
+}
+
+bool ParseHugePages(const std::string& value, HugePages* result) {
+  if (value == "none") {
+    *result = HugePages::kNone;
+  } else if (value == "transparent") {
+    *result = HugePages::kTransparent;
+  } else if (value == "hugetlb") {
+    *result = HugePages::kHugetlb;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void* AllocateLarge(size_t bytes) {
+  if (bytes < kHugePageSize) {
+    return ::operator new(bytes);
+  }
+
+  static Counter& fallbacks =
+      Metrics::Default().GetCounter("hugetlb_fallbacks_total");
+
+  size_t size = RoundUp(bytes);
+  HugePages mode = GetHugePages();
+
+  void* pointer = nullptr;
+  if (mode == HugePages::kHugetlb) {
+    pointer = mmap(
+        nullptr,
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+        -1,
+        0);
+    if (pointer == MAP_FAILED) {
+      fallbacks.Increment();
+      pointer = nullptr;
+      mode = HugePages::kTransparent;
+    }
+  }
+
+  if (pointer == nullptr) {
+    pointer = MapAligned(size);
+    if (pointer == nullptr) {
+      throw std::bad_alloc();
+    }
+    if (mode == HugePages::kTransparent) {
+      // Only advice, the kernel may still use 4KB pages.
+      madvise(pointer, size, MADV_HUGEPAGE);
+    }
+  }
+
+  LargeAllocationBytes().Add(size);
+
+  return pointer;
+}
+
+void DeallocateLarge(void* pointer, size_t bytes) {
+  if (bytes < kHugePageSize) {
+    ::operator delete(pointer);
+    return;
+  }
+  munmap(pointer, RoundUp(bytes));
+  LargeAllocationBytes().Subtract(RoundUp(bytes));
+}
+
+}  // namespace routeguide
@@ -0,0 +1,90 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_HUGE_PAGES_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_HUGE_PAGES_H_
+
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace routeguide {
+
+// How large, long lived allocations (the feature store's arrays and
+// indexes) are backed. Lookups into a multi gigabyte index touch pages
+// at random so with 4KB pages nearly every one is a TLB miss, 2MB pages
+// cover 512 times as much memory per TLB entry.
+enum class HugePages {
+  // Whatever the kernel does by default for anonymous memory.
+  kNone,
+  // Ask for transparent huge pages with 'madvise(MADV_HUGEPAGE)'.
+  kTransparent,
+  // Map from the hugetlbfs pool ('MAP_HUGETLB'), which has to be
+  // reserved up front (vm.nr_hugepages). Falls back to transparent huge
+  // pages if the pool is exhausted.
+  kHugetlb,
+};
+
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+// Process wide, set at startup before anything is allocated.
+void SetHugePages(HugePages huge_pages);
+
+HugePages GetHugePages();
+
+// Parses "none", "transparent" or "hugetlb".
+bool ParseHugePages(const std::string& value, HugePages* huge_pages);
+
+// Allocations of at least 'kHugePageSize' bytes are mapped (aligned and
+// rounded up to 'kHugePageSize') and backed according to
+// 'GetHugePages()', smaller ones come from the heap.
+void* AllocateLarge(size_t bytes);
+
+void DeallocateLarge(void* pointer, size_t bytes);
+
+template <typename T>
+struct HugePageAllocator {
+  using value_type = T;
+
+  HugePageAllocator() = default;
+
+  template <typename U>
+  HugePageAllocator(const HugePageAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(AllocateLarge(n * sizeof(T)));
+  }
+
+  void deallocate(T* pointer, size_t n) {
+    DeallocateLarge(pointer, n * sizeof(T));
+  }
+
+  template <typename U>
+  bool operator==(const HugePageAllocator<U>&) const { return true; }
+
+  template <typename U>
+  bool operator!=(const HugePageAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using HugePageVector = std::vector<T, HugePageAllocator<T>>;
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_HUGE_PAGES_H_
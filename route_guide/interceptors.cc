@@ -0,0 +1,109 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "interceptors.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace routeguide {
+
+namespace {
+
+std::mt19937_64& Random() {
+  thread_local std::mt19937_64 random(std::random_device{}());
+  return random;
+}
+
+}  // namespace
+
+MetricsInterceptor::MetricsInterceptor(
+    const std::vector<std::string>& methods) {
+  for (const std::string& method : methods) {
+    const std::string prefix = "rpc_" + method;
+    stats_[method] = Stats{
+        &Metrics::Default().GetCounter(prefix + "_calls_total"),
+        &Metrics::Default().GetGauge(prefix + "_in_flight"),
+        &Metrics::Default().GetCounter(prefix + "_latency_us_total")};
+  }
+}
+
+bool TracingInterceptor::Sample() const {
+  return std::uniform_real_distribution<double>(0, 1)(Random())
+      < sample_rate_;
+}
+
+TracingInterceptor::Span TracingInterceptor::StartSpan(
+    const InterceptedCall& call) {
+  Span span;
+  const auto& metadata = call.context->client_metadata();
+  auto trace_id = metadata.find("x-trace-id");
+  if (trace_id != metadata.end()) {
+    span.trace_id.assign(trace_id->second.data(), trace_id->second.size());
+  } else {
+    std::ostringstream id;
+    id << std::hex << std::setw(16) << std::setfill('0') << Random()();
+    span.trace_id = id.str();
+  }
+  span.method = call.method;
+  span.peer = call.context->peer();
+  span.start = std::chrono::steady_clock::now();
+  return span;
+}
+
+void TracingInterceptor::EndSpan(const Span& span) {
+  // Format first so a span isn't interleaved with other output.
+  std::ostringstream out;
+  out << "span trace_id=" << span.trace_id << " method=" << span.method
+      << " peer=" << span.peer << " duration_us="
+      << std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - span.start)
+             .count()
+      << "\n";
+  std::cout << out.str() << std::flush;
+}
+
+RateLimitInterceptor::RateLimitInterceptor(double calls_per_second)
+  : calls_per_second_(calls_per_second),
+    rejected_(Metrics::Default().GetCounter("rpc_rate_limited_total")),
+    tokens_(calls_per_second),
+    refilled_(std::chrono::steady_clock::now()) {}
+
+bool RateLimitInterceptor::TryAcquire() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto now = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed = now - refilled_;
+  refilled_ = now;
+  tokens_ = std::min(
+      calls_per_second_,
+      tokens_ + elapsed.count() * calls_per_second_);
+  if (tokens_ < 1) {
+    return false;
+  }
+  tokens_ -= 1;
+  return true;
+}
+
+AdmissionInterceptor::AdmissionInterceptor(size_t max_calls)
+  : max_calls_(max_calls),
+    rejected_(Metrics::Default().GetCounter("rpc_admission_rejected_total")) {}
+
+}  // namespace routeguide
@@ -0,0 +1,319 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_INTERCEPTORS_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_INTERCEPTORS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "eventuals/closure.h"
+#include "eventuals/flat-map.h"
+#include "eventuals/if.h"
+#include "eventuals/raise.h"
+#include "eventuals/range.h"
+#include "google/protobuf/message.h"
+#include "grpcpp/server_context.h"
+#include "metrics.h"
+
+namespace routeguide {
+
+// A call as seen by interceptors.
+struct InterceptedCall {
+  const char* method;
+  grpc::ServerContext* context;
+  bool rejected = false;
+
+  // Refuses the call: it's cancelled (like calls that arrive before the
+  // feature store is loaded) and its handler isn't run. Interceptors
+  // later in the chain still see the call.
+  void Reject() {
+    if (!rejected) {
+      rejected = true;
+      context->TryCancel();
+    }
+  }
+};
+
+// Runs 'f' when destroyed (unless moved from), i.e., when the call an
+// interceptor returned it for ends.
+template <typename F>
+class CallEnd {
+ public:
+  explicit CallEnd(F f) : f_(std::move(f)) {}
+
+  CallEnd(CallEnd&& that) : f_(std::move(that.f_)) { that.f_.reset(); }
+
+  CallEnd(const CallEnd&) = delete;
+  CallEnd& operator=(const CallEnd&) = delete;
+
+  ~CallEnd() {
+    if (f_) {
+      (*f_)();
+    }
+  }
+
+ private:
+  std::optional<F> f_;
+};
+
+// Runs 'Interceptors' around the calls to a service's handlers. The
+// chain is composed at compile time: an interceptor is any type with
+//
+//   CallEnd<...> Start(InterceptedCall& call);
+//
+// which is called, in chain order, as each call starts and whose
+// result lives until the call ends (for a stream, until the eventual
+// serving it is destroyed). An empty chain just calls the handler.
+//
+// A handler that returns an eventual is only called once that eventual
+// starts, so it must not capture its method's arguments by reference.
+template <typename... Interceptors>
+class InterceptorChain {
+ public:
+  explicit InterceptorChain(Interceptors*... interceptors)
+    : interceptors_(interceptors...) {}
+
+  // Returns what 'handler()' does: a response, an eventual of one or
+  // nothing (for a unary handler that fills in a response of the
+  // caller's). A rejected call's handler isn't called, an eventual then
+  // fails instead.
+  template <typename Handler>
+  auto operator()(
+      const char* method,
+      grpc::ServerContext* context,
+      Handler handler) {
+    if constexpr (sizeof...(Interceptors) == 0) {
+      return handler();
+    } else {
+      InterceptedCall call{method, context};
+      auto ends = Start(call);
+      using Result = decltype(handler());
+      if constexpr (std::is_void_v<Result>) {
+        if (!call.rejected) {
+          handler();
+        }
+      } else if constexpr (
+          std::is_base_of_v<google::protobuf::Message, Result>) {
+        // Unary calls are done on return, which ends them.
+        return call.rejected ? Result() : handler();
+      } else {
+        return eventuals::Closure(
+            [ends = std::move(ends),
+             rejected = call.rejected,
+             handler = std::move(handler)]() mutable {
+              return eventuals::If(rejected)
+                  .yes([]() {
+                    return eventuals::Raise("rejected by an interceptor");
+                  })
+                  .no([&handler]() {
+                    return handler();
+                  });
+            });
+      }
+    }
+  }
+
+  // Like 'operator()' for a handler that returns a stream of responses,
+  // which is empty for a rejected call (whose handler isn't called).
+  template <typename Handler>
+  auto Streaming(
+      const char* method,
+      grpc::ServerContext* context,
+      Handler handler) {
+    if constexpr (sizeof...(Interceptors) == 0) {
+      return handler();
+    } else {
+      InterceptedCall call{method, context};
+      auto ends = Start(call);
+      return eventuals::Closure(
+          [ends = std::move(ends),
+           rejected = call.rejected,
+           handler = std::move(handler)]() mutable {
+            return eventuals::Range(rejected ? 0 : 1)
+                | eventuals::FlatMap([&handler](int) {
+                     return handler();
+                   });
+          });
+    }
+  }
+
+ private:
+  // Braced initialization starts the interceptors in order.
+  auto Start(InterceptedCall& call) {
+    return std::apply(
+        [&call](Interceptors*... interceptors) {
+          return std::tuple<decltype(interceptors->Start(call))...>{
+              interceptors->Start(call)...};
+        },
+        interceptors_);
+  }
+
+  std::tuple<Interceptors*...> interceptors_;
+};
+
+// Exports, for each of 'methods', 'rpc_<method>_calls_total',
+// 'rpc_<method>_in_flight' and 'rpc_<method>_latency_us_total' (the
+// mean latency being that over the calls). Rejected calls aren't
+// counted.
+class MetricsInterceptor {
+ public:
+  explicit MetricsInterceptor(const std::vector<std::string>& methods);
+
+  auto Start(InterceptedCall& call) {
+    const Stats* stats = nullptr;
+    if (!call.rejected) {
+      auto found = stats_.find(call.method);
+      if (found != stats_.end()) {
+        stats = &found->second;
+        stats->calls->Increment();
+        stats->in_flight->Add(1);
+      }
+    }
+    return CallEnd(
+        [stats, start = std::chrono::steady_clock::now()]() {
+          if (stats != nullptr) {
+            stats->in_flight->Subtract(1);
+            stats->latency_us->Increment(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count());
+          }
+        });
+  }
+
+ private:
+  struct Stats {
+    Counter* calls;
+    Gauge* in_flight;
+    Counter* latency_us;
+  };
+
+  // Only read once constructed so lookups don't lock.
+  std::map<std::string, Stats, std::less<>> stats_;
+};
+
+// Prints a span (trace id, method, peer and duration) for a
+// 'sample_rate' fraction of the calls. The trace id is the caller's
+// 'x-trace-id' metadata if it sent one, so spans can be joined with
+// its own, and otherwise a random one.
+class TracingInterceptor {
+ public:
+  explicit TracingInterceptor(double sample_rate)
+    : sample_rate_(sample_rate) {}
+
+  auto Start(InterceptedCall& call) {
+    std::optional<Span> span;
+    if (sample_rate_ > 0 && !call.rejected && Sample()) {
+      span = StartSpan(call);
+    }
+    return CallEnd([span = std::move(span)]() {
+      if (span) {
+        EndSpan(*span);
+      }
+    });
+  }
+
+ private:
+  struct Span {
+    std::string trace_id;
+    const char* method;
+    std::string peer;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  bool Sample() const;
+
+  static Span StartSpan(const InterceptedCall& call);
+
+  static void EndSpan(const Span& span);
+
+  const double sample_rate_;
+};
+
+// Rejects calls beyond 'calls_per_second' (with bursts of up to as
+// many), counting them in 'rpc_rate_limited_total'. Zero means no
+// limit.
+class RateLimitInterceptor {
+ public:
+  explicit RateLimitInterceptor(double calls_per_second);
+
+  auto Start(InterceptedCall& call) {
+    if (calls_per_second_ > 0 && !call.rejected && !TryAcquire()) {
+      rejected_.Increment();
+      call.Reject();
+    }
+    return CallEnd([]() {});
+  }
+
+ private:
+  // Takes a token from the bucket, if there's one.
+  bool TryAcquire();
+
+  const double calls_per_second_;
+  Counter& rejected_;
+
+  std::mutex mutex_;
+  double tokens_;
+  std::chrono::steady_clock::time_point refilled_;
+};
+
+// Rejects calls while 'max_calls' are already in flight, counting them
+// in 'rpc_admission_rejected_total', so that overload sheds calls
+// rather than queueing them (and their memory). Zero means no limit.
+class AdmissionInterceptor {
+ public:
+  explicit AdmissionInterceptor(size_t max_calls);
+
+  auto Start(InterceptedCall& call) {
+    bool admitted = false;
+    if (max_calls_ > 0 && !call.rejected) {
+      if (in_flight_.fetch_add(1, std::memory_order_relaxed) < max_calls_) {
+        admitted = true;
+      } else {
+        in_flight_.fetch_sub(1, std::memory_order_relaxed);
+        rejected_.Increment();
+        call.Reject();
+      }
+    }
+    return CallEnd([this, admitted]() {
+      if (admitted) {
+        in_flight_.fetch_sub(1, std::memory_order_relaxed);
+      }
+    });
+  }
+
+ private:
+  const size_t max_calls_;
+  Counter& rejected_;
+  std::atomic<size_t> in_flight_{0};
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_INTERCEPTORS_H_
@@ -0,0 +1,135 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "memory_accounting.h"
+
+#include "metrics.h"
+
+namespace routeguide {
+
+namespace {
+
+Gauge& KindGauge(StreamMemory::Kind kind) {
+  static Gauge* gauges[] = {
+      &Metrics::Default().GetGauge("stream_buffered_bytes"),
+      &Metrics::Default().GetGauge("stream_queued_write_bytes"),
+      &Metrics::Default().GetGauge("stream_captured_bytes"),
+  };
+  return *gauges[kind];
+}
+
+Gauge& ActiveStreams() {
+  static Gauge& gauge = Metrics::Default().GetGauge("streams_active");
+  return gauge;
+}
+
+Counter& LimitExceeded() {
+  static Counter& counter =
+      Metrics::Default().GetCounter("memory_limit_exceeded_total");
+  return counter;
+}
+
+}  // namespace
+
+MemoryBudget::MemoryBudget(size_t stream_limit, size_t global_limit)
+  : stream_limit_(stream_limit),
+    global_limit_(global_limit) {}
+
+bool MemoryBudget::TryCharge(size_t bytes) {
+  static Gauge& gauge = Metrics::Default().GetGauge("memory_budget_bytes");
+  size_t used = used_.load(std::memory_order_relaxed);
+  do {
+    if (global_limit_ != 0 && used + bytes > global_limit_) {
+      LimitExceeded().Increment();
+      return false;
+    }
+  } while (!used_.compare_exchange_weak(
+      used,
+      used + bytes,
+      std::memory_order_relaxed));
+  gauge.Add(bytes);
+  return true;
+}
+
+void MemoryBudget::Release(size_t bytes) {
+  static Gauge& gauge = Metrics::Default().GetGauge("memory_budget_bytes");
+  used_.fetch_sub(bytes, std::memory_order_relaxed);
+  gauge.Subtract(bytes);
+}
+
+StreamMemory::StreamMemory(MemoryBudget* budget)
+  : budget_(budget) {
+  ActiveStreams().Add(1);
+}
+
+StreamMemory::StreamMemory(StreamMemory&& that)
+  : budget_(that.budget_),
+    charged_(that.charged_) {
+  that.budget_ = nullptr;
+  that.charged_ = {};
+}
+
+StreamMemory::~StreamMemory() {
+  if (budget_ != nullptr) {
+    for (size_t kind = 0; kind < charged_.size(); kind++) {
+      Release(static_cast<Kind>(kind), charged_[kind]);
+    }
+    ActiveStreams().Subtract(1);
+  }
+}
+
+bool StreamMemory::TryCharge(Kind kind, size_t bytes) {
+  if (budget_->stream_limit() != 0
+      && total() + bytes > budget_->stream_limit()) {
+    LimitExceeded().Increment();
+    return false;
+  }
+  if (!budget_->TryCharge(bytes)) {
+    return false;
+  }
+  charged_[kind] += bytes;
+  KindGauge(kind).Add(bytes);
+  return true;
+}
+
+void StreamMemory::Release(Kind kind, size_t bytes) {
+  if (bytes > charged_[kind]) {
+    bytes = charged_[kind];
+  }
+  charged_[kind] -= bytes;
+  KindGauge(kind).Subtract(bytes);
+  budget_->Release(bytes);
+}
+
+bool StreamMemory::TryUpdate(Kind kind, size_t bytes) {
+  if (bytes <= charged_[kind]) {
+    Release(kind, charged_[kind] - bytes);
+    return true;
+  }
+  return TryCharge(kind, bytes - charged_[kind]);
+}
+
+size_t StreamMemory::total() const {
+  size_t total = 0;
+  for (size_t charged : charged_) {
+    total += charged;
+  }
+  return total;
+}
+
+}  // namespace routeguide
@@ -0,0 +1,100 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_MEMORY_ACCOUNTING_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_MEMORY_ACCOUNTING_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace routeguide {
+
+// Server wide memory budget shared by every stream. A limit of zero
+// means unlimited.
+class MemoryBudget {
+ public:
+  MemoryBudget(size_t stream_limit, size_t global_limit);
+
+  size_t stream_limit() const { return stream_limit_; }
+
+  size_t global_limit() const { return global_limit_; }
+
+  // Charges 'bytes' against the global limit, returning false (and
+  // charging nothing) if that would exceed it.
+  bool TryCharge(size_t bytes);
+
+  void Release(size_t bytes);
+
+  size_t used() const { return used_.load(std::memory_order_relaxed); }
+
+ private:
+  const size_t stream_limit_;
+  const size_t global_limit_;
+  std::atomic<size_t> used_{0};
+};
+
+// Accounts the memory held on behalf of a single stream, charging it
+// against both the per-stream and the global limit of a
+// 'MemoryBudget'. Everything still charged is released on destruction
+// so an instance should live exactly as long as the stream's state,
+// e.g., captured in the stream's 'Closure'.
+//
+// Not thread-safe: a stream's handlers never run concurrently.
+class StreamMemory {
+ public:
+  enum Kind {
+    // Inbound messages currently held by the handler.
+    kBuffered,
+    // Outbound messages materialized but not yet handed to a write.
+    kQueuedWrites,
+    // State captured by the handler, e.g., a route being simplified.
+    kCaptured,
+  };
+
+  explicit StreamMemory(MemoryBudget* budget);
+
+  StreamMemory(StreamMemory&& that);
+
+  StreamMemory(const StreamMemory&) = delete;
+  StreamMemory& operator=(const StreamMemory&) = delete;
+
+  ~StreamMemory();
+
+  // Returns false (and charges nothing) if charging 'bytes' would
+  // exceed either the stream or the global limit.
+  bool TryCharge(Kind kind, size_t bytes);
+
+  void Release(Kind kind, size_t bytes);
+
+  // Like 'TryCharge()' but replaces the current charge for 'kind', for
+  // state that is measured rather than tracked incrementally.
+  bool TryUpdate(Kind kind, size_t bytes);
+
+  size_t charged(Kind kind) const { return charged_[kind]; }
+
+  size_t total() const;
+
+ private:
+  MemoryBudget* budget_;
+  std::array<size_t, 3> charged_ = {};
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_MEMORY_ACCOUNTING_H_
@@ -0,0 +1,104 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "metrics.h"
+
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace routeguide {
+
+Metrics& Metrics::Default() {
+  static Metrics* metrics = new Metrics();
+  return *metrics;
+}
+
+Counter& Metrics::GetCounter(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& counter = counters_[name];
+  if (!counter) {
+    counter = std::make_unique<Counter>();
+  }
+  return *counter;
+}
+
+Gauge& Metrics::GetGauge(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& gauge = gauges_[name];
+  if (!gauge) {
+    gauge = std::make_unique<Gauge>();
+  }
+  return *gauge;
+}
+
+void Metrics::Dump(std::ostream& out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& [name, counter] : counters_) {
+    out << "# TYPE " << name << " counter\n"
+        << name << " " << counter->value() << "\n";
+  }
+  for (const auto& [name, gauge] : gauges_) {
+    out << "# TYPE " << name << " gauge\n"
+        << name << " " << gauge->value() << "\n";
+  }
+}
+
+PhaseTimer::PhaseTimer(const std::string& prefix)
+  : prefix_(prefix),
+    start_(std::chrono::steady_clock::now()),
+    lap_(start_) {}
+
+void PhaseTimer::Lap(const std::string& phase) {
+  std::chrono::steady_clock::time_point start = lap_;
+  lap_ = std::chrono::steady_clock::now();
+  Export(phase, start);
+}
+
+void PhaseTimer::Total() {
+  Export("total", start_);
+}
+
+void PhaseTimer::Export(
+    const std::string& phase,
+    std::chrono::steady_clock::time_point start) {
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+  Metrics::Default()
+      .GetGauge(prefix_ + "_" + phase + "_ms")
+      .Set(ms.count());
+  std::cout << prefix_ << ": " << phase << " took " << ms.count() << " ms"
+            << std::endl;
+}
+
+void StartMetricsReporter(std::chrono::seconds interval) {
+  if (interval.count() == 0) {
+    return;
+  }
+  std::thread([interval]() {
+    while (true) {
+      std::this_thread::sleep_for(interval);
+      // Format first so a dump isn't interleaved with other output.
+      std::ostringstream out;
+      Metrics::Default().Dump(out);
+      std::cout << out.str() << std::flush;
+    }
+  }).detach();
+}
+
+}  // namespace routeguide
@@ -0,0 +1,110 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_METRICS_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace routeguide {
+
+// A monotonically increasing value, e.g., number of points received.
+class Counter {
+ public:
+  void Increment(int64_t n = 1) {
+    value_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+// A value that can go up and down, e.g., bytes currently buffered.
+class Gauge {
+ public:
+  void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+
+  void Add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+
+  void Subtract(int64_t n) { value_.fetch_sub(n, std::memory_order_relaxed); }
+
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+// Process wide registry of named counters and gauges. Lookups take a
+// lock so callers on hot paths should look a metric up once and keep
+// the returned reference (metrics are never removed).
+class Metrics {
+ public:
+  static Metrics& Default();
+
+  Counter& GetCounter(const std::string& name);
+
+  Gauge& GetGauge(const std::string& name);
+
+  // Writes every metric in the Prometheus text exposition format.
+  void Dump(std::ostream& out);
+
+ private:
+  std::mutex mutex_;
+  std::map<std::string, std::unique_ptr<Counter>> counters_;
+  std::map<std::string, std::unique_ptr<Gauge>> gauges_;
+};
+
+// Times consecutive phases, e.g., of startup, printing each one and
+// exporting it as the gauge '<prefix>_<phase>_ms'.
+class PhaseTimer {
+ public:
+  explicit PhaseTimer(const std::string& prefix);
+
+  // Ends the phase started by the previous 'Lap()' (or construction)
+  // naming it 'phase'.
+  void Lap(const std::string& phase);
+
+  // Exports the time since construction as '<prefix>_total_ms'.
+  void Total();
+
+ private:
+  void Export(
+      const std::string& phase,
+      std::chrono::steady_clock::time_point start);
+
+  const std::string prefix_;
+  const std::chrono::steady_clock::time_point start_;
+  std::chrono::steady_clock::time_point lap_;
+};
+
+// Starts a detached thread that dumps the default metrics to stdout
+// every 'interval'. Does nothing if 'interval' is zero.
+void StartMetricsReporter(std::chrono::seconds interval);
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_METRICS_H_
@@ -0,0 +1,94 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_MPSC_QUEUE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+namespace routeguide {
+
+// Unbounded multiple producer, single consumer queue. Pushing is a
+// single atomic exchange (no lock, no retry loop) so producers never
+// wait for each other or for the consumer. The consumer may briefly
+// see the queue as empty while a producer is halfway through a push,
+// 'Empty()' doesn't (it's what a consumer should check before going to
+// sleep).
+template <typename T>
+class MpscQueue {
+ public:
+  MpscQueue() : head_(&stub_), tail_(&stub_) {}
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  ~MpscQueue() {
+    T value;
+    while (TryPop(&value)) {}
+    if (tail_ != &stub_) {
+      delete tail_;
+    }
+  }
+
+  // May be called from any thread.
+  void Push(T value) {
+    Node* node = new Node();
+    node->value.emplace(std::move(value));
+    Node* previous = head_.exchange(node, std::memory_order_seq_cst);
+    previous->next.store(node, std::memory_order_release);
+  }
+
+  // Consumer only.
+  bool TryPop(T* value) {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+    *value = std::move(*next->value);
+    next->value.reset();
+    tail_ = next;
+    if (tail != &stub_) {
+      delete tail;
+    }
+    return true;
+  }
+
+  // Consumer only. False as soon as a push has started.
+  bool Empty() const {
+    return head_.load(std::memory_order_seq_cst) == tail_;
+  }
+
+ private:
+  struct Node {
+    std::atomic<Node*> next{nullptr};
+    std::optional<T> value;
+  };
+
+  Node stub_;
+  // Last pushed node, producers swap themselves in here.
+  std::atomic<Node*> head_;
+  // Last popped node (or 'stub_'), whose successor is the next to pop.
+  Node* tail_;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_MPSC_QUEUE_H_
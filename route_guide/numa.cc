@@ -0,0 +1,126 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "numa.h"
+
+#include <sched.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace routeguide {
+
+namespace {
+
+// Parses a sysfs list of cpus or nodes, e.g., "0-3,8-11".
+std::vector<int> ParseList(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    int first = 0;
+    int last = 0;
+    char dash = 0;
+    std::stringstream parts(range);
+    if (!(parts >> first)) {
+      continue;
+    }
+    last = first;
+    if ((parts >> dash >> last && dash != '-') || first < 0) {
+      continue;
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+// Returns the first line of 'path', or "" if it can't be read.
+std::string ReadLine(const std::string& path) {
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+
+}  // namespace
+
+NumaTopology NumaTopology::Detect() {
+  NumaTopology topology;
+
+  // Online node ids can have gaps (e.g., after hot removal), and nodes
+  // without cpus (memory only, e.g., CXL or HBM) can't run a thread to
+  // place a replica with, so they're left out.
+  const std::string kNodes = "/sys/devices/system/node/";
+  for (int node : ParseList(ReadLine(kNodes + "online"))) {
+    std::vector<int> cpus = ParseList(
+        ReadLine(kNodes + "node" + std::to_string(node) + "/cpulist"));
+    if (!cpus.empty()) {
+      topology.cpus_.push_back(std::move(cpus));
+    }
+  }
+
+  if (topology.cpus_.empty()) {
+    std::vector<int> cpus;
+    for (unsigned cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++) {
+      cpus.push_back(cpu);
+    }
+    topology.cpus_.push_back(std::move(cpus));
+  }
+
+  for (size_t node = 0; node < topology.cpus_.size(); node++) {
+    for (int cpu : topology.cpus_[node]) {
+      if (static_cast<size_t>(cpu) >= topology.node_of_cpu_.size()) {
+        topology.node_of_cpu_.resize(cpu + 1, 0);
+      }
+      topology.node_of_cpu_[cpu] = node;
+    }
+  }
+
+  return topology;
+}
+
+size_t NumaTopology::CurrentNode() const {
+  int cpu = sched_getcpu();
+  if (cpu < 0 || static_cast<size_t>(cpu) >= node_of_cpu_.size()) {
+    return 0;
+  }
+  return node_of_cpu_[cpu];
+}
+
+bool NumaTopology::PinToNode(size_t node) const {
+  // Sized for the highest cpu, which may be past 'CPU_SETSIZE'.
+  size_t count = node_of_cpu_.size();
+  cpu_set_t* set = CPU_ALLOC(count);
+  if (set == nullptr) {
+    return false;
+  }
+  size_t size = CPU_ALLOC_SIZE(count);
+  CPU_ZERO_S(size, set);
+  for (int cpu : cpus_[node]) {
+    CPU_SET_S(cpu, size, set);
+  }
+  bool pinned = sched_setaffinity(0, size, set) == 0;
+  CPU_FREE(set);
+  return pinned;
+}
+
+}  // namespace routeguide
@@ -0,0 +1,55 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_NUMA_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_NUMA_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace routeguide {
+
+// The machine's NUMA nodes and the cpus on each, as reported by sysfs.
+// Nodes are numbered densely from 0 in the order of their sysfs ids,
+// skipping nodes without cpus. Machines (or containers) without NUMA
+// information look like a single node with every cpu.
+class NumaTopology {
+ public:
+  static NumaTopology Detect();
+
+  size_t nodes() const { return cpus_.size(); }
+
+  const std::vector<int>& cpus(size_t node) const { return cpus_[node]; }
+
+  // Node of the cpu the calling thread is running on. Threads can
+  // migrate so this is a hint, but one that is right nearly always.
+  size_t CurrentNode() const;
+
+  // Restricts the calling thread to the cpus of 'node', returning
+  // false (leaving it as is) if the kernel refuses, e.g., because the
+  // process' cpuset excludes them all.
+  bool PinToNode(size_t node) const;
+
+ private:
+  std::vector<std::vector<int>> cpus_;
+  std::vector<size_t> node_of_cpu_;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_NUMA_H_
@@ -0,0 +1,327 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "perfect_hash_index.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+namespace routeguide {
+
+namespace {
+
+// Maximum number of keys per bucket on average.
+const uint64_t kBucketSize = 4;
+
+// Finalizer of splitmix64, as in 'PointIndex'.
+uint64_t Mix(uint64_t value) {
+  value ^= value >> 30;
+  value *= 0xbf58476d1ce4e5b9ULL;
+  value ^= value >> 27;
+  value *= 0x94d049bb133111ebULL;
+  value ^= value >> 31;
+  return value;
+}
+
+// Maps 'value' uniformly into [0, range) without a division.
+uint64_t Reduce(uint64_t value, uint64_t range) {
+  return static_cast<uint64_t>(
+      (static_cast<unsigned __int128>(value) * range) >> 64);
+}
+
+void PutUint64(std::string* out, uint64_t value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+uint64_t GetUint64(const char* data) {
+  uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+size_t PilotsSize(uint64_t bucket_count) {
+  // Padded so that the ids that follow stay 8 byte aligned.
+  return (bucket_count * sizeof(uint16_t) + 7) & ~size_t(7);
+}
+
+// Words of 'id_bits' bit ids for 'slot_count' slots, padding included.
+uint64_t IdWords(uint64_t slot_count, uint64_t id_bits) {
+  return (slot_count * id_bits + 63) / 64 + 1;
+}
+
+}  // namespace
+
+PerfectHashIndex::PerfectHashIndex(
+    const FlatArray<Coordinate>& coordinates) {
+  std::vector<Key> keys;
+  keys.reserve(coordinates.size());
+  for (uint32_t id = 0; id < coordinates.size(); id++) {
+    keys.push_back(Key{PackCoordinate(coordinates[id]), id});
+  }
+  // Keep the first feature at a coordinate, like a linear scan would.
+  std::sort(
+      keys.begin(),
+      keys.end(),
+      [](const Key& a, const Key& b) {
+        return a.key < b.key || (a.key == b.key && a.id < b.id);
+      });
+  keys.erase(
+      std::unique(
+          keys.begin(),
+          keys.end(),
+          [](const Key& a, const Key& b) { return a.key == b.key; }),
+      keys.end());
+
+  uint32_t id_bits = 1;
+  while (id_bits < 32 && (uint64_t(1) << id_bits) < coordinates.size()) {
+    id_bits++;
+  }
+
+  // A seed only fails if some bucket has no pilot that fits, which is
+  // vanishingly rare, so this practically never loops.
+  while (!TryBuild(keys, id_bits)) {
+    seed_++;
+  }
+}
+
+bool PerfectHashIndex::TryBuild(
+    const std::vector<Key>& keys,
+    uint32_t id_bits) {
+  size_t bucket_count = std::max<size_t>(
+      (keys.size() + kBucketSize - 1) / kBucketSize,
+      1);
+  size_t slot_count = keys.size() + keys.size() / 32 + 1;
+  HugePageVector<uint16_t> pilots(bucket_count, 0);
+  // Only while building, to tell taken slots from free ones.
+  std::vector<bool> taken(slot_count, false);
+  HugePageVector<uint64_t> ids(IdWords(slot_count, id_bits), 0);
+
+  // Group keys by bucket (counting sort).
+  std::vector<uint64_t> hashes(keys.size());
+  std::vector<uint32_t> starts(bucket_count + 1, 0);
+  for (size_t i = 0; i < keys.size(); i++) {
+    hashes[i] = Hash(keys[i].key);
+    starts[Bucket(hashes[i], bucket_count) + 1]++;
+  }
+  for (size_t bucket = 0; bucket < bucket_count; bucket++) {
+    starts[bucket + 1] += starts[bucket];
+  }
+  std::vector<uint32_t> grouped(keys.size());
+  {
+    std::vector<uint32_t> next(starts.begin(), starts.end() - 1);
+    for (uint32_t i = 0; i < keys.size(); i++) {
+      grouped[next[Bucket(hashes[i], bucket_count)]++] = i;
+    }
+  }
+
+  // Place the largest buckets first, while the table is emptiest.
+  std::vector<uint32_t> order(bucket_count);
+  for (uint32_t bucket = 0; bucket < bucket_count; bucket++) {
+    order[bucket] = bucket;
+  }
+  std::stable_sort(
+      order.begin(),
+      order.end(),
+      [&starts](uint32_t a, uint32_t b) {
+        return starts[a + 1] - starts[a] > starts[b + 1] - starts[b];
+      });
+
+  std::vector<uint64_t> positions;
+  for (uint32_t bucket : order) {
+    uint32_t first = starts[bucket];
+    uint32_t last = starts[bucket + 1];
+    if (first == last) {
+      break;
+    }
+    bool placed = false;
+    for (uint32_t pilot = 0; pilot <= UINT16_MAX && !placed; pilot++) {
+      positions.clear();
+      placed = true;
+      for (uint32_t i = first; i < last; i++) {
+        uint64_t position =
+            Position(hashes[grouped[i]], pilot, slot_count);
+        if (taken[position]
+            || std::find(positions.begin(), positions.end(), position)
+                != positions.end()) {
+          placed = false;
+          break;
+        }
+        positions.push_back(position);
+      }
+      if (placed) {
+        pilots[bucket] = pilot;
+        for (uint32_t i = first; i < last; i++) {
+          uint64_t position = positions[i - first];
+          taken[position] = true;
+          // Ids are below 2^'id_bits', at most two words hold one.
+          uint64_t bit = position * id_bits;
+          uint64_t id = keys[grouped[i]].id;
+          ids[bit / 64] |= id << (bit % 64);
+          if (bit % 64 + id_bits > 64) {
+            ids[bit / 64 + 1] |= id >> (64 - bit % 64);
+          }
+        }
+      }
+    }
+    if (!placed) {
+      return false;
+    }
+  }
+
+  slot_count_ = slot_count;
+  id_bits_ = id_bits;
+  pilots_ = std::move(pilots);
+  ids_ = std::move(ids);
+
+  return true;
+}
+
+void PerfectHashIndex::FindBatch(
+    const Coordinate* coordinates,
+    size_t count,
+    uint32_t* ids,
+    const FlatArray<Coordinate>& indexed) const {
+  if (empty()) {
+    std::fill(ids, ids + count, kNotFound);
+    return;
+  }
+  constexpr size_t kGroup = 16;
+  uint64_t hashes[kGroup];
+  uint64_t slots[kGroup];
+  for (size_t first = 0; first < count; first += kGroup) {
+    size_t size = std::min(kGroup, count - first);
+    for (size_t i = 0; i < size; i++) {
+      hashes[i] = Hash(PackCoordinate(coordinates[first + i]));
+      __builtin_prefetch(&pilots_[Bucket(hashes[i], pilots_.size())]);
+    }
+    for (size_t i = 0; i < size; i++) {
+      slots[i] = Slot(hashes[i]);
+      __builtin_prefetch(IdBytes(slots[i]));
+    }
+    for (size_t i = 0; i < size; i++) {
+      ids[first + i] = Id(slots[i]);
+      if (ids[first + i] < indexed.size()) {
+        __builtin_prefetch(&indexed[ids[first + i]]);
+      }
+    }
+    for (size_t i = 0; i < size; i++) {
+      ids[first + i] = Confirm(coordinates[first + i], ids[first + i], indexed);
+    }
+  }
+}
+
+void PerfectHashIndex::Prefetch(const Coordinate& coordinate) const {
+  if (!empty()) {
+    uint64_t hash = Hash(PackCoordinate(coordinate));
+    __builtin_prefetch(&pilots_[Bucket(hash, pilots_.size())]);
+  }
+}
+
+void PerfectHashIndex::Serialize(std::string* out) const {
+  PutUint64(out, seed_);
+  PutUint64(out, pilots_.size());
+  PutUint64(out, slot_count_);
+  PutUint64(out, id_bits_);
+  size_t pilots_start = out->size();
+  out->append(
+      reinterpret_cast<const char*>(pilots_.data()),
+      pilots_.size() * sizeof(uint16_t));
+  out->resize(pilots_start + PilotsSize(pilots_.size()), '\0');
+  out->append(
+      reinterpret_cast<const char*>(ids_.data()),
+      ids_.size() * sizeof(uint64_t));
+}
+
+bool PerfectHashIndex::Deserialize(
+    const char* data,
+    size_t size,
+    std::shared_ptr<const void> owner,
+    PerfectHashIndex* index) {
+  if (size < 4 * sizeof(uint64_t)) {
+    return false;
+  }
+  uint64_t seed = GetUint64(data);
+  uint64_t bucket_count = GetUint64(data + 8);
+  uint64_t slot_count = GetUint64(data + 16);
+  uint64_t id_bits = GetUint64(data + 24);
+  size -= 4 * sizeof(uint64_t);
+  data += 4 * sizeof(uint64_t);
+  if (bucket_count == 0
+      || slot_count == 0
+      || id_bits == 0
+      || id_bits > 32
+      || bucket_count > size
+      || slot_count > size * 8 / id_bits
+      || PilotsSize(bucket_count)
+              + IdWords(slot_count, id_bits) * sizeof(uint64_t)
+          != size) {
+    return false;
+  }
+
+  const char* pilots = data;
+  const char* ids = data + PilotsSize(bucket_count);
+  uint64_t id_words = IdWords(slot_count, id_bits);
+
+  index->seed_ = seed;
+  index->slot_count_ = slot_count;
+  index->id_bits_ = static_cast<uint32_t>(id_bits);
+  if (owner) {
+    if (reinterpret_cast<uintptr_t>(ids) % alignof(uint64_t) != 0) {
+      return false;
+    }
+    index->pilots_ = FlatArray<uint16_t>(
+        reinterpret_cast<const uint16_t*>(pilots),
+        bucket_count,
+        owner);
+    index->ids_ = FlatArray<uint64_t>(
+        reinterpret_cast<const uint64_t*>(ids),
+        id_words,
+        std::move(owner));
+  } else {
+    HugePageVector<uint16_t> copied_pilots(bucket_count);
+    std::memcpy(
+        copied_pilots.data(),
+        pilots,
+        bucket_count * sizeof(uint16_t));
+    HugePageVector<uint64_t> copied_ids(id_words);
+    std::memcpy(copied_ids.data(), ids, id_words * sizeof(uint64_t));
+    index->pilots_ = std::move(copied_pilots);
+    index->ids_ = std::move(copied_ids);
+  }
+
+  return true;
+}
+
+uint64_t PerfectHashIndex::Hash(uint64_t key) const {
+  return Mix(key ^ (seed_ * 0x9e3779b97f4a7c15ULL));
+}
+
+uint64_t PerfectHashIndex::Bucket(uint64_t hash, uint64_t bucket_count) {
+  return Reduce(hash, bucket_count);
+}
+
+uint64_t PerfectHashIndex::Position(
+    uint64_t hash,
+    uint16_t pilot,
+    uint64_t slot_count) {
+  return Reduce(Mix(hash ^ Mix(pilot + 1)), slot_count);
+}
+
+}  // namespace routeguide
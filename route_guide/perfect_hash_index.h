@@ -0,0 +1,152 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_PERFECT_HASH_INDEX_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_PERFECT_HASH_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "coordinate.h"
+#include "flat_array.h"
+#include "huge_pages.h"
+
+namespace routeguide {
+
+// Perfect hash index from a coordinate to the id of the first feature
+// at that coordinate, an alternative to 'PointIndex' for a feature set
+// that doesn't change between loads: it is built once (by the db
+// converter) and every lookup is exactly one probe.
+//
+// Built PTHash style: keys are hashed into buckets of ~4 and, largest
+// bucket first, each bucket gets the smallest 16 bit "pilot" that
+// places all of its keys into free slots. The table has ~3% more slots
+// than keys, which keeps pilots small. Only the pilots and the feature
+// id of each slot (bit packed, in as many bits as the largest id
+// needs) are kept, not the keys, i.e., ~4 + 1.03 * log2(features) bits
+// per feature: a lookup confirms the feature it probed against the
+// coordinates the index was built over, which callers pass in.
+class PerfectHashIndex {
+ public:
+  static constexpr uint32_t kNotFound = UINT32_MAX;
+
+  PerfectHashIndex() = default;
+
+  explicit PerfectHashIndex(const FlatArray<Coordinate>& coordinates);
+
+  bool empty() const { return pilots_.empty(); }
+
+  // 'indexed' are the coordinates the index was built over.
+  uint32_t Find(
+      const Coordinate& coordinate,
+      const FlatArray<Coordinate>& indexed) const {
+    if (empty()) {
+      return kNotFound;
+    }
+    return Confirm(coordinate, Id(Slot(Hash(PackCoordinate(coordinate)))),
+                   indexed);
+  }
+
+  // See 'PointIndex::FindBatch()', here pilots, then ids and then the
+  // features' coordinates are prefetched for a group of keys.
+  void FindBatch(
+      const Coordinate* coordinates,
+      size_t count,
+      uint32_t* ids,
+      const FlatArray<Coordinate>& indexed) const;
+
+  // See 'PointIndex::Prefetch()', only the pilot is prefetched since the
+  // slot depends on it.
+  void Prefetch(const Coordinate& coordinate) const;
+
+  size_t MemoryUsage() const {
+    return pilots_.MemoryUsage() + ids_.MemoryUsage();
+  }
+
+  // Appends the index to 'out' in a form 'Deserialize()' reads back.
+  void Serialize(std::string* out) const;
+
+  // Reads an index written by 'Serialize()' from 'size' bytes at 'data'
+  // into 'index', returning false if they don't hold a valid index. If
+  // 'owner' is set the index is used in place, 'data' must then be 8
+  // byte aligned and stay valid while 'owner' does, otherwise it's
+  // copied. Its ids aren't checked: lookups only use those within the
+  // coordinates they're passed.
+  static bool Deserialize(
+      const char* data,
+      size_t size,
+      std::shared_ptr<const void> owner,
+      PerfectHashIndex* index);
+
+ private:
+  struct Key {
+    uint64_t key;
+    uint32_t id;
+  };
+
+  bool TryBuild(const std::vector<Key>& keys, uint32_t id_bits);
+
+  uint64_t Hash(uint64_t key) const;
+
+  static uint64_t Bucket(uint64_t hash, uint64_t bucket_count);
+
+  static uint64_t Position(uint64_t hash, uint16_t pilot, uint64_t slot_count);
+
+  uint64_t Slot(uint64_t hash) const {
+    return Position(
+        hash,
+        pilots_[Bucket(hash, pilots_.size())],
+        slot_count_);
+  }
+
+  // Bytes of the packed ids that hold the id of 'slot'.
+  const char* IdBytes(uint64_t slot) const {
+    return reinterpret_cast<const char*>(ids_.data())
+        + slot * id_bits_ / 8;
+  }
+
+  // A single unaligned load, the ids are followed by a padding word.
+  uint32_t Id(uint64_t slot) const {
+    uint64_t bits;
+    std::memcpy(&bits, IdBytes(slot), sizeof(bits));
+    return static_cast<uint32_t>(
+        (bits >> (slot * id_bits_ % 8)) & ((uint64_t(1) << id_bits_) - 1));
+  }
+
+  static uint32_t Confirm(
+      const Coordinate& coordinate,
+      uint32_t id,
+      const FlatArray<Coordinate>& indexed) {
+    return id < indexed.size() && indexed[id] == coordinate ? id : kNotFound;
+  }
+
+  uint64_t seed_ = 0;
+  uint64_t slot_count_ = 0;
+  uint32_t id_bits_ = 1;
+  FlatArray<uint16_t> pilots_;
+  // 'id_bits_' per slot (0 for a free one), then a word of padding.
+  FlatArray<uint64_t> ids_;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_PERFECT_HASH_INDEX_H_
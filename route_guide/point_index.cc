@@ -0,0 +1,97 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "point_index.h"
+
+#include <algorithm>
+
+namespace routeguide {
+
+PointIndex::PointIndex(const FlatArray<Coordinate>& coordinates) {
+  size_t size = 16;
+  while (size < coordinates.size() * 2) {
+    size *= 2;
+  }
+  slots_.resize(size);
+  mask_ = size - 1;
+
+  for (uint32_t id = 0; id < coordinates.size(); id++) {
+    uint64_t key = PackCoordinate(coordinates[id]);
+    uint64_t i = Hash(key) & mask_;
+    while (slots_[i].id != kNotFound && slots_[i].key != key) {
+      i = (i + 1) & mask_;
+    }
+    // Keep the first feature at a coordinate, like a linear scan would.
+    if (slots_[i].id == kNotFound) {
+      slots_[i].key = key;
+      slots_[i].id = id;
+    }
+  }
+}
+
+uint32_t PointIndex::Find(const Coordinate& coordinate) const {
+  if (slots_.empty()) {
+    return kNotFound;
+  }
+  uint64_t key = PackCoordinate(coordinate);
+  return Probe(key, Hash(key) & mask_);
+}
+
+void PointIndex::FindBatch(
+    const Coordinate* coordinates,
+    size_t count,
+    uint32_t* ids) const {
+  if (slots_.empty()) {
+    std::fill(ids, ids + count, kNotFound);
+    return;
+  }
+  uint64_t keys[kBatchSize];
+  uint64_t starts[kBatchSize];
+  for (size_t first = 0; first < count; first += kBatchSize) {
+    size_t size = std::min(kBatchSize, count - first);
+    for (size_t i = 0; i < size; i++) {
+      keys[i] = PackCoordinate(coordinates[first + i]);
+      starts[i] = Hash(keys[i]) & mask_;
+      __builtin_prefetch(&slots_[starts[i]]);
+    }
+    for (size_t i = 0; i < size; i++) {
+      ids[first + i] = Probe(keys[i], starts[i]);
+    }
+  }
+}
+
+uint32_t PointIndex::Probe(uint64_t key, uint64_t i) const {
+  for (;; i = (i + 1) & mask_) {
+    const Slot& slot = slots_[i];
+    if (slot.id == kNotFound || slot.key == key) {
+      return slot.id;
+    }
+  }
+}
+
+uint64_t PointIndex::Hash(uint64_t key) {
+  // Finalizer of splitmix64, cheap and mixes every input bit.
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+  return key;
+}
+
+}  // namespace routeguide
@@ -0,0 +1,86 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_POINT_INDEX_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_POINT_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "coordinate.h"
+#include "flat_array.h"
+#include "huge_pages.h"
+
+namespace routeguide {
+
+// Hash index from a coordinate to the id (position) of the first
+// feature at that coordinate. Built once and read-only afterwards so
+// it can be shared by every thread without synchronization.
+//
+// Open addressing with linear probing over a flat array kept at most
+// half full, so a lookup is typically a single cache miss.
+class PointIndex {
+ public:
+  static constexpr uint32_t kNotFound = UINT32_MAX;
+
+  // Number of keys 'FindBatch()' has in flight at once.
+  static constexpr size_t kBatchSize = 16;
+
+  PointIndex() = default;
+
+  explicit PointIndex(const FlatArray<Coordinate>& coordinates);
+
+  uint32_t Find(const Coordinate& coordinate) const;
+
+  // Like 'Find()' for each of 'count' coordinates, storing the results
+  // in 'ids'. Keys are hashed and their slots prefetched a group at a
+  // time before any is probed, so on an index larger than the cache
+  // the misses of a group overlap instead of stalling one by one.
+  void FindBatch(
+      const Coordinate* coordinates,
+      size_t count,
+      uint32_t* ids) const;
+
+  // Prefetches the slot a 'Find()' of 'coordinate' starts at, for
+  // lookups that don't arrive together but are known a little ahead.
+  void Prefetch(const Coordinate& coordinate) const {
+    if (!slots_.empty()) {
+      __builtin_prefetch(&slots_[Hash(PackCoordinate(coordinate)) & mask_]);
+    }
+  }
+
+  size_t MemoryUsage() const { return slots_.capacity() * sizeof(Slot); }
+
+ private:
+  struct Slot {
+    uint64_t key = 0;
+    uint32_t id = kNotFound;
+  };
+
+  static uint64_t Hash(uint64_t key);
+
+  // Probes for 'key' starting at slot 'i'.
+  uint32_t Probe(uint64_t key, uint64_t i) const;
+
+  HugePageVector<Slot> slots_;
+  uint64_t mask_ = 0;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_POINT_INDEX_H_
@@ -0,0 +1,97 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "replicated_feature_store.h"
+
+#include <string>
+#include <thread>
+
+namespace routeguide {
+
+ReplicatedFeatureStore::ReplicatedFeatureStore(
+    std::unique_ptr<FeatureStore> store) {
+  replicas_.push_back(std::move(store));
+}
+
+std::unique_ptr<ReplicatedFeatureStore> ReplicatedFeatureStore::Replicate(
+    std::unique_ptr<FeatureStore> store,
+    NumaTopology topology,
+    std::string* error) {
+  if (topology.nodes() == 1) {
+    return std::make_unique<ReplicatedFeatureStore>(std::move(store));
+  }
+
+  std::unique_ptr<ReplicatedFeatureStore> replicated(
+      new ReplicatedFeatureStore());
+  replicated->replicas_.resize(topology.nodes());
+
+  // Copy onto every node in parallel, the original is only read. A copy
+  // made by a thread that couldn't be pinned could be placed anywhere,
+  // so it isn't made.
+  std::vector<char> pinned(topology.nodes(), false);
+  std::vector<std::thread> threads;
+  for (size_t node = 0; node < topology.nodes(); node++) {
+    threads.emplace_back([&, node]() {
+      pinned[node] = topology.PinToNode(node);
+      if (pinned[node]) {
+        replicated->replicas_[node] = store->Clone();
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  for (size_t node = 0; node < topology.nodes(); node++) {
+    if (!pinned[node]) {
+      *error = "couldn't pin a thread to NUMA node " + std::to_string(node)
+          + ", not replicating";
+      return std::make_unique<ReplicatedFeatureStore>(std::move(store));
+    }
+  }
+
+  replicated->topology_ = std::move(topology);
+
+  return replicated;
+}
+
+std::unique_ptr<ReplicatedFeatureStore> ReplicatedFeatureStore::ApplyDelta(
+    const std::vector<FeatureChange>& delta,
+    std::string* error) const {
+  std::unique_ptr<ReplicatedFeatureStore> updated(
+      new ReplicatedFeatureStore());
+  for (const auto& replica : replicas_) {
+    std::unique_ptr<FeatureStore> store = replica->ApplyDelta(delta, error);
+    if (!store) {
+      return nullptr;
+    }
+    updated->replicas_.push_back(std::move(store));
+  }
+  updated->topology_ = topology_;
+  return updated;
+}
+
+size_t ReplicatedFeatureStore::MemoryUsage() const {
+  size_t usage = 0;
+  for (const auto& replica : replicas_) {
+    usage += replica->MemoryUsage();
+  }
+  return usage;
+}
+
+}  // namespace routeguide
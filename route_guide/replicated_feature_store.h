@@ -0,0 +1,76 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_REPLICATED_FEATURE_STORE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_REPLICATED_FEATURE_STORE_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "feature_store.h"
+#include "numa.h"
+
+namespace routeguide {
+
+// One copy of an immutable 'FeatureStore' per NUMA node so that lookups
+// read memory local to the socket the calling thread runs on instead of
+// paying cross node latency on every cache miss.
+class ReplicatedFeatureStore {
+ public:
+  // A single, unreplicated store.
+  explicit ReplicatedFeatureStore(std::unique_ptr<FeatureStore> store);
+
+  // Copies 'store' onto every node of 'topology'. Each copy is made by
+  // a thread pinned to that node so the kernel's first touch policy
+  // allocates its pages there. If a thread can't be pinned 'store' is
+  // returned unreplicated, setting 'error'.
+  static std::unique_ptr<ReplicatedFeatureStore> Replicate(
+      std::unique_ptr<FeatureStore> store,
+      NumaTopology topology,
+      std::string* error);
+
+  // The copy for the node the calling thread is running on.
+  const FeatureStore& Local() const {
+    return replicas_.size() == 1
+        ? *replicas_[0]
+        : *replicas_[topology_.CurrentNode()];
+  }
+
+  size_t replicas() const { return replicas_.size(); }
+
+  // Returns the replicas with 'delta' applied to each, see
+  // 'FeatureStore::ApplyDelta()', or nullptr (setting 'error'). The
+  // changes are small so they aren't placed on any particular node.
+  std::unique_ptr<ReplicatedFeatureStore> ApplyDelta(
+      const std::vector<FeatureChange>& delta,
+      std::string* error) const;
+
+  size_t MemoryUsage() const;
+
+ private:
+  ReplicatedFeatureStore() = default;
+
+  NumaTopology topology_;
+  std::vector<std::unique_ptr<FeatureStore>> replicas_;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_REPLICATED_FEATURE_STORE_H_
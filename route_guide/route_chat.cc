@@ -0,0 +1,435 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "route_chat.h"
+
+#include <algorithm>
+#include <charconv>
+
+#include "coordinate.h"
+#include "metrics.h"
+
+namespace routeguide {
+
+namespace {
+
+// Notes a sequencer takes from its mailbox before handing the posting
+// streams their replies.
+const size_t kBatchSize = 256;
+
+// What a queued cursor is charged, its queue node included.
+const size_t kCursorSize = sizeof(ChatCursor) + 2 * sizeof(void*);
+
+// A log record's header, the size of the serialized note.
+const size_t kLogHeaderSize = 4;
+
+std::string EncodeChatLogRecord(const RouteNote& note) {
+  std::string payload = note.SerializeAsString();
+  uint32_t size = payload.size();
+  std::string record(kLogHeaderSize, '\0');
+  for (size_t i = 0; i < kLogHeaderSize; i++) {
+    record[i] = static_cast<char>(size >> (8 * i));
+  }
+  return record + payload;
+}
+
+uint64_t LocationKey(const RouteNote& note) {
+  return PackCoordinate(
+      note.location().latitude(),
+      note.location().longitude());
+}
+
+// Parses the number at '*first' up to 'separator', moving past both.
+template <typename T>
+bool ParseField(const char** first, const char* last, char separator,
+                T* value) {
+  auto parsed = std::from_chars(*first, last, *value);
+  if (parsed.ec != std::errc() || parsed.ptr == last
+      || *parsed.ptr != separator) {
+    return false;
+  }
+  *first = parsed.ptr + 1;
+  return true;
+}
+
+Gauge& SubscriptionsGauge() {
+  static Gauge& subscriptions =
+      Metrics::Default().GetGauge("route_chat_subscriptions");
+  return subscriptions;
+}
+
+}  // namespace
+
+std::optional<std::vector<ChatResumePoint>> ParseChatResumePoints(
+    const std::string& spec,
+    std::string* error) {
+  // Every field ends with a separator, the last point's included.
+  std::string fields = spec + ';';
+  const char* first = fields.data();
+  const char* last = fields.data() + fields.size();
+  std::vector<ChatResumePoint> points;
+  while (first != last) {
+    ChatResumePoint point;
+    if (!ParseField(&first, last, ',', &point.location.latitude)
+        || !ParseField(&first, last, ',', &point.location.longitude)
+        || !ParseField(&first, last, ';', &point.sequence)) {
+      *error = "invalid resume points '" + spec
+          + "', expected '<lat>,<lon>,<sequence>' separated by ';'";
+      return std::nullopt;
+    }
+    points.push_back(point);
+  }
+  return points;
+}
+
+size_t ParseChatLog(
+    const std::string& contents,
+    std::vector<RouteNote>* notes) {
+  size_t position = 0;
+  while (contents.size() - position >= kLogHeaderSize) {
+    uint32_t size = 0;
+    for (size_t i = 0; i < kLogHeaderSize; i++) {
+      size |= static_cast<uint32_t>(
+                  static_cast<uint8_t>(contents[position + i]))
+          << (8 * i);
+    }
+    RouteNote note;
+    if (size > contents.size() - position - kLogHeaderSize
+        || !note.ParseFromArray(
+            contents.data() + position + kLogHeaderSize,
+            size)) {
+      break;
+    }
+    notes->push_back(std::move(note));
+    position += kLogHeaderSize + size;
+  }
+  return position;
+}
+
+RouteChatStream::~RouteChatStream() {
+  ChatCursor cursor;
+  while (outbound_.TryPop(&cursor)) {
+    budget_->Release(kCursorSize);
+  }
+}
+
+bool RouteChatStream::Pop(RouteNote* note) {
+  while (!current_.Next(note)) {
+    if (!outbound_.TryPop(&current_)) {
+      return false;
+    }
+    queued_bytes_.fetch_sub(kCursorSize, std::memory_order_relaxed);
+    budget_->Release(kCursorSize);
+  }
+  return true;
+}
+
+void RouteChatStream::Notify(std::function<void()> wake) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!Ready()) {
+    waiter_ = std::move(wake);
+    return;
+  }
+  lock.unlock();
+  wake();
+}
+
+void RouteChatStream::Close() {
+  closed_.store(true, std::memory_order_release);
+  Wake();
+}
+
+bool RouteChatStream::Ready() {
+  if (closed_.load(std::memory_order_relaxed)) {
+    return true;
+  } else if (stopped_) {
+    return false;
+  } else if (overflowed_.load(std::memory_order_relaxed)) {
+    return true;
+  }
+  // A cursor still halfway through being pushed isn't seen here, but
+  // its push wakes the waiter once it's done.
+  if (current_.remaining() == 0 && outbound_.TryPop(&current_)) {
+    queued_bytes_.fetch_sub(kCursorSize, std::memory_order_relaxed);
+    budget_->Release(kCursorSize);
+  }
+  return current_.remaining() > 0;
+}
+
+void RouteChatStream::Wake() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::function<void()> wake = std::move(waiter_);
+  waiter_ = nullptr;
+  lock.unlock();
+  if (wake) {
+    wake();
+  }
+}
+
+void RouteChatStream::Push(ChatCursor cursor) {
+  if (overflowed_.load(std::memory_order_relaxed)
+      || cursor.remaining() == 0) {
+    return;
+  }
+  size_t size = kCursorSize;
+  size_t limit = budget_->stream_limit();
+  if ((limit > 0
+       && queued_bytes_.load(std::memory_order_relaxed) + size > limit)
+      || !budget_->TryCharge(size)) {
+    overflowed_.store(true, std::memory_order_release);
+  } else {
+    queued_bytes_.fetch_add(size, std::memory_order_relaxed);
+    outbound_.Push(std::move(cursor));
+  }
+}
+
+RouteChatHub::RouteChatHub(
+    size_t shards,
+    size_t history_limit,
+    AppendLog* log)
+  : log_(log) {
+  for (size_t i = 0; i < std::max<size_t>(shards, 1); i++) {
+    shards_.push_back(std::make_unique<Shard>());
+  }
+  history_limit_ = history_limit / shards_.size();
+  for (auto& shard : shards_) {
+    shard->sequencer = std::thread([this, shard = shard.get()]() {
+      Sequence(shard);
+    });
+  }
+}
+
+RouteChatHub::~RouteChatHub() {
+  for (auto& shard : shards_) {
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    shard->stopping = true;
+    shard->wake.notify_one();
+  }
+  for (auto& shard : shards_) {
+    shard->sequencer.join();
+  }
+  std::unique_lock<std::mutex> lock(flushes_mutex_);
+  flushed_.wait(lock, [this]() { return pending_flushes_ == 0; });
+}
+
+RouteChatHub::Subscription::~Subscription() {
+  for (size_t i = 0; i < ids_.size(); i++) {
+    Shard* shard = hub_->shards_[i].get();
+    std::lock_guard<std::mutex> lock(shard->subscriptions_mutex);
+    shard->subscriptions.Erase(ids_[i]);
+  }
+  SubscriptionsGauge().Subtract(1);
+}
+
+std::unique_ptr<RouteChatHub::Subscription> RouteChatHub::Subscribe(
+    std::shared_ptr<RouteChatStream> stream,
+    const ChatArea& area) {
+  std::vector<uint64_t> ids;
+  ids.reserve(shards_.size());
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->subscriptions_mutex);
+    ids.push_back(shard->subscriptions.Insert(area, stream));
+  }
+  SubscriptionsGauge().Add(1);
+  return std::make_unique<Subscription>(this, std::move(ids));
+}
+
+void RouteChatHub::Post(
+    std::shared_ptr<RouteChatStream> stream,
+    RouteNote&& note,
+    Done done) {
+  Send(Message{std::move(stream), std::move(note), std::move(done)});
+}
+
+void RouteChatHub::Resume(
+    std::shared_ptr<RouteChatStream> stream,
+    const ChatResumePoint& point) {
+  RouteNote note;
+  note.mutable_location()->set_latitude(point.location.latitude);
+  note.mutable_location()->set_longitude(point.location.longitude);
+  note.set_sequence(point.sequence);
+  Send(Message{std::move(stream), std::move(note), nullptr, true});
+}
+
+void RouteChatHub::Restore(std::vector<RouteNote>&& notes) {
+  for (RouteNote& note : notes) {
+    Send(Message{nullptr, std::move(note), nullptr, false, true});
+  }
+}
+
+void RouteChatHub::Send(Message&& message) {
+  Shard* shard =
+      shards_[std::hash<uint64_t>()(LocationKey(message.note))
+              % shards_.size()]
+          .get();
+  shard->mailbox.Push(std::move(message));
+  // Pairs with the sequencer announcing it's going to sleep and then
+  // checking the mailbox (both sequentially consistent), so either it
+  // sees this note or this sees it sleeping.
+  if (shard->sleeping.load(std::memory_order_seq_cst)) {
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    shard->wake.notify_one();
+  }
+}
+
+void RouteChatHub::Sequence(Shard* shard) {
+  static Counter& notes =
+      Metrics::Default().GetCounter("route_chat_notes_total");
+  static Counter& batches =
+      Metrics::Default().GetCounter("route_chat_batches_total");
+  static Counter& deliveries =
+      Metrics::Default().GetCounter("route_chat_deliveries_total");
+  static Counter& evicted =
+      Metrics::Default().GetCounter("route_chat_evicted_bytes_total");
+  static Gauge& history_bytes =
+      Metrics::Default().GetGauge("route_chat_history_bytes");
+  static Counter& log_dropped =
+      Metrics::Default().GetCounter("route_chat_log_dropped_total");
+
+  std::vector<Message> batch;
+  batch.reserve(kBatchSize);
+  // Streams pushed to while 'subscriptions_mutex' is held, woken once
+  // it isn't.
+  std::vector<std::shared_ptr<RouteChatStream>> pushed;
+  while (true) {
+    Message message;
+    while (batch.size() < kBatchSize && shard->mailbox.TryPop(&message)) {
+      batch.push_back(std::move(message));
+    }
+
+    if (batch.empty()) {
+      std::unique_lock<std::mutex> lock(shard->mutex);
+      shard->sleeping.store(true, std::memory_order_seq_cst);
+      shard->wake.wait(lock, [shard]() {
+        return !shard->mailbox.Empty() || shard->stopping;
+      });
+      shard->sleeping.store(false, std::memory_order_relaxed);
+      if (shard->mailbox.Empty()) {
+        // Stopping, and everything posted has been sequenced.
+        return;
+      }
+      // A push may still be linking its note, 'TryPop()' catches up.
+      lock.unlock();
+      std::this_thread::yield();
+      continue;
+    }
+
+    size_t delivered = 0;
+    std::unique_lock<std::mutex> lock(shard->subscriptions_mutex);
+    for (Message& message : batch) {
+      uint64_t key = LocationKey(message.note);
+      if (message.resume) {
+        // Without creating a log for a location nothing was posted to.
+        auto history = shard->history.find(key);
+        if (history != shard->history.end()) {
+          message.stream->Push(
+              history->second.After(message.note.sequence()));
+          pushed.push_back(message.stream);
+        }
+        continue;
+      }
+      ChatLog& history = shard->history[key];
+      if (!message.restored) {
+        message.stream->Push(history.After(message.note.sequence()));
+        pushed.push_back(message.stream);
+      }
+      message.note.set_sequence(history.size() + 1);
+      if (log_ != nullptr
+          && !message.restored
+          && !log_->Append(EncodeChatLogRecord(message.note))) {
+        log_dropped.Increment();
+      }
+      Coordinate location{
+          message.note.location().latitude(),
+          message.note.location().longitude()};
+      // The note's slot is charged with its segment.
+      size_t bytes = message.note.SpaceUsedLong() - sizeof(RouteNote);
+      size_t segments = history.segments();
+      size_t used = history.bytes();
+      ChatCursor appended = history.Append(std::move(message.note), bytes);
+      if (history.segments() != segments) {
+        shard->segments.push_back(key);
+      }
+      shard->history_bytes += history.bytes() - used;
+      history_bytes.Add(history.bytes() - used);
+      while (history_limit_ > 0 && shard->history_bytes > history_limit_) {
+        auto oldest = shard->history.find(shard->segments.front());
+        size_t freed = oldest->second.EvictOldest();
+        // Dropping a location once it has nothing left keeps the map
+        // from growing with every location ever posted to.
+        if (oldest->second.segments() == 0) {
+          shard->history.erase(oldest);
+        }
+        shard->segments.pop_front();
+        shard->history_bytes -= freed;
+        history_bytes.Subtract(freed);
+        evicted.Increment(freed);
+      }
+      if (message.restored) {
+        continue;
+      }
+      shard->subscriptions.ForEachContaining(
+          location,
+          [&](const std::shared_ptr<RouteChatStream>& subscriber) {
+            if (subscriber != message.stream) {
+              subscriber->Push(appended);
+              pushed.push_back(subscriber);
+              delivered++;
+            }
+          });
+    }
+    lock.unlock();
+    for (const std::shared_ptr<RouteChatStream>& stream : pushed) {
+      stream->Wake();
+    }
+    pushed.clear();
+    // Only now that the whole batch is in the history, so that a stream
+    // that posts again right away finds its previous note there (and,
+    // with a log, once it's written).
+    std::vector<Done> done;
+    for (Message& message : batch) {
+      if (message.done) {
+        done.push_back(std::move(message.done));
+      }
+    }
+    if (log_ != nullptr && !done.empty()) {
+      {
+        std::lock_guard<std::mutex> flushes_lock(flushes_mutex_);
+        pending_flushes_++;
+      }
+      log_->Flush([this, done = std::move(done)](bool) {
+        for (const Done& posted : done) {
+          posted();
+        }
+        std::lock_guard<std::mutex> flushes_lock(flushes_mutex_);
+        pending_flushes_--;
+        flushed_.notify_all();
+      });
+    } else {
+      for (const Done& posted : done) {
+        posted();
+      }
+    }
+    notes.Increment(batch.size());
+    batches.Increment();
+    deliveries.Increment(delivered);
+    batch.clear();
+  }
+}
+
+}  // namespace routeguide
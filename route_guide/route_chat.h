@@ -0,0 +1,280 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_CHAT_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_CHAT_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "file_io.h"
+#include "memory_accounting.h"
+#include "mpsc_queue.h"
+#include "protos/route_guide.grpc.pb.h"
+#include "route_chat_area.h"
+#include "route_chat_log.h"
+
+namespace routeguide {
+
+// The notes queued for one 'RouteChat' stream to write, as cursors over
+// the hub's logs pushed by its sequencers, and popped a note at a time
+// by the stream's handler. However many notes a cursor covers only the
+// note being written is ever copied, so a replay of a long history
+// takes no more memory than a single note. Queued cursors are charged
+// against 'budget' (the stream's and the global limit): one that
+// doesn't fit is dropped and the stream marked as overflowed, after
+// which it should be cancelled.
+//
+// The handler waits for notes with 'Notify()' rather than polling
+// after each of its own reads, so a stream that only listens to a
+// subscription is written its notes as they're pushed.
+class RouteChatStream {
+ public:
+  explicit RouteChatStream(MemoryBudget* budget) : budget_(budget) {}
+
+  ~RouteChatStream();
+
+  // Handler only. Copies the next queued note into 'note'.
+  bool Pop(RouteNote* note);
+
+  // Handler only. Calls 'wake', here or on the thread that makes it
+  // so, once there's a note to pop, the stream has overflowed or it's
+  // closed. Once stopped, only once it's closed.
+  void Notify(std::function<void()> wake);
+
+  // No more notes will be posted, e.g., the client is done writing and
+  // every note it wrote has been sequenced.
+  void Close();
+
+  // Handler only. Writing has been given up on (the stream overflowed
+  // or the call is ending), the handler only waits for 'Close()'.
+  void Stop() { stopped_ = true; }
+
+  bool overflowed() const {
+    return overflowed_.load(std::memory_order_acquire);
+  }
+
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+  bool stopped() const { return stopped_; }
+
+ private:
+  friend class RouteChatHub;
+
+  // Sequencers only. Queues 'cursor' (or marks the stream overflowed)
+  // without waking the handler, see 'Wake()'.
+  void Push(ChatCursor cursor);
+
+  // Calls the waiting 'Notify()' callback, if any. It runs the handler
+  // (which may write and end the call) so no lock may be held.
+  void Wake();
+
+  // Handler only, with 'mutex_' held.
+  bool Ready();
+
+  MemoryBudget* const budget_;
+  MpscQueue<ChatCursor> outbound_;
+  std::atomic<size_t> queued_bytes_{0};
+  // Handler only, the cursor being written from.
+  ChatCursor current_;
+  std::atomic<bool> overflowed_{false};
+  std::atomic<bool> closed_{false};
+  // Handler only.
+  bool stopped_ = false;
+
+  // Only this stream's pushes and its handler take it.
+  std::mutex mutex_;
+  std::function<void()> waiter_;
+};
+
+// Where a reconnecting 'RouteChat' stream left off at a location: the
+// last sequence number it saw there.
+struct ChatResumePoint {
+  Coordinate location;
+  uint64_t sequence = 0;
+};
+
+// Parses resume points given as '<lat>,<lon>,<sequence>' separated by
+// ';', setting 'error' and returning nothing if 'spec' isn't that.
+std::optional<std::vector<ChatResumePoint>> ParseChatResumePoints(
+    const std::string& spec,
+    std::string* error);
+
+// Parses the notes of a log written by 'RouteChatHub' (each note's
+// serialized size, 4 bytes little endian, followed by the note) into
+// 'notes', oldest first. Returns the size of the whole records, after
+// which there's at most a record torn by a crash.
+size_t ParseChatLog(
+    const std::string& contents,
+    std::vector<RouteNote>* notes);
+
+// Sequences the notes of every 'RouteChat' stream. Locations are split
+// into 'shards', each with a mailbox that any stream posts to without
+// taking a lock and a sequencer thread that owns the shard's history:
+// it takes the posted notes a batch at a time, queues the notes
+// received earlier at each note's location on the posting stream and
+// then appends the note to the history. Posting takes no lock and no
+// lock is shared between shards, so throughput doesn't fall as streams
+// are added.
+//
+// Since a location belongs to a single sequencer its notes are totally
+// ordered: each is numbered with its position in the location's history
+// ('RouteNote::sequence', from 1). A posted note's own sequence number,
+// if any, is the last one its stream has seen there, and only the notes
+// after it are queued, so resuming costs what was missed rather than
+// the whole history. A stream can also resume without posting, see
+// 'Resume()'.
+//
+// The history is capped at 'history_limit' bytes (split evenly between
+// the shards, zero for no cap): past it a shard evicts its oldest
+// segments first, whichever locations they belong to.
+//
+// Streams may also subscribe to an area, in which case every note
+// sequenced within it is queued on them as well. Sequencers find the
+// subscribers through a 'ChatAreaIndex', so a note is only matched
+// against the subscriptions around it. Each shard has its own index,
+// holding every subscription, which only its sequencer and (briefly)
+// subscribing and unsubscribing streams lock.
+//
+// Given a 'log', the sequencers also append every note they sequence
+// to it (see 'ParseChatLog()') and only call a batch's 'Done's once the
+// batch is written (and synced, if the log syncs), so a stream's note
+// is in the log before the stream goes on to its next one while a
+// single write commits the notes of every stream. Appending never
+// blocks a sequencer: a note that doesn't fit the log's buffer is only
+// counted in 'route_chat_log_dropped_total'. The log isn't compacted,
+// 'Restore()' replays all of it and the history cap applies as usual.
+class RouteChatHub {
+ public:
+  // Called, on a sequencer thread, once a posted note's replies have
+  // been queued on its stream.
+  using Done = std::function<void()>;
+
+  // Ends its subscription when destroyed.
+  class Subscription {
+   public:
+    // 'ids' by shard.
+    Subscription(RouteChatHub* hub, std::vector<uint64_t> ids)
+      : hub_(hub), ids_(std::move(ids)) {}
+
+    Subscription(const Subscription&) = delete;
+    Subscription& operator=(const Subscription&) = delete;
+
+    ~Subscription();
+
+   private:
+    RouteChatHub* const hub_;
+    const std::vector<uint64_t> ids_;
+  };
+
+  RouteChatHub(size_t shards, size_t history_limit, AppendLog* log = nullptr);
+
+  // Sequences the notes already posted, stops the sequencers and waits
+  // for their last batches to be written to the log.
+  ~RouteChatHub();
+
+  // Appends 'notes' (read back from a log, oldest first) to the history
+  // without queueing them on any stream or logging them again. Ordered
+  // before the notes posted after it.
+  void Restore(std::vector<RouteNote>&& notes);
+
+  void Post(
+      std::shared_ptr<RouteChatStream> stream,
+      RouteNote&& note,
+      Done done);
+
+  // Queues the notes after 'point.sequence' at 'point.location' on
+  // 'stream', as a note posted there with that sequence number would,
+  // but without posting one. Ordered with the notes 'stream' posts.
+  void Resume(
+      std::shared_ptr<RouteChatStream> stream,
+      const ChatResumePoint& point);
+
+  // Queues every note sequenced within 'area' from now on, except those
+  // 'stream' posts itself, on 'stream' for as long as the returned
+  // subscription lives.
+  std::unique_ptr<Subscription> Subscribe(
+      std::shared_ptr<RouteChatStream> stream,
+      const ChatArea& area);
+
+  size_t shards() const { return shards_.size(); }
+
+ private:
+  struct Message {
+    std::shared_ptr<RouteChatStream> stream;
+    RouteNote note;
+    Done done;
+    // Only queue the notes after 'note.sequence()', see 'Resume()'.
+    bool resume = false;
+    // Has no stream, see 'Restore()'.
+    bool restored = false;
+  };
+
+  struct Shard {
+    MpscQueue<Message> mailbox;
+
+    // Only taken to sleep and to wake the sequencer.
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<bool> sleeping{false};
+    bool stopping = false;
+
+    // Owned by the sequencer. The note at index i of a location's log
+    // has sequence number i + 1.
+    std::unordered_map<uint64_t, ChatLog> history;
+    // The location of every segment in 'history', oldest first.
+    std::deque<uint64_t> segments;
+    size_t history_bytes = 0;
+
+    // Held by the sequencer for a batch.
+    std::mutex subscriptions_mutex;
+    ChatAreaIndex<std::shared_ptr<RouteChatStream>> subscriptions;
+
+    std::thread sequencer;
+  };
+
+  // Hands 'message' to the shard of its note's location.
+  void Send(Message&& message);
+
+  void Sequence(Shard* shard);
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  // Per shard.
+  size_t history_limit_ = 0;
+
+  AppendLog* const log_;
+  // Batches waiting for the log to write them before their 'Done's.
+  std::mutex flushes_mutex_;
+  std::condition_variable flushed_;
+  size_t pending_flushes_ = 0;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_CHAT_H_
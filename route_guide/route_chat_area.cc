@@ -0,0 +1,147 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "route_chat_area.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "geo.h"
+
+namespace routeguide {
+
+namespace {
+
+constexpr double kPi = 3.1415926;
+
+constexpr int32_t kMaxLatitude = 90 * int32_t(kCoordFactor);
+constexpr int32_t kMaxLongitude = 180 * int32_t(kCoordFactor);
+
+// Splits 'values' on commas and parses each as a number.
+bool ParseNumbers(const std::string& values, std::vector<double>* numbers) {
+  size_t start = 0;
+  while (true) {
+    size_t end = values.find(',', start);
+    std::string value = values.substr(
+        start,
+        end == std::string::npos ? std::string::npos : end - start);
+    char* parsed = nullptr;
+    double number = std::strtod(value.c_str(), &parsed);
+    if (value.empty() || *parsed != '\0' || !std::isfinite(number)) {
+      return false;
+    }
+    numbers->push_back(number);
+    if (end == std::string::npos) {
+      return true;
+    }
+    start = end + 1;
+  }
+}
+
+bool IsValid(double latitude, double longitude) {
+  return std::abs(latitude) <= kMaxLatitude
+      && std::abs(longitude) <= kMaxLongitude;
+}
+
+}  // namespace
+
+std::optional<ChatArea> ChatArea::Parse(
+    const std::string& spec,
+    std::string* error) {
+  const std::string kCircle = "circle:";
+  const std::string kRectangle = "rectangle:";
+  std::vector<double> numbers;
+  if (spec.compare(0, kCircle.size(), kCircle) == 0) {
+    if (ParseNumbers(spec.substr(kCircle.size()), &numbers)
+        && numbers.size() == 3
+        && IsValid(numbers[0], numbers[1])
+        && numbers[2] >= 0) {
+      return Circle(
+          Coordinate{int32_t(numbers[0]), int32_t(numbers[1])},
+          numbers[2]);
+    }
+  } else if (spec.compare(0, kRectangle.size(), kRectangle) == 0) {
+    if (ParseNumbers(spec.substr(kRectangle.size()), &numbers)
+        && numbers.size() == 4
+        && IsValid(numbers[0], numbers[1])
+        && IsValid(numbers[2], numbers[3])
+        && numbers[0] <= numbers[2]
+        && numbers[1] <= numbers[3]) {
+      return Rectangle(
+          Coordinate{int32_t(numbers[0]), int32_t(numbers[1])},
+          Coordinate{int32_t(numbers[2]), int32_t(numbers[3])});
+    }
+  }
+  *error = "invalid area '" + spec
+      + "', expected 'circle:<lat>,<lon>,<radius>' or "
+        "'rectangle:<lat_lo>,<lon_lo>,<lat_hi>,<lon_hi>'";
+  return std::nullopt;
+}
+
+ChatArea ChatArea::Circle(const Coordinate& center, double radius) {
+  ChatArea area;
+  area.circle_ = true;
+  area.center_ = center;
+  area.radius_ = radius;
+
+  // The box spans the circle's latitudes and, at the latitude furthest
+  // from the equator, its longitudes (or every longitude if the circle
+  // reaches a pole or the antimeridian).
+  double delta = radius / kEarthRadius * 180 / kPi * kCoordFactor;
+  double lat_lo = center.latitude - delta;
+  double lat_hi = center.latitude + delta;
+  double lon_lo = -kMaxLongitude;
+  double lon_hi = kMaxLongitude;
+  if (lat_lo > -kMaxLatitude && lat_hi < kMaxLatitude) {
+    double widest = std::max(std::abs(lat_lo), std::abs(lat_hi))
+        / kCoordFactor * kPi / 180;
+    double lon_delta = delta / std::cos(widest);
+    if (center.longitude - lon_delta > -kMaxLongitude
+        && center.longitude + lon_delta < kMaxLongitude) {
+      lon_lo = center.longitude - lon_delta;
+      lon_hi = center.longitude + lon_delta;
+    }
+  }
+  area.lo_ = Coordinate{
+      int32_t(std::floor(std::max<double>(lat_lo, -kMaxLatitude))),
+      int32_t(std::floor(lon_lo))};
+  area.hi_ = Coordinate{
+      int32_t(std::ceil(std::min<double>(lat_hi, kMaxLatitude))),
+      int32_t(std::ceil(lon_hi))};
+  return area;
+}
+
+ChatArea ChatArea::Rectangle(const Coordinate& lo, const Coordinate& hi) {
+  ChatArea area;
+  area.lo_ = lo;
+  area.hi_ = hi;
+  return area;
+}
+
+bool ChatArea::Contains(const Coordinate& coordinate) const {
+  if (coordinate.latitude < lo_.latitude
+      || coordinate.latitude > hi_.latitude
+      || coordinate.longitude < lo_.longitude
+      || coordinate.longitude > hi_.longitude) {
+    return false;
+  }
+  return !circle_ || GreatCircleDistance(center_, coordinate) <= radius_;
+}
+
+}  // namespace routeguide
@@ -0,0 +1,181 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_CHAT_AREA_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_CHAT_AREA_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "coordinate.h"
+
+namespace routeguide {
+
+// Area a 'RouteChat' stream subscribes to, either a circle (a radius in
+// metres around a centre) or a rectangle (its lowest and highest
+// corners, both included). Coordinates are those of 'Point'. Areas
+// don't wrap around the antimeridian.
+class ChatArea {
+ public:
+  // Parses 'circle:<lat>,<lon>,<radius>' or
+  // 'rectangle:<lat_lo>,<lon_lo>,<lat_hi>,<lon_hi>', setting 'error'
+  // and returning nothing if 'spec' is neither.
+  static std::optional<ChatArea> Parse(
+      const std::string& spec,
+      std::string* error);
+
+  static ChatArea Circle(const Coordinate& center, double radius);
+
+  static ChatArea Rectangle(const Coordinate& lo, const Coordinate& hi);
+
+  bool Contains(const Coordinate& coordinate) const;
+
+  // Bounding box.
+  const Coordinate& lo() const { return lo_; }
+  const Coordinate& hi() const { return hi_; }
+
+ private:
+  ChatArea() = default;
+
+  Coordinate lo_;
+  Coordinate hi_;
+  bool circle_ = false;
+  Coordinate center_;
+  double radius_ = 0;
+};
+
+// Grid of 'kCellSize' square cells over the areas of the active
+// subscriptions, each listing the areas that overlap it, so finding the
+// areas that contain a coordinate only looks at those nearby. Areas
+// spanning more than 'kMaxCells' cells are kept in a list that's
+// checked for every coordinate instead. Not thread safe.
+template <typename T>
+class ChatAreaIndex {
+ public:
+  // A tenth of a degree, about 11km of latitude.
+  static constexpr int64_t kCellSize = 1000000;
+
+  static constexpr int64_t kMaxCells = 1024;
+
+  // Returns an id to 'Erase()' the area with.
+  uint64_t Insert(const ChatArea& area, T value) {
+    uint64_t id = next_id_++;
+    Entry* entry =
+        &entries_.emplace(id, Entry{area, std::move(value)}).first->second;
+    ForEachCell(area, [&](uint64_t cell) {
+      cells_[cell].push_back(entry);
+    });
+    return id;
+  }
+
+  void Erase(uint64_t id) {
+    auto entry = entries_.find(id);
+    if (entry == entries_.end()) {
+      return;
+    }
+    ForEachCell(entry->second.area, [&](uint64_t cell) {
+      auto areas = cells_.find(cell);
+      if (areas == cells_.end()) {
+        return;
+      }
+      std::vector<Entry*>& list = areas->second;
+      list.erase(std::find(list.begin(), list.end(), &entry->second));
+      if (list.empty()) {
+        cells_.erase(areas);
+      }
+    });
+    entries_.erase(entry);
+  }
+
+  // Calls 'f' with the value of every area containing 'coordinate'.
+  template <typename F>
+  void ForEachContaining(const Coordinate& coordinate, F&& f) const {
+    if (entries_.empty()) {
+      return;
+    }
+    auto visit = [&](const std::vector<Entry*>& list) {
+      for (const Entry* entry : list) {
+        if (entry->area.Contains(coordinate)) {
+          f(entry->value);
+        }
+      }
+    };
+    auto areas = cells_.find(CellKey(
+        Cell(coordinate.latitude),
+        Cell(coordinate.longitude)));
+    if (areas != cells_.end()) {
+      visit(areas->second);
+    }
+    auto wide = cells_.find(kWide);
+    if (wide != cells_.end()) {
+      visit(wide->second);
+    }
+  }
+
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    ChatArea area;
+    T value;
+  };
+
+  // Key of the list of wide areas, not a valid cell.
+  static constexpr uint64_t kWide = ~uint64_t(0);
+
+  static int64_t Cell(int32_t value) {
+    // Shifted so the division rounds down for negative coordinates too.
+    return (int64_t(value) + (int64_t(1) << 31)) / kCellSize;
+  }
+
+  static uint64_t CellKey(int64_t latitude, int64_t longitude) {
+    return (uint64_t(latitude) << 32) | uint64_t(longitude);
+  }
+
+  template <typename F>
+  static void ForEachCell(const ChatArea& area, F&& f) {
+    int64_t lat_lo = Cell(area.lo().latitude);
+    int64_t lat_hi = Cell(area.hi().latitude);
+    int64_t lon_lo = Cell(area.lo().longitude);
+    int64_t lon_hi = Cell(area.hi().longitude);
+    if ((lat_hi - lat_lo + 1) * (lon_hi - lon_lo + 1) > kMaxCells) {
+      f(kWide);
+      return;
+    }
+    for (int64_t latitude = lat_lo; latitude <= lat_hi; latitude++) {
+      for (int64_t longitude = lon_lo; longitude <= lon_hi; longitude++) {
+        f(CellKey(latitude, longitude));
+      }
+    }
+  }
+
+  // Nodes (and so the entries the cells point to) are stable.
+  std::unordered_map<uint64_t, Entry> entries_;
+  std::unordered_map<uint64_t, std::vector<Entry*>> cells_;
+  uint64_t next_id_ = 0;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_CHAT_AREA_H_
@@ -0,0 +1,86 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "route_chat_log.h"
+
+#include <algorithm>
+
+namespace routeguide {
+
+ChatCursor ChatLog::Append(RouteNote&& note, size_t bytes) {
+  if (tail_ == nullptr || tail_->size == tail_->capacity) {
+    auto segment = std::make_shared<ChatSegment>(
+        tail_ == nullptr
+            ? kMinSegmentSize
+            : std::min(tail_->capacity * 2, kMaxSegmentSize));
+    segment->bytes =
+        sizeof(ChatSegment) + segment->capacity * sizeof(RouteNote);
+    bytes_ += segment->bytes;
+    if (tail_ == nullptr) {
+      head_ = segment;
+    } else {
+      tail_->next = segment;
+    }
+    tail_ = std::move(segment);
+    segments_++;
+  }
+  size_t index = tail_->size++;
+  tail_->notes[index] = std::move(note);
+  tail_->bytes += bytes;
+  bytes_ += bytes;
+  size_++;
+  return ChatCursor(tail_, index, 1);
+}
+
+size_t ChatLog::EvictOldest() {
+  if (head_ == nullptr) {
+    return 0;
+  }
+  size_t bytes = head_->bytes;
+  bytes_ -= bytes;
+  evicted_ += head_->size;
+  if (head_ == tail_) {
+    head_.reset();
+    tail_.reset();
+  } else {
+    head_ = head_->next;
+  }
+  segments_--;
+  return bytes;
+}
+
+ChatCursor ChatLog::After(uint64_t skip) const {
+  if (skip > size_) {
+    skip = 0;
+  }
+  skip = std::max(skip, evicted_);
+  if (skip >= size_) {
+    return ChatCursor();
+  }
+  // Only the segments are walked, of which there are few since they
+  // double in size.
+  std::shared_ptr<const ChatSegment> segment = head_;
+  uint64_t index = skip - evicted_;
+  while (index >= segment->capacity) {
+    index -= segment->capacity;
+    segment = segment->next;
+  }
+  return ChatCursor(std::move(segment), index, size_ - skip);
+}
+
+}  // namespace routeguide
@@ -0,0 +1,131 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_CHAT_LOG_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_CHAT_LOG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "protos/route_guide.grpc.pb.h"
+
+namespace routeguide {
+
+// A block of consecutive notes of a 'ChatLog'. Slots are written once,
+// by the sequencer, before any cursor covering them is published, and
+// never move, so cursors read them without a lock.
+struct ChatSegment {
+  explicit ChatSegment(size_t capacity)
+    : notes(new RouteNote[capacity]),
+      capacity(capacity) {}
+
+  const std::unique_ptr<RouteNote[]> notes;
+  const size_t capacity;
+  // Sequencer only.
+  size_t size = 0;
+  // Sequencer only, the memory used by the segment: every slot, used or
+  // not, plus what the notes in use allocate.
+  size_t bytes = 0;
+  // Set once, when the segment is full and the next note is appended.
+  std::shared_ptr<ChatSegment> next;
+};
+
+// A snapshot of a range of a 'ChatLog', read a note at a time. Holds on
+// to the segments it has left to read, not to copies of the notes, so
+// it's the same size however many notes it covers.
+class ChatCursor {
+ public:
+  ChatCursor() = default;
+
+  ChatCursor(
+      std::shared_ptr<const ChatSegment> segment,
+      size_t index,
+      uint64_t count)
+    : segment_(std::move(segment)),
+      index_(index),
+      remaining_(count) {}
+
+  // Copies the next note into 'note', or returns false if there are no
+  // more.
+  bool Next(RouteNote* note) {
+    if (remaining_ == 0) {
+      return false;
+    }
+    if (index_ == segment_->capacity) {
+      segment_ = segment_->next;
+      index_ = 0;
+    }
+    *note = segment_->notes[index_++];
+    if (--remaining_ == 0) {
+      segment_.reset();
+    }
+    return true;
+  }
+
+  uint64_t remaining() const { return remaining_; }
+
+ private:
+  std::shared_ptr<const ChatSegment> segment_;
+  size_t index_ = 0;
+  uint64_t remaining_ = 0;
+};
+
+// Log of the notes received at one location, owned by the location's
+// sequencer. Notes are appended at the end and evicted from the start a
+// segment at a time. Segments start small (most locations only ever see
+// a few notes) and double up to 'kMaxSegmentSize'.
+class ChatLog {
+ public:
+  static constexpr size_t kMinSegmentSize = 8;
+  static constexpr size_t kMaxSegmentSize = 1024;
+
+  // Appends 'note', which allocates 'bytes' of memory beyond its slot,
+  // and returns a cursor over just it.
+  ChatCursor Append(RouteNote&& note, size_t bytes);
+
+  // Evicts the oldest segment, if any, and returns the memory it used.
+  // Cursors reading it keep it alive until they're done.
+  size_t EvictOldest();
+
+  // Returns a cursor over the notes after the first 'skip', or from the
+  // oldest note still kept if some of those were evicted or if 'skip' is
+  // past the last note (the log was dropped once all of its notes were
+  // evicted and started over).
+  ChatCursor After(uint64_t skip) const;
+
+  // Notes ever appended, evicted ones included.
+  uint64_t size() const { return size_; }
+
+  size_t segments() const { return segments_; }
+
+  // Memory used by the segments kept, see 'ChatSegment::bytes'.
+  size_t bytes() const { return bytes_; }
+
+ private:
+  std::shared_ptr<ChatSegment> head_;
+  std::shared_ptr<ChatSegment> tail_;
+  uint64_t size_ = 0;
+  uint64_t evicted_ = 0;
+  size_t segments_ = 0;
+  size_t bytes_ = 0;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_CHAT_LOG_H_
@@ -0,0 +1,307 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Checks that a 'RouteChat' client that stops reading doesn't stall the
+// other chats of 'route_guide_server' (the sync server): one client
+// floods a location with notes without ever reading its replies while
+// '--clients' clients each run '--chats' short chats at locations of
+// their own, every chat with a '--deadline_ms' deadline. Every chat has
+// to complete with its one reply.
+//
+// The server listens on a port it picks (so that runs in parallel don't
+// collide) and reports it on its stdout, which the test reads.
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/channel.h>
+#include <grpcpp/client_context.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+#include "helper.h"
+#include "protos/route_guide.grpc.pb.h"
+
+using grpc::ChannelArguments;
+using grpc::ClientContext;
+using grpc::ClientReaderWriter;
+using routeguide::RouteGuide;
+using routeguide::RouteNote;
+
+namespace {
+
+// Returns a stub on a channel of its own (so that each client gets its
+// own connection, as separate hosts would) to 'address'.
+std::unique_ptr<RouteGuide::Stub> NewStub(
+    const std::string& address,
+    int channel) {
+  ChannelArguments arguments;
+  arguments.SetInt("route_chat_stall_test.channel", channel);
+  return RouteGuide::NewStub(grpc::CreateCustomChannel(
+      address,
+      grpc::InsecureChannelCredentials(),
+      arguments));
+}
+
+RouteNote Note(int latitude, size_t size) {
+  RouteNote note;
+  note.mutable_location()->set_latitude(latitude);
+  note.mutable_location()->set_longitude(0);
+  note.set_message(std::string(size, 'x'));
+  return note;
+}
+
+// Starts 'server' with 'args' in a child process, returning its pid or
+// -1 if it couldn't be started. Sets 'output' to the read end of a pipe
+// from its stdout.
+pid_t StartServer(
+    const std::string& server,
+    std::vector<std::string> args,
+    int* output) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return -1;
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(server.c_str()));
+    for (std::string& arg : args) {
+      argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+    execv(server.c_str(), argv.data());
+    _exit(127);
+  }
+  close(fds[1]);
+  if (pid < 0) {
+    close(fds[0]);
+    return -1;
+  }
+  *output = fds[0];
+  return pid;
+}
+
+// Reads 'output' (echoing it) until the server reports the address it
+// listens on, returning it or "" if it exits or doesn't report one
+// within 'timeout'.
+std::string ReadListeningAddress(
+    int output,
+    std::chrono::milliseconds timeout) {
+  const std::string prefix = "Server listening on ";
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::string line;
+  while (true) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    pollfd readable = {output, POLLIN, 0};
+    char c;
+    if (left.count() <= 0
+        || poll(&readable, 1, left.count()) <= 0
+        || read(output, &c, 1) != 1) {
+      return "";
+    }
+    std::cout << c;
+    if (c != '\n') {
+      line += c;
+      continue;
+    }
+    if (line.compare(0, prefix.size(), prefix) == 0) {
+      return line.substr(prefix.size());
+    }
+    line.clear();
+  }
+}
+
+// Echoes the rest of 'output' until the server exits, so it never blocks
+// on a full pipe.
+void EchoOutput(int output) {
+  char buffer[4096];
+  ssize_t size;
+  while ((size = read(output, buffer, sizeof(buffer))) > 0) {
+    std::cout.write(buffer, size);
+  }
+  close(output);
+}
+
+// Stops the server started by 'StartServer()'.
+void StopServer(pid_t pid, std::thread* echo) {
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+  if (echo->joinable()) {
+    echo->join();
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  // Expect args: --server=path/to/route_guide_server,
+  // --db_path=path/to/route_guide_db.json, --address=localhost:0 (port
+  // 0 lets the server pick one), --clients=16, --chats=20 and
+  // --deadline_ms=3000.
+  std::string server = routeguide::GetFlagValue(argc, argv, "server");
+  std::string db_path = routeguide::GetDbPath(argc, argv);
+  std::string address =
+      routeguide::GetFlagValue(argc, argv, "address", "localhost:0");
+  int clients = 0;
+  int chats = 0;
+  int deadline_ms = 0;
+  bool valid_flags =
+      routeguide::GetFlagValue(argc, argv, "clients", 16, &clients);
+  valid_flags &= routeguide::GetFlagValue(argc, argv, "chats", 20, &chats);
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "deadline_ms",
+      3000,
+      &deadline_ms);
+  if (!valid_flags || server.empty()) {
+    std::cerr << "Expected --server=path/to/route_guide_server" << std::endl;
+    return 1;
+  }
+
+  int output = -1;
+  pid_t pid = StartServer(
+      server,
+      {"--db_path=" + db_path, "--address=" + address, "--max_threads=256"},
+      &output);
+  if (pid < 0) {
+    std::cerr << "Failed to start " << server << std::endl;
+    return 1;
+  }
+
+  int failures = 0;
+  std::thread echo;
+  std::string requested = address;
+  address = ReadListeningAddress(output, std::chrono::seconds(30));
+  if (!address.empty()) {
+    echo = std::thread(EchoOutput, output);
+  } else {
+    close(output);
+  }
+  auto started = grpc::CreateChannel(
+      address.empty() ? requested : address,
+      grpc::InsecureChannelCredentials());
+  if (address.empty()
+      || !started->WaitForConnected(
+          std::chrono::system_clock::now() + std::chrono::seconds(10))) {
+    std::cerr << "Server didn't start listening on " << requested
+              << std::endl;
+    StopServer(pid, &echo);
+    return 1;
+  }
+
+  std::unique_ptr<RouteGuide::Stub> flooder = NewStub(address, 0);
+  // No deadline: the flood has to last until the chats are done, however
+  // long that takes, and is cancelled then.
+  ClientContext flood_context;
+  std::unique_ptr<ClientReaderWriter<RouteNote, RouteNote>> flood(
+      flooder->RouteChat(&flood_context));
+  // Every note gets a reply per note before it at the same location, so
+  // the replies soon fill the flow control window nobody reads from and
+  // the server's writes to this stream block.
+  std::atomic<int> flooded{0};
+  std::atomic<bool> flood_done{false};
+  std::thread flood_writer([&]() {
+    for (int i = 0; i < 400 && flood->Write(Note(7, 1024)); i++) {
+      flooded++;
+    }
+    flood_done = true;
+  });
+  // Wait for the flood to stall, i.e., for writes to stop going through
+  // because the server stopped reading them.
+  for (int stalled = 0; stalled < 5 && !flood_done;) {
+    int before = flooded;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    stalled = flooded > 0 && flooded == before ? stalled + 1 : 0;
+  }
+  std::cout << "Flooded " << flooded << " notes without reading"
+            << std::endl;
+
+  std::atomic<int> completed{0};
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (int client = 0; client < clients; client++) {
+    threads.emplace_back([&, client]() {
+      std::unique_ptr<RouteGuide::Stub> stub = NewStub(address, client + 1);
+      for (int chat = 0; chat < chats; chat++) {
+        ClientContext context;
+        context.set_deadline(
+            std::chrono::system_clock::now()
+            + std::chrono::milliseconds(deadline_ms));
+        std::unique_ptr<ClientReaderWriter<RouteNote, RouteNote>> stream(
+            stub->RouteChat(&context));
+        // The second note gets the first as its one reply.
+        int latitude = 1000 + client * chats + chat;
+        stream->Write(Note(latitude, 16));
+        stream->Write(Note(latitude, 16));
+        stream->WritesDone();
+        RouteNote reply;
+        int replies = 0;
+        while (stream->Read(&reply)) {
+          replies++;
+        }
+        grpc::Status status = stream->Finish();
+        if (status.ok() && replies == 1) {
+          completed++;
+        } else if (chat == 0) {
+          std::cerr << "Client " << client << " got " << replies
+                    << " replies and status " << status.error_code()
+                    << " (" << status.error_message() << ")" << std::endl;
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cout << completed << "/" << clients * chats << " chats completed in "
+            << elapsed << " seconds" << std::endl;
+  if (completed != clients * chats) {
+    failures++;
+  }
+
+  flood_context.TryCancel();
+  flood_writer.join();
+  flood->Finish();
+
+  StopServer(pid, &echo);
+
+  if (failures > 0) {
+    std::cerr << "Chats stalled behind a client that doesn't read"
+              << std::endl;
+    return 1;
+  }
+  return 0;
+}
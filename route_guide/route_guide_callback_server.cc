@@ -0,0 +1,306 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <grpc/grpc.h>
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
+#include <grpcpp/server_context.h>
+#include <grpcpp/security/server_credentials.h>
+#include "feature_db.h"
+#include "feature_store.h"
+#include "geo.h"
+#include "helper.h"
+#include "protos/route_guide.grpc.pb.h"
+
+using grpc::CallbackServerContext;
+using grpc::Server;
+using grpc::ServerBidiReactor;
+using grpc::ServerBuilder;
+using grpc::ServerReadReactor;
+using grpc::ServerUnaryReactor;
+using grpc::ServerWriteReactor;
+using grpc::Status;
+using routeguide::Point;
+using routeguide::Feature;
+using routeguide::Rectangle;
+using routeguide::RouteSummary;
+using routeguide::RouteNote;
+using routeguide::RouteGuide;
+using routeguide::Coordinate;
+using routeguide::FeatureDbLoad;
+using routeguide::FeatureStore;
+using routeguide::GetDistance;
+using std::chrono::system_clock;
+
+// 'RouteGuide' on gRPC's callback API: no call holds a thread while it
+// waits for a message, each reactor is resumed by the library when one
+// is read or written. Features are served from the same 'FeatureStore'
+// (and, with '--feature_db_path', the same feature db) as the eventuals
+// server so the two can be compared head to head.
+class RouteGuideImpl final : public RouteGuide::CallbackService {
+ public:
+  explicit RouteGuideImpl(const FeatureStore* store) : store_(store) {}
+
+  ServerUnaryReactor* GetFeature(
+      CallbackServerContext* context,
+      const Point* point,
+      Feature* feature) override {
+    store_->CopyName(
+        store_->Find(Coordinate{point->latitude(), point->longitude()}),
+        feature);
+    feature->mutable_location()->CopyFrom(*point);
+    ServerUnaryReactor* reactor = context->DefaultReactor();
+    reactor->Finish(Status::OK);
+    return reactor;
+  }
+
+  ServerWriteReactor<Feature>* ListFeatures(
+      CallbackServerContext* context,
+      const routeguide::Rectangle* rectangle) override {
+    // Writes the features in the rectangle one at a time, each once the
+    // previous one has been written.
+    class Lister final : public ServerWriteReactor<Feature> {
+     public:
+      Lister(const FeatureStore* store, const routeguide::Rectangle& rectangle)
+        : store_(store) {
+        store_->FindInRectangle(
+            Coordinate{rectangle.lo().latitude(), rectangle.lo().longitude()},
+            Coordinate{rectangle.hi().latitude(), rectangle.hi().longitude()},
+            &ids_);
+        Next();
+      }
+
+      void OnWriteDone(bool ok) override {
+        if (!ok) {
+          Finish(Status(grpc::StatusCode::UNKNOWN, "Write failed"));
+          return;
+        }
+        Next();
+      }
+
+      void OnDone() override { delete this; }
+
+     private:
+      void Next() {
+        if (next_ == ids_.size()) {
+          Finish(Status::OK);
+          return;
+        }
+        feature_ = store_->GetFeature(ids_[next_++]);
+        StartWrite(&feature_);
+      }
+
+      const FeatureStore* const store_;
+      std::vector<uint32_t> ids_;
+      size_t next_ = 0;
+      Feature feature_;
+    };
+    return new Lister(store_, *rectangle);
+  }
+
+  ServerReadReactor<Point>* RecordRoute(
+      CallbackServerContext* context,
+      RouteSummary* summary) override {
+    class Recorder final : public ServerReadReactor<Point> {
+     public:
+      Recorder(const FeatureStore* store, RouteSummary* summary)
+        : store_(store),
+          summary_(summary),
+          start_time_(system_clock::now()) {
+        StartRead(&point_);
+      }
+
+      void OnReadDone(bool ok) override {
+        if (!ok) {
+          // The client is done writing.
+          system_clock::time_point end_time = system_clock::now();
+          summary_->set_point_count(point_count_);
+          summary_->set_feature_count(feature_count_);
+          summary_->set_distance(static_cast<long>(distance_));
+          auto secs = std::chrono::duration_cast<std::chrono::seconds>(
+              end_time - start_time_);
+          summary_->set_elapsed_time(secs.count());
+          Finish(Status::OK);
+          return;
+        }
+        point_count_++;
+        if (store_->IsNamed(store_->Find(
+                Coordinate{point_.latitude(), point_.longitude()}))) {
+          feature_count_++;
+        }
+        if (point_count_ != 1) {
+          distance_ += GetDistance(previous_, point_);
+        }
+        previous_ = point_;
+        StartRead(&point_);
+      }
+
+      void OnDone() override { delete this; }
+
+     private:
+      const FeatureStore* const store_;
+      RouteSummary* const summary_;
+      const system_clock::time_point start_time_;
+      Point point_;
+      Point previous_;
+      int point_count_ = 0;
+      int feature_count_ = 0;
+      float distance_ = 0.0;
+    };
+    return new Recorder(store_, summary);
+  }
+
+  ServerBidiReactor<RouteNote, RouteNote>* RouteChat(
+      CallbackServerContext* context) override {
+    // Reads a note, writes the notes received earlier at its location
+    // one at a time and only then reads the next note, so at most one
+    // read or write is outstanding.
+    class Chatter final : public ServerBidiReactor<RouteNote, RouteNote> {
+     public:
+      explicit Chatter(RouteGuideImpl* service) : service_(service) {
+        StartRead(&note_);
+      }
+
+      void OnReadDone(bool ok) override {
+        if (!ok) {
+          Finish(Status::OK);
+          return;
+        }
+        notes_.clear();
+        next_ = 0;
+        {
+          std::unique_lock<std::mutex> lock(service_->mu_);
+          for (const RouteNote& n : service_->received_notes_) {
+            if (n.location().latitude() == note_.location().latitude() &&
+                n.location().longitude() == note_.location().longitude()) {
+              notes_.push_back(n);
+            }
+          }
+          service_->received_notes_.push_back(note_);
+        }
+        Next();
+      }
+
+      void OnWriteDone(bool ok) override {
+        if (!ok) {
+          Finish(Status(grpc::StatusCode::UNKNOWN, "Write failed"));
+          return;
+        }
+        Next();
+      }
+
+      void OnDone() override { delete this; }
+
+     private:
+      void Next() {
+        if (next_ == notes_.size()) {
+          StartRead(&note_);
+        } else {
+          StartWrite(&notes_[next_++]);
+        }
+      }
+
+      RouteGuideImpl* const service_;
+      RouteNote note_;
+      std::vector<RouteNote> notes_;
+      size_t next_ = 0;
+    };
+    return new Chatter(this);
+  }
+
+ private:
+  const FeatureStore* const store_;
+  std::mutex mu_;
+  std::vector<RouteNote> received_notes_;
+};
+
+// Returns false if the server can't be started, e.g., because its port
+// is taken.
+bool RunServer(const FeatureStore* store) {
+  std::string server_address("0.0.0.0:50051");
+  RouteGuideImpl service(store);
+
+  ServerBuilder builder;
+  builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  builder.RegisterService(&service);
+  std::unique_ptr<Server> server(builder.BuildAndStart());
+  if (!server) {
+    std::cerr << "Failed to build and start server on " << server_address
+              << std::endl;
+    return false;
+  }
+  std::cout << "Server listening on " << server_address << std::endl;
+  server->Wait();
+  return true;
+}
+
+int main(int argc, char** argv) {
+  // Expect args: --db_path=path/to/route_guide_db.json,
+  // --feature_db_path=path/to/route_guide_db.rgdb (instead of --db_path),
+  // --attach_feature_db=false and --name_cache_blocks=64, like the
+  // eventuals server.
+  std::unique_ptr<FeatureStore> store;
+  std::string feature_db_path =
+      routeguide::GetFlagValue(argc, argv, "feature_db_path");
+  if (!feature_db_path.empty()) {
+    FeatureDbLoad load = FeatureDbLoad::kCopy;
+    if (routeguide::GetFlagValue(argc, argv, "attach_feature_db", "false")
+        == "true") {
+      load = FeatureDbLoad::kAttach;
+    }
+    size_t name_cache_blocks = 0;
+    if (!routeguide::GetFlagValue(
+            argc,
+            argv,
+            "name_cache_blocks",
+            size_t(64),
+            &name_cache_blocks)) {
+      return -1;
+    }
+    std::string error;
+    store = routeguide::LoadFeatureDb(
+        feature_db_path,
+        name_cache_blocks,
+        load,
+        &error);
+    if (!store) {
+      std::cerr << "Error loading the feature db: " << error << std::endl;
+      return -1;
+    }
+  } else {
+    std::vector<Feature> features;
+    routeguide::ParseDb(
+        routeguide::GetDbFileContent(argc, argv),
+        &features);
+    store = std::make_unique<FeatureStore>(std::move(features));
+  }
+  std::cout << "Serving " << store->size() << " features." << std::endl;
+
+  if (!RunServer(store.get())) {
+    return -1;
+  }
+
+  return 0;
+}
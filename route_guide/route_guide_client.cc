@@ -152,8 +152,17 @@ class RouteGuideClient {
     }
   }
 
-  void RouteChat() {
+  // Subscribes to the notes within 'area' (see 'ChatArea::Parse()'),
+  // if it's not empty, and first asks for the notes missed since
+  // 'resume' (see 'ParseChatResumePoints()'), if it's not empty.
+  void RouteChat(const std::string& area, const std::string& resume) {
     ClientContext context;
+    if (!area.empty()) {
+      context.AddMetadata("route-chat-area", area);
+    }
+    if (!resume.empty()) {
+      context.AddMetadata("route-chat-resume", resume);
+    }
 
     std::shared_ptr<ClientReaderWriter<RouteNote, RouteNote> > stream(
         stub_->RouteChat(&context));
@@ -177,7 +186,8 @@ class RouteGuideClient {
     while (stream->Read(&server_note)) {
       std::cout << "Got message " << server_note.message()
                 << " at " << server_note.location().latitude() << ", "
-                << server_note.location().longitude() << std::endl;
+                << server_note.location().longitude()
+                << " (#" << server_note.sequence() << ")" << std::endl;
     }
     writer.join();
     Status status = stream->Finish();
@@ -217,7 +227,10 @@ class RouteGuideClient {
 };
 
 int main(int argc, char** argv) {
-  // Expect only arg: --db_path=path/to/route_guide_db.json.
+  // Expect args: --db_path=path/to/route_guide_db.json and optionally
+  // --chat_area=circle:<lat>,<lon>,<radius> (or
+  // rectangle:<lat_lo>,<lon_lo>,<lat_hi>,<lon_hi>) and
+  // --chat_resume=<lat>,<lon>,<sequence>;... for RouteChat.
   std::string db = routeguide::GetDbFileContent(argc, argv);
   RouteGuideClient guide(
       grpc::CreateChannel("localhost:50051",
@@ -231,7 +244,9 @@ int main(int argc, char** argv) {
   std::cout << "-------------- RecordRoute --------------" << std::endl;
   guide.RecordRoute();
   std::cout << "-------------- RouteChat --------------" << std::endl;
-  guide.RouteChat();
+  guide.RouteChat(
+      routeguide::GetFlagValue(argc, argv, "chat_area"),
+      routeguide::GetFlagValue(argc, argv, "chat_resume"));
 
   return 0;
 }
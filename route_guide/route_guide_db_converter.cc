@@ -0,0 +1,76 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Converts the json db into the binary feature db (see 'feature_db.h')
+// that the eventuals server maps with '--feature_db_path'. The json db
+// is parsed strictly so a malformed record fails the conversion rather
+// than silently dropping a feature.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "feature_db.h"
+#include "helper.h"
+#include "protos/route_guide.grpc.pb.h"
+
+using routeguide::DbParseMode;
+using routeguide::Feature;
+
+int main(int argc, char** argv) {
+  // Expect args: --db_path=path/to/route_guide_db.json and
+  // --output_path=path/to/route_guide_db.rgdb.
+  std::string output_path =
+      routeguide::GetFlagValue(argc, argv, "output_path");
+  if (output_path.empty()) {
+    std::cerr << "Missing --output_path" << std::endl;
+    return -1;
+  }
+
+  std::string db = routeguide::GetDbFileContent(argc, argv);
+
+  std::vector<Feature> feature_list;
+  std::string error;
+  if (!routeguide::ParseDb(db, &feature_list, DbParseMode::kStrict, &error)) {
+    std::cerr << "Error parsing the db file: " << error << std::endl;
+    return -1;
+  }
+
+  // Report what interning saves when this db is served from json.
+  std::vector<std::string> names;
+  names.reserve(feature_list.size());
+  for (const Feature& feature : feature_list) {
+    names.push_back(feature.name());
+  }
+  size_t strings_usage = routeguide::StringsMemoryUsage(names);
+  routeguide::InternedFeatureNames interned(std::move(names));
+  std::cout << "Names use " << strings_usage << " bytes as strings, "
+            << interned.MemoryUsage() << " bytes interned ("
+            << interned.stored() << " of " << feature_list.size()
+            << " stored)." << std::endl;
+
+  if (!routeguide::WriteFeatureDb(output_path, feature_list, &error)) {
+    std::cerr << "Error writing the feature db: " << error << std::endl;
+    return -1;
+  }
+
+  std::cout << "Wrote " << feature_list.size() << " features to "
+            << output_path << std::endl;
+
+  return 0;
+}
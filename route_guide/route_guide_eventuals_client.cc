@@ -42,6 +42,7 @@
 #include "eventuals/timer.h"
 #include "helper.h"
 #include "protos/route_guide.grpc.pb.h"
+#include "route_guide_eventuals_stub.h"
 
 using grpc::ClientContext;
 using grpc::Status;
@@ -51,7 +52,7 @@ using routeguide::Feature;
 using routeguide::Rectangle;
 using routeguide::RouteSummary;
 using routeguide::RouteNote;
-using routeguide::RouteGuide;
+using routeguide::RouteGuideEventualsStub;
 
 using stout::Borrowable;
 
@@ -66,9 +67,7 @@ using eventuals::Range;
 using eventuals::Then;
 using eventuals::Timer;
 
-using eventuals::grpc::Client;
 using eventuals::grpc::CompletionPool;
-using eventuals::grpc::Stream;
 
 Point MakePoint(long latitude, long longitude) {
   Point p;
@@ -100,14 +99,14 @@ class RouteGuideClient {
       const std::shared_ptr<::grpc::ChannelCredentials>& credentials,
       stout::borrowed_ptr<CompletionPool> pool,
       const std::string& db)
-    : client_(target, credentials, std::move(pool)) {
+    : stub_(target, credentials, std::move(pool)) {
     routeguide::ParseDb(db, &feature_list_);
   }
 
   auto GetFeature();
 
   auto ListFeatures() {
-    return client_.Call<RouteGuide, Rectangle, Stream<Feature>>("ListFeatures")
+    return stub_.ListFeatures()
         | Then(Let([this](auto& call) {
              routeguide::Rectangle rect;
 
@@ -145,7 +144,7 @@ class RouteGuideClient {
 
   auto RecordRoute() {
     unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-    return client_.Call<RouteGuide, Stream<Point>, RouteSummary>("RecordRoute")
+    return stub_.RecordRoute()
         | Then(Let(
             [this,
              generator = std::default_random_engine(seed),
@@ -200,10 +199,7 @@ class RouteGuideClient {
   }
 
   auto RouteChat() {
-    return client_.Call<
-               RouteGuide,
-               Stream<RouteNote>,
-               Stream<RouteNote>>("RouteChat")
+    return stub_.RouteChat()
         | Then(Let([](auto& call) {
              return DoAll(
                         Foreach(
@@ -243,7 +239,7 @@ class RouteGuideClient {
 
  private:
   auto GetOneFeature(Point&& point) {
-    return client_.Call<RouteGuide, Point, Feature>("GetFeature")
+    return stub_.GetFeature()
         | Then(Let([this, point = std::move(point)](auto& call) {
              return call.Writer().WriteLast(point)
                  | call.Reader().Read()
@@ -286,7 +282,7 @@ class RouteGuideClient {
   }
 
   const float kCoordFactor_ = 10000000.0;
-  Client client_;
+  RouteGuideEventualsStub stub_;
   std::vector<Feature> feature_list_;
 };
 
@@ -16,26 +16,49 @@
  *
  */
 
+#include <unistd.h>
+
 #include <algorithm>
 #include <chrono>
-#include <cmath>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "eventuals/closure.h"
-#include "eventuals/filter.h"
+#include "eventuals/event-loop.h"
+#include "eventuals/finally.h"
 #include "eventuals/flat-map.h"
 #include "eventuals/grpc/server.h"
 #include "eventuals/iterate.h"
-#include "eventuals/let.h"
-#include "eventuals/lock.h"
 #include "eventuals/loop.h"
 #include "eventuals/map.h"
+#include "eventuals/stream.h"
+#include "eventuals/terminal.h"
 #include "eventuals/then.h"
+#include "feature_db.h"
+#include "feature_delta.h"
+#include "feature_pipeline.h"
+#include "feature_store.h"
+#include "file_io.h"
+#include "file_io_event_loop.h"
+#include "geo.h"
+#include "health_service.h"
 #include "helper.h"
+#include "huge_pages.h"
+#include "interceptors.h"
+#include "memory_accounting.h"
+#include "metrics.h"
 #include "protos/route_guide.eventuals.h"
 #include "protos/route_guide.grpc.pb.h"
+#include "replicated_feature_store.h"
+#include "route_chat.h"
+#include "route_simplifier.h"
+#include "traffic_capture.h"
+#include "unary_call_pool.h"
 
 using routeguide::Point;
 using routeguide::Feature;
@@ -45,112 +68,287 @@ using routeguide::RouteNote;
 
 using routeguide::eventuals::RouteGuide;
 
+using routeguide::AdmissionInterceptor;
+using routeguide::AppendLog;
+using routeguide::CapturedMethod;
+using routeguide::Coordinate;
+using routeguide::Counter;
+using routeguide::DbChunkParser;
+using routeguide::DbParseMode;
+using routeguide::FeatureChange;
+using routeguide::FeatureDbLoad;
+using routeguide::FeatureStore;
+using routeguide::FileIo;
+using routeguide::FileIoWatcher;
+using routeguide::GetFeatureCallPool;
+using routeguide::Gauge;
+using routeguide::GetDistance;
+using routeguide::HealthImpl;
+using routeguide::HugePages;
+using routeguide::InterceptorChain;
+using routeguide::MemoryBudget;
+using routeguide::Metrics;
+using routeguide::MetricsInterceptor;
+using routeguide::NumaTopology;
+using routeguide::ParseAndIndex;
+using routeguide::PhaseTimer;
+using routeguide::RateLimitInterceptor;
+using routeguide::ReadFile;
+using routeguide::ChatArea;
+using routeguide::ChatResumePoint;
+using routeguide::ParseChatResumePoints;
+using routeguide::ReplicatedFeatureStore;
+using routeguide::RouteChatHub;
+using routeguide::RouteChatStream;
+using routeguide::RouteSimplifier;
+using routeguide::StreamMemory;
+using routeguide::TracingInterceptor;
+using routeguide::TrafficCapture;
+
 using std::chrono::system_clock;
 
 using eventuals::Closure;
-using eventuals::Filter;
+using eventuals::EventLoop;
+using eventuals::Finally;
 using eventuals::FlatMap;
 using eventuals::Iterate;
-using eventuals::Let;
 using eventuals::Loop;
 using eventuals::Map;
-using eventuals::Synchronizable;
+using eventuals::Terminate;
 using eventuals::Then;
 
 using eventuals::grpc::Server;
 using eventuals::grpc::ServerBuilder;
 using eventuals::grpc::ServerReader;
 
-float ConvertToRadians(float num) {
-  return num * 3.1415926 /180;
-}
+struct RouteGuideOptions {
+  // A positive tolerance (in metres) simplifies routes received by
+  // 'RecordRoute' before computing their distance, see
+  // 'RouteSimplifier'.
+  double simplify_tolerance = 0;
 
-// The formula is based on http://mathforum.org/library/drmath/view/51879.html
-float GetDistance(const Point& start, const Point& end) {
-  const float kCoordFactor = 10000000.0;
-  float lat_1 = start.latitude() / kCoordFactor;
-  float lat_2 = end.latitude() / kCoordFactor;
-  float lon_1 = start.longitude() / kCoordFactor;
-  float lon_2 = end.longitude() / kCoordFactor;
-  float lat_rad_1 = ConvertToRadians(lat_1);
-  float lat_rad_2 = ConvertToRadians(lat_2);
-  float delta_lat_rad = ConvertToRadians(lat_2-lat_1);
-  float delta_lon_rad = ConvertToRadians(lon_2-lon_1);
-
-  float a = pow(sin(delta_lat_rad/2), 2) + cos(lat_rad_1) * cos(lat_rad_2) *
-            pow(sin(delta_lon_rad/2), 2);
-  float c = 2 * atan2(sqrt(a), sqrt(1-a));
-  int R = 6371000; // metres
-
-  return R * c;
-}
+  // Memory a single stream may hold (inbound messages, replayed notes
+  // not yet written, captured state) before it gets cancelled, and
+  // memory all streams plus the 'RouteChat' history may hold in total.
+  // Zero means unlimited.
+  size_t stream_memory_limit = 0;
+  size_t global_memory_limit = 0;
 
-std::string GetFeatureName(const Point& point,
-                           const std::vector<Feature>& feature_list) {
-  for (const Feature& f : feature_list) {
-    if (f.location().latitude() == point.latitude() &&
-        f.location().longitude() == point.longitude()) {
-      return f.name();
-    }
-  }
-  return "";
-}
+  // Where to record inbound requests for later replay, if anywhere.
+  TrafficCapture* capture = nullptr;
+
+  // The json db and whether a malformed record in it should prevent the
+  // server from starting or just be skipped.
+  std::string db_path;
+  DbParseMode db_parse_mode = DbParseMode::kLenient;
+
+  // Binary feature db (see 'feature_db.h') to serve instead of the json
+  // db, if any, whether to copy it or attach to it (sharing it with
+  // other servers on the host) and how many blocks of its names to keep
+  // decoded.
+  std::string feature_db_path;
+  FeatureDbLoad feature_db_load = FeatureDbLoad::kCopy;
+  size_t name_cache_blocks = 64;
+
+  // Whether to keep a copy of the feature store on every NUMA node, see
+  // 'ReplicatedFeatureStore'.
+  bool numa_replicas = false;
+
+  // Directory to poll every 'feature_delta_poll_interval' for delta
+  // files (see 'feature_delta.h') to apply to the feature store, if any.
+  std::string feature_delta_dir;
+  std::chrono::seconds feature_delta_poll_interval{10};
+
+  // Whether to start serving before the feature store has been built,
+  // in which case only 'RouteChat' works until then (the other RPCs
+  // get cancelled) and health checks report NOT_SERVING.
+  bool serve_before_indexes = false;
+
+  // Sampling rate of call spans and limits on the rate of calls and on
+  // calls in flight (zero for none), see 'interceptors.h'.
+  double trace_sample_rate = 0;
+  double max_calls_per_second = 0;
+  size_t max_concurrent_calls = 0;
+
+  // Address to also serve 'GetFeature' on through pre-requested calls
+  // (see 'GetFeatureCallPool'), if any, with how many completion queues
+  // and calls kept requested on each.
+  std::string unary_address;
+  size_t unary_completion_queues = 1;
+  size_t unary_calls_per_queue = 128;
+
+  // Shards (each with a sequencer thread) that 'RouteChat' notes are
+  // split into by location, see 'RouteChatHub'.
+  size_t route_chat_shards = 4;
+
+  // Bytes of 'RouteChat' history kept, oldest evicted first (zero for
+  // no cap).
+  size_t route_chat_history_limit = 64 << 20;
+
+  // Where to log the 'RouteChat' notes sequenced, restoring the history
+  // from it at startup, if anywhere, and whether each write to it is
+  // synced before the notes it commits are acknowledged (see
+  // 'RouteChatHub').
+  std::string route_chat_log_path;
+  bool route_chat_log_sync = false;
+};
 
-class RouteGuideImpl final
-  : public RouteGuide::Service<RouteGuideImpl>,
-    public Synchronizable {
+// The 'RouteGuide' handlers, served through 'InterceptedRouteGuide'.
+class RouteGuideImpl final {
  public:
-  explicit RouteGuideImpl(const std::string& db) {
-    routeguide::ParseDb(db, &feature_list_);
+  // Logs 'RouteChat' notes to 'route_chat_log', if any.
+  explicit RouteGuideImpl(
+      const RouteGuideOptions& options,
+      AppendLog* route_chat_log = nullptr)
+    : simplify_tolerance_(options.simplify_tolerance),
+      capture_(options.capture),
+      memory_budget_(
+          options.stream_memory_limit,
+          options.global_memory_limit),
+      route_chat_(
+          options.route_chat_shards,
+          options.route_chat_history_limit,
+          route_chat_log) {}
+
+  // Restores the 'RouteChat' history from 'notes', read back from its
+  // log, before serving.
+  void RestoreRouteChat(std::vector<RouteNote>&& notes) {
+    route_chat_.Restore(std::move(notes));
+  }
+
+  // Makes 'store' available to the RPCs, may be called while serving
+  // (e.g., with a store derived by applying a delta to the current one)
+  // in which case calls that already started keep using the store they
+  // started with.
+  void SetFeatureStore(std::shared_ptr<const ReplicatedFeatureStore> store) {
+    std::atomic_store_explicit(
+        &store_,
+        std::move(store),
+        std::memory_order_release);
+  }
+
+  // The current feature store, nullptr until one is set.
+  std::shared_ptr<const ReplicatedFeatureStore> feature_store() const {
+    return std::atomic_load_explicit(&store_, std::memory_order_acquire);
   }
 
   auto GetFeature(grpc::ServerContext* context, Point&& point) {
     Feature feature;
-    feature.set_name(GetFeatureName(point, feature_list_));
-    feature.mutable_location()->CopyFrom(point);
+    GetFeature(context, point, &feature);
     return feature;
   }
 
+  // Fills in 'feature', which may keep the buffers of an earlier
+  // response (see 'GetFeatureCallPool').
+  void GetFeature(
+      grpc::ServerContext* context,
+      const Point& point,
+      Feature* feature) {
+    if (capture_ != nullptr) {
+      capture_->Record(
+          CapturedMethod::kGetFeature,
+          capture_->NextStream(),
+          point);
+    }
+    std::shared_ptr<const FeatureStore> store = LoadedStore(context);
+    if (store != nullptr) {
+      store->CopyName(
+          store->Find(Coordinate{point.latitude(), point.longitude()}),
+          feature);
+    }
+    feature->mutable_location()->CopyFrom(point);
+  }
+
+  // Starts loading the index slot that 'GetFeature()' will look 'point'
+  // up in, so that the misses of a batch of calls overlap.
+  void PrefetchFeature(const Point& point) {
+    std::shared_ptr<const ReplicatedFeatureStore> store = feature_store();
+    if (store != nullptr) {
+      store->Local().Prefetch(Coordinate{point.latitude(), point.longitude()});
+    }
+  }
+
   auto ListFeatures(
       grpc::ServerContext* context,
       routeguide::Rectangle&& rectangle) {
-    auto lo = rectangle.lo();
-    auto hi = rectangle.hi();
-    long left = (std::min)(lo.longitude(), hi.longitude());
-    long right = (std::max)(lo.longitude(), hi.longitude());
-    long top = (std::max)(lo.latitude(), hi.latitude());
-    long bottom = (std::min)(lo.latitude(), hi.latitude());
-
-    return Iterate(feature_list_)
-        | Filter([left, right, top, bottom](const Feature& f) {
-             return f.location().longitude() >= left
-                 && f.location().longitude() <= right
-                 && f.location().latitude() >= bottom
-                 && f.location().latitude() <= top;
+    if (capture_ != nullptr) {
+      capture_->Record(
+          CapturedMethod::kListFeatures,
+          capture_->NextStream(),
+          rectangle);
+    }
+    std::vector<uint32_t> ids;
+    std::shared_ptr<const FeatureStore> store = LoadedStore(context);
+    if (store != nullptr) {
+      store->FindInRectangle(
+          Coordinate{rectangle.lo().latitude(), rectangle.lo().longitude()},
+          Coordinate{rectangle.hi().latitude(), rectangle.hi().longitude()},
+          &ids);
+    }
+
+    return Iterate(std::move(ids))
+        | Map([store](uint32_t id) {
+             return store->GetFeature(id);
            });
   }
 
   auto RecordRoute(grpc::ServerContext* context, ServerReader<Point>& reader) {
     return Closure([this,
+                    context,
                     &reader,
+                    store = LoadedStore(context),
                     point_count = 0,
                     feature_count = 0,
                     distance = 0.0,
                     previous = Point(),
+                    simplifier = RouteSimplifier(simplify_tolerance_),
+                    memory = StreamMemory(&memory_budget_),
+                    cancelled = false,
+                    stream = capture_ ? capture_->NextStream() : 0,
                     start_time = system_clock::now()]() mutable {
       return reader.Read()
           | Map([&](Point&& point) {
+               if (cancelled || store == nullptr) {
+                 return;
+               }
+               if (capture_ != nullptr) {
+                 capture_->Record(CapturedMethod::kRecordRoute, stream, point);
+               }
                point_count++;
-               if (!GetFeatureName(point, feature_list_).empty()) {
+               // One lookup per point: they arrive a message at a time,
+               // so batching them (see 'FindBatch()') would only
+               // overlap misses that cost far less than a message.
+               if (store->IsNamed(store->Find(
+                       Coordinate{point.latitude(), point.longitude()}))) {
                  feature_count++;
                }
-               if (point_count != 1) {
+               size_t captured = 0;
+               if (simplify_tolerance_ > 0) {
+                 simplifier.Add(
+                     Coordinate{point.latitude(), point.longitude()});
+                 captured += sizeof(simplifier) + simplifier.MemoryUsage();
+               } else if (point_count != 1) {
                  distance += GetDistance(previous, point);
                }
                previous = point;
+               if (!memory.TryUpdate(StreamMemory::kCaptured, captured)) {
+                 cancelled = true;
+                 context->TryCancel();
+               }
              })
           | Loop()
           | Then([&]() {
+               if (simplify_tolerance_ > 0) {
+                 simplifier.Finish();
+                 distance = simplifier.Distance();
+                 // The compression ratio is received / kept.
+                 static Counter& received = Metrics::Default().GetCounter(
+                     "route_simplifier_points_received_total");
+                 static Counter& kept = Metrics::Default().GetCounter(
+                     "route_simplifier_points_kept_total");
+                 received.Increment(simplifier.received());
+                 kept.Increment(simplifier.kept());
+               }
                system_clock::time_point end_time = system_clock::now();
                RouteSummary summary;
                summary.set_point_count(point_count);
@@ -164,79 +362,773 @@ class RouteGuideImpl final
     });
   }
 
-  //  route-chat -> (notes :: ...RouteNote) -> ...RouteNote =
-  //   ... foreach: notes {
-  //     note ->
-  //       server is:
-  //         Idle { received-notes } ->
-  //           set: server is: Chatting
-  //           ... foreach: received-notes {
-  //             n ->
-  //               if: (n `location `latitude) == (note `location `latitude)
-  //                   && (n `location `longitude) == (note `location `longitude)
-  //               then: ...n
-  //               else: ...]
-  //             ...] ->
-  //               set: received-notes =: `enqueue note
-  //               ...]
-  //           }
-  //         _ -> skip: Idle
-  //     ...] -> ...]
-  //   }
-
+  // Each note is posted to 'route_chat_' (see 'RouteChatHub') whose
+  // sequencer for the note's location queues the notes received there
+  // earlier on this stream's 'RouteChatStream', from which they're
+  // written. A stream that sent 'route-chat-area' metadata is also sent
+  // the notes other streams post within that area, and one that sent
+  // 'route-chat-resume' metadata the notes it missed since it last saw
+  // them, without having to post a note at each location.
+  //
+  // Notes are read and posted on their own (see 'ReadNotes()') while
+  // the returned stream writes the queued notes as they're queued, so a
+  // stream that only listens to its area is written to as well.
   auto RouteChat(grpc::ServerContext* context, ServerReader<RouteNote>& reader) {
-    return reader.Read()
-        | FlatMap(Let(
-            [this, notes = std::vector<RouteNote>()](RouteNote& note) mutable {
-              return Synchronized(Then([&]() {
-                       for (const RouteNote& n : received_notes_) {
-                         if (n.location().latitude()
-                                 == note.location().latitude()
-                             && n.location().longitude()
-                                 == note.location().longitude()) {
-                           notes.push_back(n);
-                         }
-                       }
-                       received_notes_.push_back(note);
-                     }))
-                  | Closure([&]() {
-                       return Iterate(std::move(notes));
-                     });
-            }));
+    auto chat = std::make_shared<RouteChatStream>(&memory_budget_);
+    auto subscription = Subscribe(context, chat);
+    // Before the reads start, so the missed notes are queued first.
+    Resume(context, chat);
+    std::shared_ptr<void> reads = ReadNotes(context, reader, chat);
+    return eventuals::Stream<RouteNote>()
+        .context(RouteChatCall{
+            chat,
+            std::move(subscription),
+            std::move(reads)})
+        .next([this, context](RouteChatCall& call, auto& k) {
+          WriteNext(context, call.chat, k);
+        })
+        .done([this, context](RouteChatCall& call, auto& k) {
+          // The reads may still be running, wait for them to end.
+          context->TryCancel();
+          call.chat->Stop();
+          WriteNext(context, call.chat, k);
+        });
+  }
+
+ private:
+  // Subscribes 'chat' to the area in the 'route-chat-area' metadata, if
+  // the client sent any, or cancels the call if the area is invalid.
+  std::unique_ptr<RouteChatHub::Subscription> Subscribe(
+      grpc::ServerContext* context,
+      std::shared_ptr<RouteChatStream> chat) {
+    const auto& metadata = context->client_metadata();
+    auto spec = metadata.find("route-chat-area");
+    if (spec == metadata.end()) {
+      return nullptr;
+    }
+    std::string error;
+    std::optional<ChatArea> area = ChatArea::Parse(
+        std::string(spec->second.data(), spec->second.size()),
+        &error);
+    if (!area) {
+      std::cerr << "RouteChat: " << error << std::endl;
+      context->TryCancel();
+      return nullptr;
+    }
+    return route_chat_.Subscribe(std::move(chat), *area);
+  }
+
+  // Queues the notes 'chat' missed at the locations in the
+  // 'route-chat-resume' metadata, if the client sent any (see
+  // 'ParseChatResumePoints()'), or cancels the call if it's invalid.
+  void Resume(
+      grpc::ServerContext* context,
+      const std::shared_ptr<RouteChatStream>& chat) {
+    const auto& metadata = context->client_metadata();
+    auto spec = metadata.find("route-chat-resume");
+    if (spec == metadata.end()) {
+      return;
+    }
+    std::string error;
+    std::optional<std::vector<ChatResumePoint>> points =
+        ParseChatResumePoints(
+            std::string(spec->second.data(), spec->second.size()),
+            &error);
+    if (!points) {
+      std::cerr << "RouteChat: " << error << std::endl;
+      context->TryCancel();
+      return;
+    }
+    for (const ChatResumePoint& point : *points) {
+      route_chat_.Resume(chat, point);
+    }
+  }
+
+  // What a 'RouteChat' call holds on to until its last note is written:
+  // the reads are only done once 'chat' is closed.
+  struct RouteChatCall {
+    std::shared_ptr<RouteChatStream> chat;
+    std::unique_ptr<RouteChatHub::Subscription> subscription;
+    std::shared_ptr<void> reads;
+  };
+
+  // Starts reading the notes of a 'RouteChat' call and posting them,
+  // one at a time, closing 'chat' once the client is done writing (or
+  // the call fails) and every note has been sequenced. Returns what
+  // runs the reads, which must live until then.
+  std::shared_ptr<void> ReadNotes(
+      grpc::ServerContext* context,
+      ServerReader<RouteNote>& reader,
+      std::shared_ptr<RouteChatStream> chat) {
+    // Nothing waits on the future, 'Finally()' closes 'chat' however the
+    // reads end.
+    auto [future, k] = Terminate(
+        reader.Read()
+        | FlatMap([this,
+                   context,
+                   chat,
+                   stream = capture_ ? capture_->NextStream() : 0](
+                      RouteNote&& note) {
+            if (capture_ != nullptr) {
+              capture_->Record(CapturedMethod::kRouteChat, stream, note);
+            }
+            // The history outlives the stream so it isn't charged
+            // against the budget, it's capped by 'route_chat_'.
+            if (chat->overflowed()) {
+              context->TryCancel();
+              return PostNote(chat, std::nullopt);
+            }
+            return PostNote(chat, std::move(note));
+          })
+        | Loop()
+        | Finally([chat](auto) {
+            chat->Close();
+          }));
+    auto reads = std::make_shared<decltype(k)>(std::move(k));
+    reads->Start();
+    return reads;
+  }
+
+  // Posts 'note', if there's one, and ends once its replies have been
+  // queued on 'chat' (on the sequencer thread), before the next note is
+  // read.
+  auto PostNote(
+      std::shared_ptr<RouteChatStream> chat,
+      std::optional<RouteNote> note) {
+    return eventuals::Stream<RouteNote>()
+        .context(std::move(note))
+        .next([this, chat = std::move(chat)](
+                  std::optional<RouteNote>& note,
+                  auto& k) {
+          if (note) {
+            RouteNote posted = std::move(*note);
+            note.reset();
+            route_chat_.Post(chat, std::move(posted), [&k]() {
+              k.Ended();
+            });
+          } else {
+            k.Ended();
+          }
+        })
+        .done([](std::optional<RouteNote>&, auto& k) {
+          k.Ended();
+        });
+  }
+
+  // Writes the next note queued on 'chat' once there is one, or ends
+  // the writes once 'chat' is closed and there are none left. If 'chat'
+  // overflowed (its notes no longer fit in the memory limits) or was
+  // stopped the call is cancelled instead, ending once the reads have.
+  template <typename K>
+  void WriteNext(
+      grpc::ServerContext* context,
+      std::shared_ptr<RouteChatStream> chat,
+      K& k) {
+    chat->Notify([this, context, chat, &k]() {
+      RouteNote queued;
+      if (chat->overflowed() || chat->stopped()) {
+        if (chat->closed()) {
+          k.Ended();
+        } else {
+          context->TryCancel();
+          chat->Stop();
+          WriteNext(context, chat, k);
+        }
+      } else if (chat->Pop(&queued)) {
+        k.Emit(std::move(queued));
+      } else {
+        k.Ended();
+      }
+    });
+  }
+
+  // Returns the feature store (the copy local to the calling thread's
+  // NUMA node, kept alive for as long as the call holds on to it) or, if
+  // it hasn't been built yet, cancels the call and returns nullptr.
+  std::shared_ptr<const FeatureStore> LoadedStore(
+      grpc::ServerContext* context) {
+    std::shared_ptr<const ReplicatedFeatureStore> store = feature_store();
+    if (store == nullptr) {
+      context->TryCancel();
+      return nullptr;
+    }
+    const FeatureStore* local = &store->Local();
+    return std::shared_ptr<const FeatureStore>(std::move(store), local);
+  }
+
+  const double simplify_tolerance_;
+  TrafficCapture* capture_;
+  MemoryBudget memory_budget_;
+  // Only accessed through 'std::atomic_load()' and 'std::atomic_store()'.
+  std::shared_ptr<const ReplicatedFeatureStore> store_;
+  RouteChatHub route_chat_;
+};
+
+// The 'RouteGuide' service: the generated glue calls these, which run
+// every call to 'Handlers' through 'Interceptors' (see
+// 'InterceptorChain') so that metrics, tracing and admission control
+// aren't part of any handler.
+template <typename Handlers, typename... Interceptors>
+class InterceptedRouteGuide final
+  : public RouteGuide::Service<
+        InterceptedRouteGuide<Handlers, Interceptors...>> {
+ public:
+  InterceptedRouteGuide(Handlers* handlers, Interceptors*... interceptors)
+    : handlers_(handlers),
+      intercept_(interceptors...) {}
+
+  auto GetFeature(grpc::ServerContext* context, Point&& point) {
+    return intercept_("GetFeature", context, [&]() {
+      return handlers_->GetFeature(context, std::move(point));
+    });
+  }
+
+  // For 'GetFeatureCallPool', which serves the same calls.
+  void GetFeature(
+      grpc::ServerContext* context,
+      const Point& point,
+      Feature* feature) {
+    intercept_("GetFeature", context, [&]() {
+      handlers_->GetFeature(context, point, feature);
+    });
+  }
+
+  // The handlers of these only run once the eventual returned starts,
+  // see 'InterceptorChain', so they capture the arguments they need.
+  auto ListFeatures(
+      grpc::ServerContext* context,
+      routeguide::Rectangle&& rectangle) {
+    return intercept_.Streaming(
+        "ListFeatures",
+        context,
+        [this, context, rectangle = std::move(rectangle)]() mutable {
+          return handlers_->ListFeatures(context, std::move(rectangle));
+        });
+  }
+
+  // 'reader' is the call's, it lives as long as the call does.
+  auto RecordRoute(grpc::ServerContext* context, ServerReader<Point>& reader) {
+    return intercept_("RecordRoute", context, [this, context, &reader]() {
+      return handlers_->RecordRoute(context, reader);
+    });
+  }
+
+  auto RouteChat(
+      grpc::ServerContext* context,
+      ServerReader<RouteNote>& reader) {
+    return intercept_.Streaming(
+        "RouteChat",
+        context,
+        [this, context, &reader]() {
+          return handlers_->RouteChat(context, reader);
+        });
   }
 
  private:
-  std::vector<Feature> feature_list_;
-  std::vector<RouteNote> received_notes_;
+  Handlers* const handlers_;
+  InterceptorChain<Interceptors...> intercept_;
 };
 
-int RunServer(const std::string& db_path) {
+// Reads and parses the db (at once, see 'feature_pipeline.h') and
+// builds the feature store and its indexes, timing each phase. The read
+// completions run on the event loop but the parsing and indexing don't,
+// so with --serve_before_indexes the loop keeps flushing the logs while
+// this waits for the store. Returns nullptr if the db is malformed and
+// 'options.db_parse_mode' is strict.
+std::unique_ptr<FeatureStore> LoadFeatureStore(
+    FileIo* file_io,
+    const RouteGuideOptions& options,
+    PhaseTimer* timer) {
+  auto parser = std::make_shared<DbChunkParser>(options.db_parse_mode);
+  std::string read_error;
+  std::unique_ptr<FeatureStore> store =
+      *(ReadFile(file_io, options.db_path, &read_error)
+        | ParseAndIndex(parser, timer));
+  if (!read_error.empty()) {
+    // Like before, a missing db just means serving no features.
+    std::cerr << "Error reading the db file: " << read_error << std::endl;
+  }
+  if (!parser->error().empty()) {
+    std::cerr << "Error parsing the db file: " << parser->error()
+              << std::endl;
+  }
+  if (store) {
+    std::cout << "DB parsed, loaded " << store->size() << " features."
+              << std::endl;
+  }
+  return store;
+}
+
+// Maps the binary feature db and builds the feature store's indexes
+// from its coordinates, names are decoded lazily while serving.
+std::unique_ptr<FeatureStore> MapFeatureDb(
+    const RouteGuideOptions& options,
+    PhaseTimer* timer) {
+  std::string error;
+  std::unique_ptr<FeatureStore> store = routeguide::LoadFeatureDb(
+      options.feature_db_path,
+      options.name_cache_blocks,
+      options.feature_db_load,
+      &error);
+  if (!store) {
+    std::cerr << "Error loading the feature db: " << error << std::endl;
+    return nullptr;
+  }
+  std::cout << "Feature DB mapped, loaded " << store->size()
+            << " features." << std::endl;
+  timer->Lap("load_feature_db");
+  return store;
+}
+
+// Applies the delta files that show up in 'options.feature_delta_dir'
+// to the feature store of 'impl', each once and in name order (starting
+// with those already there), publishing each updated store atomically.
+// Runs on a detached thread, like the metrics reporter.
+void StartFeatureDeltaPoller(
+    RouteGuideImpl* impl,
+    const RouteGuideOptions& options) {
+  if (options.feature_delta_dir.empty()) {
+    return;
+  }
+  std::thread([impl,
+               directory = options.feature_delta_dir,
+               interval = options.feature_delta_poll_interval]() {
+    static Counter& applied =
+        Metrics::Default().GetCounter("feature_deltas_applied_total");
+    static Counter& rejected =
+        Metrics::Default().GetCounter("feature_deltas_rejected_total");
+    // Path of the last delta file applied (or rejected), files are
+    // expected to be named in the order they're written (e.g., by a
+    // sequence number). One that can't be read or parsed may still be
+    // being written, it's retried at the next poll (before any later
+    // one) and only reported once.
+    std::string last;
+    std::string unreadable;
+    while (true) {
+      for (const std::string& path :
+           routeguide::ListFeatureDeltas(directory)) {
+        if (path <= last) {
+          continue;
+        }
+        std::vector<FeatureChange> delta;
+        std::string error;
+        if (!routeguide::ReadFeatureDelta(path, &delta, &error)) {
+          if (path != unreadable) {
+            std::cerr << "Waiting for feature delta " << path << ": "
+                      << error << std::endl;
+            unreadable = path;
+          }
+          break;
+        }
+        last = path;
+        std::unique_ptr<ReplicatedFeatureStore> updated =
+            impl->feature_store()->ApplyDelta(delta, &error);
+        if (!updated) {
+          std::cerr << "Skipping feature delta " << path << ": " << error
+                    << std::endl;
+          rejected.Increment();
+          continue;
+        }
+        std::cout << "Applied feature delta " << path << " ("
+                  << delta.size() << " changes), serving "
+                  << updated->Local().size() << " features." << std::endl;
+        Metrics::Default()
+            .GetGauge("feature_store_bytes")
+            .Set(updated->MemoryUsage());
+        impl->SetFeatureStore(std::move(updated));
+        applied.Increment();
+      }
+      std::this_thread::sleep_for(interval);
+    }
+  }).detach();
+}
+
+// Bytes of 'RouteChat' notes that may wait for the log's write in flight,
+// notes past that aren't logged.
+const size_t kRouteChatLogBufferBytes = 16 << 20;
+
+// Reads the notes an earlier run logged to 'options.route_chat_log_path'
+// (if it did) into 'notes' and opens the log to append after them,
+// dropping a record torn by a crash. Returns nullptr if the log can't be
+// read or opened.
+std::unique_ptr<AppendLog> OpenRouteChatLog(
+    FileIo* file_io,
+    const RouteGuideOptions& options,
+    std::vector<RouteNote>* notes) {
+  const std::string& path = options.route_chat_log_path;
+  std::string contents;
+  std::string error;
+  if (access(path.c_str(), F_OK) == 0
+      && !routeguide::ReadFileContents(file_io, path, &contents, &error)) {
+    std::cerr << "Error reading the RouteChat log: " << error << std::endl;
+    return nullptr;
+  }
+  size_t size = routeguide::ParseChatLog(contents, notes);
+  if (size < contents.size()) {
+    std::cerr << "Dropping " << contents.size() - size
+              << " bytes of a torn record at the end of " << path
+              << std::endl;
+  }
+  std::unique_ptr<AppendLog> log = AppendLog::Open(
+      file_io,
+      path,
+      size,
+      options.route_chat_log_sync,
+      kRouteChatLogBufferBytes,
+      &error);
+  if (!log) {
+    std::cerr << "Error opening the RouteChat log: " << error << std::endl;
+    return nullptr;
+  }
+  std::cout << "Restoring " << notes->size() << " RouteChat notes from "
+            << path << std::endl;
+  return log;
+}
+
+int RunServer(
+    FileIo* file_io,
+    const RouteGuideOptions& options,
+    PhaseTimer* timer) {
   std::string server_address("0.0.0.0:50051");
-  RouteGuideImpl impl(db_path);
+
+  // Outlives 'impl', which waits for its notes to be written.
+  std::unique_ptr<AppendLog> route_chat_log;
+  std::vector<RouteNote> restored;
+  if (!options.route_chat_log_path.empty()) {
+    route_chat_log = OpenRouteChatLog(file_io, options, &restored);
+    if (!route_chat_log) {
+      return -1;
+    }
+  }
+
+  RouteGuideImpl impl(options, route_chat_log.get());
+  impl.RestoreRouteChat(std::move(restored));
+  HealthImpl health({"routeguide.RouteGuide"});
+
+  // Limits go first so that rejected calls aren't measured or traced.
+  RateLimitInterceptor rate_limit(options.max_calls_per_second);
+  AdmissionInterceptor admission(options.max_concurrent_calls);
+  MetricsInterceptor metrics(
+      {"GetFeature", "ListFeatures", "RecordRoute", "RouteChat"});
+  TracingInterceptor tracing(options.trace_sample_rate);
+  InterceptedRouteGuide<
+      RouteGuideImpl,
+      RateLimitInterceptor,
+      AdmissionInterceptor,
+      MetricsInterceptor,
+      TracingInterceptor>
+      service(&impl, &rate_limit, &admission, &metrics, &tracing);
+
+  auto load = [&]() {
+    std::unique_ptr<FeatureStore> store = options.feature_db_path.empty()
+        ? LoadFeatureStore(file_io, options, timer)
+        : MapFeatureDb(options, timer);
+    if (!store) {
+      return false;
+    }
+    std::unique_ptr<ReplicatedFeatureStore> replicated;
+    if (options.numa_replicas) {
+      std::string error;
+      replicated = ReplicatedFeatureStore::Replicate(
+          std::move(store),
+          NumaTopology::Detect(),
+          &error);
+      if (!error.empty()) {
+        std::cerr << "Failed to replicate the feature store: " << error
+                  << std::endl;
+      }
+      timer->Lap("replicate");
+    } else {
+      replicated = std::make_unique<ReplicatedFeatureStore>(std::move(store));
+    }
+    std::cout << "Feature store uses " << replicated->MemoryUsage()
+              << " bytes (" << replicated->replicas() << " replicas)."
+              << std::endl;
+    Metrics::Default()
+        .GetGauge("feature_store_bytes")
+        .Set(replicated->MemoryUsage());
+    impl.SetFeatureStore(std::move(replicated));
+    health.SetServing(true);
+    timer->Total();
+    StartFeatureDeltaPoller(&impl, options);
+    return true;
+  };
+
+  std::promise<bool> loaded;
+  std::future<bool> load_result = loaded.get_future();
+  std::thread loader;
+  if (options.serve_before_indexes) {
+    loader = std::thread([&]() {
+      loaded.set_value(load());
+    });
+  } else if (!load()) {
+    return -1;
+  }
+
+  std::unique_ptr<GetFeatureCallPool> unary;
+  if (!options.unary_address.empty()) {
+    std::string error;
+    unary = GetFeatureCallPool::Start(
+        options.unary_address,
+        options.unary_completion_queues,
+        options.unary_calls_per_queue,
+        [&service](
+            grpc::ServerContext* context,
+            const Point& point,
+            Feature* feature) {
+          service.GetFeature(context, point, feature);
+        },
+        [&impl](const Point& point) {
+          impl.PrefetchFeature(point);
+        },
+        &error);
+    if (!unary) {
+      std::cerr << "Failed to start unary GetFeature server: " << error
+                << std::endl;
+      if (loader.joinable()) {
+        loader.join();
+      }
+      return -1;
+    }
+    std::cout << "Serving unary GetFeature on " << options.unary_address
+              << std::endl;
+  }
 
   ServerBuilder builder;
   builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
 
-  builder.RegisterService(&impl);
+  builder.RegisterService(&service);
+  builder.RegisterService(&health);
 
   auto build = builder.BuildAndStart();
 
   if (!build.status.ok()) {
     std::cerr << "Failed to build and start server: "
               << build.status.error() << std::endl;
+    if (loader.joinable()) {
+      loader.join();
+    }
     return -1;
   }
 
   std::unique_ptr<Server> server(std::move(build.server));
   std::cout << "Server listening on " << server_address << std::endl;
 
+  // The features are still loading with --serve_before_indexes, if that
+  // fails shut down (and exit non-zero) rather than reporting
+  // NOT_SERVING and cancelling calls forever.
+  if (loader.joinable()) {
+    bool ok = load_result.get();
+    loader.join();
+    if (!ok) {
+      std::cerr << "Failed to load features, shutting down" << std::endl;
+      health.Shutdown();
+      server->Shutdown();
+      server->Wait();
+      return -1;
+    }
+  }
+
   server->Wait();
 
   return 0;
 }
 
 int main(int argc, char** argv) {
-  // Expect only arg: --db_path=path/to/route_guide_db.json.
-  std::string db = routeguide::GetDbFileContent(argc, argv);
-  return RunServer(db);
+  // Expect args: --db_path=path/to/route_guide_db.json,
+  // --simplify_tolerance_m=0, --stream_memory_limit_bytes=0,
+  // --global_memory_limit_bytes=0, --capture_path=path/to/capture,
+  // --capture_buffer_bytes=16777216, --strict_db=false,
+  // --serve_before_indexes=false, --metrics_interval_s=0,
+  // --feature_db_path=path/to/route_guide_db.rgdb (instead of --db_path),
+  // --attach_feature_db=false, --name_cache_blocks=64,
+  // --huge_pages=none (or transparent or hugetlb, see 'HugePages') and
+  // --numa_replicas=false, --file_io=auto (or io_uring or threads,
+  // see 'FileIo'), --feature_delta_dir=path/to/deltas,
+  // --feature_delta_poll_s=10, --trace_sample_rate=0,
+  // --max_calls_per_s=0, --max_concurrent_calls=0,
+  // --unary_address=0.0.0.0:50052 (unset by default),
+  // --unary_completion_queues=1, --unary_calls_per_queue=128,
+  // --route_chat_shards=4, --route_chat_history_bytes=67108864,
+  // --route_chat_log_path=path/to/route_chat.log (unset by default) and
+  // --route_chat_log_sync=false.
+  PhaseTimer timer("startup");
+
+  HugePages huge_pages;
+  std::string huge_pages_flag =
+      routeguide::GetFlagValue(argc, argv, "huge_pages", "none");
+  if (!routeguide::ParseHugePages(huge_pages_flag, &huge_pages)) {
+    std::cerr << "Invalid --huge_pages=" << huge_pages_flag << std::endl;
+    return -1;
+  }
+  routeguide::SetHugePages(huge_pages);
+
+  RouteGuideOptions options;
+  options.feature_db_path =
+      routeguide::GetFlagValue(argc, argv, "feature_db_path");
+  if (routeguide::GetFlagValue(argc, argv, "attach_feature_db", "false")
+      == "true") {
+    options.feature_db_load = FeatureDbLoad::kAttach;
+  }
+  // Every malformed flag is reported before giving up.
+  bool valid_flags = routeguide::GetFlagValue(
+      argc,
+      argv,
+      "name_cache_blocks",
+      size_t(64),
+      &options.name_cache_blocks);
+  options.numa_replicas = routeguide::GetFlagValue(
+      argc,
+      argv,
+      "numa_replicas",
+      "false") == "true";
+  options.feature_delta_dir =
+      routeguide::GetFlagValue(argc, argv, "feature_delta_dir");
+  int feature_delta_poll_s = 0;
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "feature_delta_poll_s",
+      10,
+      &feature_delta_poll_s);
+  options.feature_delta_poll_interval =
+      std::chrono::seconds(feature_delta_poll_s);
+
+  FileIo::Backend file_io_backend;
+  std::string file_io_flag =
+      routeguide::GetFlagValue(argc, argv, "file_io", "auto");
+  if (!FileIo::ParseBackend(file_io_flag, &file_io_backend)) {
+    std::cerr << "Invalid --file_io=" << file_io_flag << std::endl;
+    return -1;
+  }
+  // File I/O completes on the event loop rather than on threads of its
+  // own, the watcher has to be set up before the loop runs.
+  std::unique_ptr<FileIo> file_io = FileIo::Create(
+      file_io_backend,
+      64,
+      FileIo::Completions::kPolled);
+  if (!file_io) {
+    std::cerr << "Failed to set up --file_io=" << file_io_flag << std::endl;
+    return -1;
+  }
+  EventLoop::ConstructDefault();
+  FileIoWatcher file_io_watcher(file_io.get(), EventLoop::Default());
+  std::thread([]() { EventLoop::Default().RunForever(); }).detach();
+
+  options.db_path = routeguide::GetDbPath(argc, argv);
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "simplify_tolerance_m",
+      0.0,
+      &options.simplify_tolerance);
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "stream_memory_limit_bytes",
+      size_t(0),
+      &options.stream_memory_limit);
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "global_memory_limit_bytes",
+      size_t(0),
+      &options.global_memory_limit);
+  if (routeguide::GetFlagValue(argc, argv, "strict_db", "false") == "true") {
+    options.db_parse_mode = DbParseMode::kStrict;
+  }
+  options.serve_before_indexes = routeguide::GetFlagValue(
+      argc,
+      argv,
+      "serve_before_indexes",
+      "false") == "true";
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "trace_sample_rate",
+      0.0,
+      &options.trace_sample_rate);
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "max_calls_per_s",
+      0.0,
+      &options.max_calls_per_second);
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "max_concurrent_calls",
+      size_t(0),
+      &options.max_concurrent_calls);
+  options.unary_address =
+      routeguide::GetFlagValue(argc, argv, "unary_address");
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "unary_completion_queues",
+      size_t(1),
+      &options.unary_completion_queues);
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "unary_calls_per_queue",
+      size_t(128),
+      &options.unary_calls_per_queue);
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "route_chat_shards",
+      size_t(4),
+      &options.route_chat_shards);
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "route_chat_history_bytes",
+      size_t(64 << 20),
+      &options.route_chat_history_limit);
+  options.route_chat_log_path =
+      routeguide::GetFlagValue(argc, argv, "route_chat_log_path");
+  options.route_chat_log_sync = routeguide::GetFlagValue(
+      argc,
+      argv,
+      "route_chat_log_sync",
+      "false") == "true";
+  size_t capture_buffer_bytes = 0;
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "capture_buffer_bytes",
+      size_t(16777216),
+      &capture_buffer_bytes);
+  int metrics_interval_s = 0;
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "metrics_interval_s",
+      0,
+      &metrics_interval_s);
+  if (!valid_flags) {
+    return -1;
+  }
+
+  std::unique_ptr<TrafficCapture> capture;
+  std::string capture_path =
+      routeguide::GetFlagValue(argc, argv, "capture_path");
+  if (!capture_path.empty()) {
+    std::string error;
+    capture = TrafficCapture::Open(
+        file_io.get(),
+        capture_path,
+        capture_buffer_bytes,
+        &error);
+    if (!capture) {
+      std::cerr << "Failed to open the capture: " << error << std::endl;
+      return -1;
+    }
+    options.capture = capture.get();
+  }
+
+  routeguide::StartMetricsReporter(std::chrono::seconds(metrics_interval_s));
+
+  return RunServer(file_io.get(), options, &timer);
 }
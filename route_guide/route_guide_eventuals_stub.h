@@ -0,0 +1,79 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_GUIDE_EVENTUALS_STUB_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_GUIDE_EVENTUALS_STUB_H_
+
+#include <memory>
+#include <string>
+
+#include "eventuals/grpc/client.h"
+#include "protos/route_guide.grpc.pb.h"
+
+namespace routeguide {
+
+// Typed eventuals client stub for 'routeguide.RouteGuide', the
+// counterpart of the generated 'RouteGuide::Stub': each method starts a
+// call with its request and response types fixed at compile time, so
+// call sites can't mistype a method name or mismatch a message type.
+//
+// NOTE: it's only a wrapper, 'Client::Call()' still builds the
+// method's path from its name (and gRPC a method from that) on every
+// call. Reusing a 'grpc::internal::RpcMethod' per method, like
+// 'RouteGuide::Stub' does, needs 'eventuals::grpc::Client' to accept
+// one, which it doesn't.
+class RouteGuideEventualsStub {
+ public:
+  RouteGuideEventualsStub(
+      const std::string& target,
+      const std::shared_ptr<::grpc::ChannelCredentials>& credentials,
+      stout::borrowed_ptr<eventuals::grpc::CompletionPool> pool)
+    : client_(target, credentials, std::move(pool)) {}
+
+  auto GetFeature() {
+    return client_.Call<RouteGuide, Point, Feature>("GetFeature");
+  }
+
+  auto ListFeatures() {
+    return client_.Call<
+        RouteGuide,
+        Rectangle,
+        eventuals::grpc::Stream<Feature>>("ListFeatures");
+  }
+
+  auto RecordRoute() {
+    return client_.Call<
+        RouteGuide,
+        eventuals::grpc::Stream<Point>,
+        RouteSummary>("RecordRoute");
+  }
+
+  auto RouteChat() {
+    return client_.Call<
+        RouteGuide,
+        eventuals::grpc::Stream<RouteNote>,
+        eventuals::grpc::Stream<RouteNote>>("RouteChat");
+  }
+
+ private:
+  eventuals::grpc::Client client_;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_GUIDE_EVENTUALS_STUB_H_
@@ -0,0 +1,401 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Replays requests captured by a server started with '--capture_path'
+// against a (possibly different) server and reports latency
+// distributions per method. Every captured RPC is replayed at its
+// original offset from the start of the capture divided by '--speed'
+// (0 replays as fast as possible) by one of '--concurrency' threads.
+// Client streaming RPCs also keep the original spacing between their
+// messages.
+//
+// '--methods' (a comma separated list, e.g., "GetFeature") replays only
+// the calls of those methods, e.g., against a server that doesn't
+// implement the others. '--get_features=N' replays N synthetic
+// 'GetFeature' calls instead of a capture, the same ones on every run,
+// so that two servers can be compared without capturing first.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpc/grpc.h>
+#include <grpcpp/channel.h>
+#include <grpcpp/client_context.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+#include "helper.h"
+#include "protos/route_guide.grpc.pb.h"
+#include "traffic_capture.h"
+
+using grpc::Channel;
+using grpc::ClientContext;
+using grpc::ClientReader;
+using grpc::ClientReaderWriter;
+using grpc::ClientWriter;
+using grpc::Status;
+using routeguide::CapturedMethod;
+using routeguide::CapturedRequest;
+using routeguide::Feature;
+using routeguide::Point;
+using routeguide::Rectangle;
+using routeguide::RouteGuide;
+using routeguide::RouteNote;
+using routeguide::RouteSummary;
+
+using Clock = std::chrono::steady_clock;
+using std::chrono::nanoseconds;
+
+// All captured messages of a single RPC.
+struct Call {
+  CapturedMethod method;
+  std::vector<const CapturedRequest*> requests;
+};
+
+class Latencies {
+ public:
+  void Add(CapturedMethod method, nanoseconds latency, bool ok) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& samples = samples_[method];
+    samples.latencies.push_back(latency);
+    if (!ok) {
+      samples.failures++;
+    }
+  }
+
+  void AddLag(nanoseconds lag) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lags_.push_back(lag);
+  }
+
+  void Print() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::cout << std::left << std::setw(14) << "method"
+              << std::right << std::setw(9) << "count"
+              << std::setw(9) << "failed"
+              << std::setw(11) << "p50 us"
+              << std::setw(11) << "p90 us"
+              << std::setw(11) << "p99 us"
+              << std::setw(11) << "p99.9 us"
+              << std::setw(11) << "max us" << std::endl;
+    for (auto& [method, samples] : samples_) {
+      PrintRow(
+          routeguide::CapturedMethodName(method),
+          samples.latencies,
+          samples.failures);
+    }
+    // How late calls were started compared to their schedule, if this
+    // is significant the replay needs more '--concurrency'.
+    PrintRow("(start lag)", lags_, 0);
+  }
+
+ private:
+  static void PrintRow(
+      const std::string& name,
+      std::vector<nanoseconds>& latencies,
+      size_t failures) {
+    if (latencies.empty()) {
+      return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+      size_t index = static_cast<size_t>(p * (latencies.size() - 1));
+      return std::chrono::duration_cast<std::chrono::microseconds>(
+                 latencies[index])
+          .count();
+    };
+    std::cout << std::left << std::setw(14) << name
+              << std::right << std::setw(9) << latencies.size()
+              << std::setw(9) << failures
+              << std::setw(11) << percentile(0.5)
+              << std::setw(11) << percentile(0.9)
+              << std::setw(11) << percentile(0.99)
+              << std::setw(11) << percentile(0.999)
+              << std::setw(11) << percentile(1.0) << std::endl;
+  }
+
+  struct Samples {
+    std::vector<nanoseconds> latencies;
+    size_t failures = 0;
+  };
+
+  std::mutex mutex_;
+  std::map<CapturedMethod, Samples> samples_;
+  std::vector<nanoseconds> lags_;
+};
+
+// Returns 'count' 'GetFeature' requests, all due at the start:
+// alternately at the location of one of 'features' (in turn) and at a
+// random point, which almost never has a feature.
+std::vector<CapturedRequest> SyntheticGetFeatures(
+    const std::vector<Feature>& features,
+    size_t count) {
+  std::mt19937 random(count);
+  std::uniform_int_distribution<int32_t> latitude(-900000000, 900000000);
+  std::uniform_int_distribution<int32_t> longitude(
+      -1800000000,
+      1800000000);
+  std::vector<CapturedRequest> requests(count);
+  for (size_t i = 0; i < count; i++) {
+    Point point;
+    if (i % 2 == 0 && !features.empty()) {
+      point = features[(i / 2) % features.size()].location();
+    } else {
+      point.set_latitude(latitude(random));
+      point.set_longitude(longitude(random));
+    }
+    requests[i].stream = i + 1;
+    requests[i].method = CapturedMethod::kGetFeature;
+    point.SerializeToString(&requests[i].payload);
+  }
+  return requests;
+}
+
+// Parses a comma separated list of method names into 'methods',
+// returning false if one isn't a 'RouteGuide' method.
+bool ParseMethods(const std::string& list, std::set<CapturedMethod>* methods) {
+  std::stringstream names(list);
+  std::string name;
+  while (std::getline(names, name, ',')) {
+    bool found = false;
+    for (CapturedMethod method :
+         {CapturedMethod::kGetFeature,
+          CapturedMethod::kListFeatures,
+          CapturedMethod::kRecordRoute,
+          CapturedMethod::kRouteChat}) {
+      if (name == routeguide::CapturedMethodName(method)) {
+        methods->insert(method);
+        found = true;
+      }
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  return true;
+}
+
+class Replayer {
+ public:
+  Replayer(std::shared_ptr<Channel> channel, double speed)
+    : stub_(RouteGuide::NewStub(channel)),
+      speed_(speed) {}
+
+  // Replays 'calls' (ordered by their first request) using
+  // 'concurrency' threads.
+  void Run(const std::vector<Call>& calls, int concurrency) {
+    start_ = Clock::now();
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < concurrency; i++) {
+      threads.emplace_back([&]() {
+        size_t index = 0;
+        while ((index = next.fetch_add(1)) < calls.size()) {
+          Replay(calls[index]);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  Latencies& latencies() { return latencies_; }
+
+ private:
+  Clock::time_point Scheduled(const CapturedRequest& request) {
+    if (speed_ <= 0) {
+      return start_;
+    }
+    return start_
+        + std::chrono::duration_cast<Clock::duration>(
+               nanoseconds(static_cast<int64_t>(request.time / speed_)));
+  }
+
+  void Replay(const Call& call) {
+    Clock::time_point scheduled = Scheduled(*call.requests.front());
+    std::this_thread::sleep_until(scheduled);
+    latencies_.AddLag(std::max(Clock::now() - scheduled, Clock::duration()));
+
+    ClientContext context;
+    Clock::time_point start = Clock::now();
+    bool ok = false;
+
+    switch (call.method) {
+      case CapturedMethod::kGetFeature: {
+        Point point;
+        Feature feature;
+        point.ParseFromString(call.requests.front()->payload);
+        ok = stub_->GetFeature(&context, point, &feature).ok();
+        break;
+      }
+      case CapturedMethod::kListFeatures: {
+        Rectangle rectangle;
+        Feature feature;
+        rectangle.ParseFromString(call.requests.front()->payload);
+        std::unique_ptr<ClientReader<Feature>> reader(
+            stub_->ListFeatures(&context, rectangle));
+        while (reader->Read(&feature)) {}
+        ok = reader->Finish().ok();
+        break;
+      }
+      case CapturedMethod::kRecordRoute: {
+        RouteSummary summary;
+        std::unique_ptr<ClientWriter<Point>> writer(
+            stub_->RecordRoute(&context, &summary));
+        for (const CapturedRequest* request : call.requests) {
+          std::this_thread::sleep_until(Scheduled(*request));
+          Point point;
+          point.ParseFromString(request->payload);
+          if (!writer->Write(point)) {
+            break;
+          }
+        }
+        // Only measure the time to get the summary, the rest is the
+        // (replayed) client pace.
+        start = Clock::now();
+        writer->WritesDone();
+        ok = writer->Finish().ok();
+        break;
+      }
+      case CapturedMethod::kRouteChat: {
+        std::shared_ptr<ClientReaderWriter<RouteNote, RouteNote>> stream(
+            stub_->RouteChat(&context));
+        std::thread reader([stream]() {
+          RouteNote note;
+          while (stream->Read(&note)) {}
+        });
+        for (const CapturedRequest* request : call.requests) {
+          std::this_thread::sleep_until(Scheduled(*request));
+          RouteNote note;
+          note.ParseFromString(request->payload);
+          if (!stream->Write(note)) {
+            break;
+          }
+        }
+        // Measures how long it takes to drain the remaining replies.
+        start = Clock::now();
+        stream->WritesDone();
+        reader.join();
+        ok = stream->Finish().ok();
+        break;
+      }
+    }
+
+    latencies_.Add(call.method, Clock::now() - start, ok);
+  }
+
+  std::unique_ptr<RouteGuide::Stub> stub_;
+  const double speed_;
+  Clock::time_point start_;
+  Latencies latencies_;
+};
+
+int main(int argc, char** argv) {
+  // Expect args: --capture_path=path/to/capture (or --get_features=N
+  // and --db_path=path/to/route_guide_db.json), --target=localhost:50051,
+  // --speed=1, --concurrency=64 and --methods=<all methods>.
+  std::string capture_path =
+      routeguide::GetFlagValue(argc, argv, "capture_path");
+  std::string target =
+      routeguide::GetFlagValue(argc, argv, "target", "localhost:50051");
+  std::string methods_flag = routeguide::GetFlagValue(
+      argc,
+      argv,
+      "methods",
+      "GetFeature,ListFeatures,RecordRoute,RouteChat");
+  double speed = 0;
+  int concurrency = 0;
+  size_t get_features = 0;
+  bool valid_flags = routeguide::GetFlagValue(argc, argv, "speed", 1.0, &speed);
+  valid_flags &=
+      routeguide::GetFlagValue(argc, argv, "concurrency", 64, &concurrency);
+  valid_flags &= routeguide::GetFlagValue(
+      argc,
+      argv,
+      "get_features",
+      size_t(0),
+      &get_features);
+  if (!valid_flags) {
+    return -1;
+  }
+  std::set<CapturedMethod> methods;
+  if (!ParseMethods(methods_flag, &methods)) {
+    std::cerr << "Invalid --methods=" << methods_flag
+              << ", expected a comma separated list of GetFeature,"
+              << " ListFeatures, RecordRoute and RouteChat" << std::endl;
+    return -1;
+  }
+
+  std::vector<CapturedRequest> requests;
+  if (get_features > 0) {
+    std::vector<Feature> features;
+    routeguide::ParseDb(
+        routeguide::GetDbFileContent(argc, argv),
+        &features);
+    requests = SyntheticGetFeatures(features, get_features);
+  } else if (!routeguide::ReadTrafficCapture(capture_path, &requests)) {
+    std::cerr << "Failed to read capture " << capture_path << std::endl;
+    return -1;
+  }
+
+  // Group requests into calls, ordered by when each call started.
+  std::vector<Call> calls;
+  std::map<uint64_t, size_t> indexes;
+  for (const CapturedRequest& request : requests) {
+    if (methods.count(request.method) == 0) {
+      continue;
+    }
+    auto [iterator, inserted] = indexes.emplace(request.stream, calls.size());
+    if (inserted) {
+      calls.push_back(Call{request.method, {}});
+    }
+    calls[iterator->second].requests.push_back(&request);
+  }
+
+  std::cout << "Replaying " << calls.size() << " calls (" << requests.size()
+            << " requests) against " << target << std::endl;
+
+  Replayer replayer(
+      grpc::CreateChannel(target, grpc::InsecureChannelCredentials()),
+      speed);
+
+  Clock::time_point start = Clock::now();
+  replayer.Run(calls, concurrency);
+  auto elapsed = std::chrono::duration<double>(Clock::now() - start);
+
+  std::cout << "Replayed in " << elapsed.count() << " seconds ("
+            << calls.size() / elapsed.count() << " calls/second)"
+            << std::endl;
+
+  replayer.latencies().Print();
+
+  return 0;
+}
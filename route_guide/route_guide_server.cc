@@ -16,21 +16,23 @@
  *
  */
 
-#include <algorithm>
 #include <chrono>
-#include <cmath>
 #include <iostream>
 #include <memory>
 #include <string>
 
 #include <grpc/grpc.h>
+#include <grpcpp/resource_quota.h>
 #include <grpcpp/server.h>
 #include <grpcpp/server_builder.h>
 #include <grpcpp/server_context.h>
 #include <grpcpp/security/server_credentials.h>
+#include "feature_store.h"
+#include "geo.h"
 #include "helper.h"
 #include "protos/route_guide.grpc.pb.h"
 
+using grpc::ResourceQuota;
 using grpc::Server;
 using grpc::ServerBuilder;
 using grpc::ServerContext;
@@ -44,53 +46,27 @@ using routeguide::Rectangle;
 using routeguide::RouteSummary;
 using routeguide::RouteNote;
 using routeguide::RouteGuide;
+using routeguide::Coordinate;
+using routeguide::FeatureStore;
+using routeguide::GetDistance;
 using std::chrono::system_clock;
 
-
-float ConvertToRadians(float num) {
-  return num * 3.1415926 /180;
-}
-
-// The formula is based on http://mathforum.org/library/drmath/view/51879.html
-float GetDistance(const Point& start, const Point& end) {
-  const float kCoordFactor = 10000000.0;
-  float lat_1 = start.latitude() / kCoordFactor;
-  float lat_2 = end.latitude() / kCoordFactor;
-  float lon_1 = start.longitude() / kCoordFactor;
-  float lon_2 = end.longitude() / kCoordFactor;
-  float lat_rad_1 = ConvertToRadians(lat_1);
-  float lat_rad_2 = ConvertToRadians(lat_2);
-  float delta_lat_rad = ConvertToRadians(lat_2-lat_1);
-  float delta_lon_rad = ConvertToRadians(lon_2-lon_1);
-
-  float a = pow(sin(delta_lat_rad/2), 2) + cos(lat_rad_1) * cos(lat_rad_2) *
-            pow(sin(delta_lon_rad/2), 2);
-  float c = 2 * atan2(sqrt(a), sqrt(1-a));
-  int R = 6371000; // metres
-
-  return R * c;
-}
-
-std::string GetFeatureName(const Point& point,
-                           const std::vector<Feature>& feature_list) {
-  for (const Feature& f : feature_list) {
-    if (f.location().latitude() == point.latitude() &&
-        f.location().longitude() == point.longitude()) {
-      return f.name();
-    }
-  }
-  return "";
+std::vector<Feature> ParseFeatures(const std::string& db) {
+  std::vector<Feature> features;
+  routeguide::ParseDb(db, &features);
+  return features;
 }
 
 class RouteGuideImpl final : public RouteGuide::Service {
  public:
-  explicit RouteGuideImpl(const std::string& db) {
-    routeguide::ParseDb(db, &feature_list_);
-  }
+  explicit RouteGuideImpl(const std::string& db)
+    : store_(ParseFeatures(db)) {}
 
   Status GetFeature(ServerContext* context, const Point* point,
                     Feature* feature) override {
-    feature->set_name(GetFeatureName(*point, feature_list_));
+    store_.CopyName(
+        store_.Find(Coordinate{point->latitude(), point->longitude()}),
+        feature);
     feature->mutable_location()->CopyFrom(*point);
     return Status::OK;
   }
@@ -98,19 +74,13 @@ class RouteGuideImpl final : public RouteGuide::Service {
   Status ListFeatures(ServerContext* context,
                       const routeguide::Rectangle* rectangle,
                       ServerWriter<Feature>* writer) override {
-    auto lo = rectangle->lo();
-    auto hi = rectangle->hi();
-    long left = (std::min)(lo.longitude(), hi.longitude());
-    long right = (std::max)(lo.longitude(), hi.longitude());
-    long top = (std::max)(lo.latitude(), hi.latitude());
-    long bottom = (std::min)(lo.latitude(), hi.latitude());
-    for (const Feature& f : feature_list_) {
-      if (f.location().longitude() >= left &&
-          f.location().longitude() <= right &&
-          f.location().latitude() >= bottom &&
-          f.location().latitude() <= top) {
-        writer->Write(f);
-      }
+    std::vector<uint32_t> ids;
+    store_.FindInRectangle(
+        Coordinate{rectangle->lo().latitude(), rectangle->lo().longitude()},
+        Coordinate{rectangle->hi().latitude(), rectangle->hi().longitude()},
+        &ids);
+    for (uint32_t id : ids) {
+      writer->Write(store_.GetFeature(id));
     }
     return Status::OK;
   }
@@ -126,7 +96,8 @@ class RouteGuideImpl final : public RouteGuide::Service {
     system_clock::time_point start_time = system_clock::now();
     while (reader->Read(&point)) {
       point_count++;
-      if (!GetFeatureName(point, feature_list_).empty()) {
+      if (store_.IsNamed(
+              store_.Find(Coordinate{point.latitude(), point.longitude()}))) {
         feature_count++;
       }
       if (point_count != 1) {
@@ -148,42 +119,91 @@ class RouteGuideImpl final : public RouteGuide::Service {
   Status RouteChat(ServerContext* context,
                    ServerReaderWriter<RouteNote, RouteNote>* stream) override {
     RouteNote note;
+    // Notes to write to this stream, queued while holding 'mu_' and only
+    // written once it is released so that a slow client (whose writes
+    // block) doesn't stall every other stream.
+    std::vector<RouteNote> outbound;
     while (stream->Read(&note)) {
-      std::unique_lock<std::mutex> lock(mu_);
-      for (const RouteNote& n : received_notes_) {
-        if (n.location().latitude() == note.location().latitude() &&
-            n.location().longitude() == note.location().longitude()) {
-          stream->Write(n);
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        for (const RouteNote& n : received_notes_) {
+          if (n.location().latitude() == note.location().latitude() &&
+              n.location().longitude() == note.location().longitude()) {
+            outbound.push_back(n);
+          }
+        }
+        received_notes_.push_back(note);
+      }
+      for (const RouteNote& n : outbound) {
+        if (!stream->Write(n)) {
+          return Status::OK;
         }
       }
-      received_notes_.push_back(note);
+      outbound.clear();
     }
 
     return Status::OK;
   }
 
  private:
-  std::vector<Feature> feature_list_;
+  const FeatureStore store_;
   std::mutex mu_;
   std::vector<RouteNote> received_notes_;
 };
 
-void RunServer(const std::string& db_path) {
-  std::string server_address("0.0.0.0:50051");
+// Returns false if the server can't be started, e.g., because its port
+// is taken.
+bool RunServer(
+    const std::string& db_path,
+    const std::string& server_address,
+    int max_threads) {
   RouteGuideImpl service(db_path);
 
   ServerBuilder builder;
-  builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  // With port 0 (e.g., "localhost:0") the port is picked when the
+  // server starts, and reported in its "listening" line.
+  int selected_port = 0;
+  builder.AddListeningPort(
+      server_address,
+      grpc::InsecureServerCredentials(),
+      &selected_port);
   builder.RegisterService(&service);
+  // Every call in progress (a stream for as long as it's open) holds one
+  // of the sync server's threads, cap them so that many idle streams
+  // can't exhaust the host. Calls beyond the cap fail with
+  // RESOURCE_EXHAUSTED.
+  if (max_threads > 0) {
+    ResourceQuota quota("route_guide_server");
+    quota.SetMaxThreads(max_threads);
+    builder.SetResourceQuota(quota);
+  }
   std::unique_ptr<Server> server(builder.BuildAndStart());
-  std::cout << "Server listening on " << server_address << std::endl;
+  if (!server) {
+    std::cerr << "Failed to build and start server on " << server_address
+              << std::endl;
+    return false;
+  }
+  std::cout << "Server listening on "
+            << server_address.substr(0, server_address.rfind(':') + 1)
+            << selected_port << std::endl;
   server->Wait();
+  return true;
 }
 
 int main(int argc, char** argv) {
-  // Expect only arg: --db_path=path/to/route_guide_db.json.
+  // Expect args: --db_path=path/to/route_guide_db.json,
+  // --address=0.0.0.0:50051 (port 0 picks a free one) and
+  // --max_threads=256 (0 for no cap).
+  int max_threads = 0;
+  if (!routeguide::GetFlagValue(argc, argv, "max_threads", 256, &max_threads)) {
+    return -1;
+  }
+  std::string address =
+      routeguide::GetFlagValue(argc, argv, "address", "0.0.0.0:50051");
   std::string db = routeguide::GetDbFileContent(argc, argv);
-  RunServer(db);
+  if (!RunServer(db, address, max_threads)) {
+    return -1;
+  }
 
   return 0;
 }
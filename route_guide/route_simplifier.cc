@@ -0,0 +1,92 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "route_simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "geo.h"
+
+namespace routeguide {
+
+namespace {
+
+const double kMetresPerUnit = kEarthRadius * M_PI / 180 / kCoordFactor;
+
+// Distance in metres from 'p' to the segment 'a' -> 'b'. Points are
+// projected onto a plane tangent at 'a' (equirectangular), which is
+// accurate enough for the short segments a simplifier deals with.
+double SegmentDistance(
+    const Coordinate& a,
+    const Coordinate& b,
+    const Coordinate& p) {
+  double scale = std::cos(a.latitude / kCoordFactor * M_PI / 180);
+  double bx = (double(b.longitude) - a.longitude) * scale * kMetresPerUnit;
+  double by = (double(b.latitude) - a.latitude) * kMetresPerUnit;
+  double px = (double(p.longitude) - a.longitude) * scale * kMetresPerUnit;
+  double py = (double(p.latitude) - a.latitude) * kMetresPerUnit;
+  double length = bx * bx + by * by;
+  double t = length > 0 ? (px * bx + py * by) / length : 0;
+  t = std::clamp(t, 0.0, 1.0);
+  return std::hypot(px - t * bx, py - t * by);
+}
+
+}  // namespace
+
+RouteSimplifier::RouteSimplifier(double tolerance, size_t max_window)
+  : tolerance_(tolerance),
+    max_window_(std::max<size_t>(max_window, 1)) {}
+
+void RouteSimplifier::Add(const Coordinate& coordinate) {
+  received_++;
+
+  if (kept_ == 0 || tolerance_ <= 0) {
+    Keep(coordinate);
+    return;
+  }
+
+  bool fits = window_.size() < max_window_;
+  for (size_t i = 0; fits && i < window_.size(); i++) {
+    fits = SegmentDistance(anchor_, coordinate, window_[i]) <= tolerance_;
+  }
+
+  if (!fits) {
+    Keep(window_.back());
+    window_.clear();
+  }
+
+  window_.push_back(coordinate);
+}
+
+void RouteSimplifier::Finish() {
+  if (!window_.empty()) {
+    Keep(window_.back());
+    window_.clear();
+  }
+}
+
+void RouteSimplifier::Keep(const Coordinate& coordinate) {
+  if (kept_ > 0) {
+    distance_ += GreatCircleDistance(anchor_, coordinate);
+  }
+  anchor_ = coordinate;
+  kept_++;
+}
+
+}  // namespace routeguide
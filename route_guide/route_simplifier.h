@@ -0,0 +1,82 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_SIMPLIFIER_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_SIMPLIFIER_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "coordinate.h"
+
+namespace routeguide {
+
+// Simplifies a route as its points arrive, i.e., without having to
+// buffer the whole route first as classic Douglas-Peucker does.
+//
+// This is the "opening window" variant of Douglas-Peucker: starting
+// from the last kept point (the anchor) we keep extending a window of
+// candidate points for as long as every point in the window lies
+// within 'tolerance' metres of the segment from the anchor to the
+// newest point. Once a point breaks that invariant the previous point
+// is kept, becoming the new anchor. The window is capped at
+// 'max_window' points so the per-point cost stays bounded on long
+// straight stretches. Kept points aren't stored, only the last one (the
+// anchor) and the length of the route up to it, so memory stays
+// bounded by the window however long the route gets.
+class RouteSimplifier {
+ public:
+  // A 'tolerance' of zero (or less) keeps every point.
+  explicit RouteSimplifier(double tolerance, size_t max_window = 256);
+
+  void Add(const Coordinate& coordinate);
+
+  // Keeps the final point of the route, must be called once all points
+  // have been added.
+  void Finish();
+
+  // Number of points kept so far.
+  size_t kept() const { return kept_; }
+
+  size_t received() const { return received_; }
+
+  // Length in metres of the simplified route (so far, until 'Finish()').
+  double Distance() const { return distance_; }
+
+  // Bytes allocated for candidate points.
+  size_t MemoryUsage() const {
+    return window_.capacity() * sizeof(Coordinate);
+  }
+
+ private:
+  // Makes 'coordinate' the anchor, adding the segment to it.
+  void Keep(const Coordinate& coordinate);
+
+  const double tolerance_;
+  const size_t max_window_;
+  size_t received_ = 0;
+  size_t kept_ = 0;
+  double distance_ = 0.0;
+  // The last kept point, valid once 'kept_' isn't zero.
+  Coordinate anchor_;
+  std::vector<Coordinate> window_;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_SIMPLIFIER_H_
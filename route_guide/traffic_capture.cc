@@ -0,0 +1,172 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "traffic_capture.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "google/protobuf/message_lite.h"
+#include "metrics.h"
+
+namespace routeguide {
+
+namespace {
+
+const char kMagic[] = "RGCAP001";
+const size_t kMagicSize = sizeof(kMagic) - 1;
+
+size_t PutVarint(char* buffer, uint64_t value) {
+  size_t size = 0;
+  while (value >= 0x80) {
+    buffer[size++] = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  buffer[size++] = static_cast<char>(value);
+  return size;
+}
+
+bool GetVarint(const std::string& data, size_t* position, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *position < data.size(); shift += 7) {
+    uint8_t byte = data[(*position)++];
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+const char* CapturedMethodName(CapturedMethod method) {
+  switch (method) {
+    case CapturedMethod::kGetFeature:
+      return "GetFeature";
+    case CapturedMethod::kListFeatures:
+      return "ListFeatures";
+    case CapturedMethod::kRecordRoute:
+      return "RecordRoute";
+    case CapturedMethod::kRouteChat:
+      return "RouteChat";
+  }
+  return "Unknown";
+}
+
+std::unique_ptr<TrafficCapture> TrafficCapture::Open(
+    FileIo* io,
+    const std::string& path,
+    size_t buffer_size,
+    std::string* error) {
+  std::unique_ptr<AppendLog> log = AppendLog::Open(
+      io,
+      path,
+      0,
+      false,
+      std::max<size_t>(buffer_size, 4096),
+      error);
+  if (!log) {
+    return nullptr;
+  }
+  log->Append(std::string(kMagic, kMagicSize));
+  return std::unique_ptr<TrafficCapture>(new TrafficCapture(std::move(log)));
+}
+
+void TrafficCapture::Record(
+    CapturedMethod method,
+    uint64_t stream,
+    const google::protobuf::MessageLite& request) {
+  static Counter& recorded =
+      Metrics::Default().GetCounter("capture_records_total");
+  static Counter& dropped =
+      Metrics::Default().GetCounter("capture_records_dropped_total");
+
+  size_t payload_size = request.ByteSizeLong();
+
+  uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start_)
+                      .count();
+
+  char header[4 * 10];
+  size_t size = 0;
+  size += PutVarint(header + size, time);
+  size += PutVarint(header + size, stream);
+  size += PutVarint(header + size, static_cast<uint8_t>(method));
+  size += PutVarint(header + size, payload_size);
+
+  if (log_->Append(size + payload_size, [&](char* buffer) {
+        memcpy(buffer, header, size);
+        request.SerializeWithCachedSizesToArray(
+            reinterpret_cast<uint8_t*>(buffer + size));
+      })) {
+    recorded.Increment();
+  } else {
+    dropped.Increment();
+  }
+}
+
+bool ReadTrafficCapture(
+    const std::string& path,
+    std::vector<CapturedRequest>* requests) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::stringstream stream;
+  stream << file.rdbuf();
+  std::string data = stream.str();
+
+  if (data.compare(0, kMagicSize, kMagic) != 0) {
+    return false;
+  }
+
+  size_t position = kMagicSize;
+  while (position < data.size()) {
+    CapturedRequest request;
+    uint64_t method = 0;
+    uint64_t size = 0;
+    if (!GetVarint(data, &position, &request.time)
+        || !GetVarint(data, &position, &request.stream)
+        || !GetVarint(data, &position, &method)
+        || !GetVarint(data, &position, &size)
+        || size > data.size() - position) {
+      // Torn, only the last record can be.
+      break;
+    }
+    if (method < static_cast<uint8_t>(CapturedMethod::kGetFeature)
+        || method > static_cast<uint8_t>(CapturedMethod::kRouteChat)) {
+      return false;
+    }
+    request.method = static_cast<CapturedMethod>(method);
+    request.payload = data.substr(position, size);
+    position += size;
+    requests->push_back(std::move(request));
+  }
+  std::stable_sort(
+      requests->begin(),
+      requests->end(),
+      [](const CapturedRequest& a, const CapturedRequest& b) {
+        return a.time < b.time;
+      });
+  return true;
+}
+
+}  // namespace routeguide
@@ -0,0 +1,114 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_TRAFFIC_CAPTURE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_TRAFFIC_CAPTURE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "file_io.h"
+
+namespace google {
+namespace protobuf {
+class MessageLite;
+}  // namespace protobuf
+}  // namespace google
+
+namespace routeguide {
+
+enum class CapturedMethod : uint8_t {
+  kGetFeature = 1,
+  kListFeatures = 2,
+  kRecordRoute = 3,
+  kRouteChat = 4,
+};
+
+const char* CapturedMethodName(CapturedMethod method);
+
+// One inbound request message. Every RPC gets its own 'stream' id and
+// the messages of a client streaming RPC share it; the client is
+// assumed to have half-closed right after its last captured message.
+struct CapturedRequest {
+  // Nanoseconds since the capture started.
+  uint64_t time = 0;
+  uint64_t stream = 0;
+  CapturedMethod method = CapturedMethod::kGetFeature;
+  // The serialized request message.
+  std::string payload;
+};
+
+// Records inbound requests to a compact binary file: a magic header
+// followed by varint encoded (time, stream, method, length) records
+// each followed by the serialized request.
+//
+// 'Record()' only encodes straight into the buffer of an 'AppendLog',
+// which writes it out through 'FileIo', so request handlers never block
+// on disk. If 'buffer_size' bytes are already waiting for the write in
+// flight the record is dropped (and counted in
+// 'capture_records_dropped_total') rather than stalling the server.
+// Handlers take their records' times without a lock of their own, so
+// records may land slightly out of time order (though never within a
+// stream), 'ReadTrafficCapture()' puts them back in order.
+class TrafficCapture {
+ public:
+  // Returns nullptr (and sets 'error') if 'path' can't be opened for
+  // writing.
+  static std::unique_ptr<TrafficCapture> Open(
+      FileIo* io,
+      const std::string& path,
+      size_t buffer_size,
+      std::string* error);
+
+  // Waits for the records to be written.
+  ~TrafficCapture() = default;
+
+  // Returns a new id for an RPC about to be captured.
+  uint64_t NextStream() {
+    return next_stream_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void Record(
+      CapturedMethod method,
+      uint64_t stream,
+      const google::protobuf::MessageLite& request);
+
+ private:
+  explicit TrafficCapture(std::unique_ptr<AppendLog> log)
+    : log_(std::move(log)), start_(std::chrono::steady_clock::now()) {}
+
+  const std::unique_ptr<AppendLog> log_;
+  const std::chrono::steady_clock::time_point start_;
+  std::atomic<uint64_t> next_stream_{1};
+
+};
+
+// Reads every record of a file written by 'TrafficCapture', in time
+// order, returning false if the file can't be read or is malformed. A
+// final record torn by the server stopping mid-write is left out.
+bool ReadTrafficCapture(
+    const std::string& path,
+    std::vector<CapturedRequest>* requests);
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_TRAFFIC_CAPTURE_H_
@@ -0,0 +1,204 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "unary_call_pool.h"
+
+#include <algorithm>
+#include <optional>
+#include <utility>
+
+#include "grpcpp/server_builder.h"
+
+namespace routeguide {
+
+// A slot for one call at a time, requested again once its call ends.
+class GetFeatureCallPool::Call {
+ public:
+  Call(GetFeatureCallPool* pool, Queue* queue)
+    : pool_(pool),
+      queue_(queue) {}
+
+  void Request() {
+    // A 'ServerContext' can't be reused, but it can be rebuilt in place
+    // (which still allocates its state).
+    responder_.reset();
+    context_.reset();
+    context_.emplace();
+    responder_.emplace(&*context_);
+    finishing_ = false;
+    pool_->service_.RequestGetFeature(
+        &*context_,
+        &request_,
+        &*responder_,
+        queue_->queue.get(),
+        queue_->queue.get(),
+        this);
+  }
+
+  // Whether an event for this slot, if 'ok', is a call arriving.
+  bool arriving() const {
+    return !finishing_;
+  }
+
+  const Point& request() const {
+    return request_;
+  }
+
+  // Called with each event for this slot, from its queue's thread.
+  void Proceed(bool ok) {
+    if (!finishing_) {
+      if (!ok) {
+        // The server is shutting down, no call will arrive.
+        return;
+      }
+      response_.Clear();
+      pool_->handler_(&*context_, request_, &response_);
+      finishing_ = true;
+      responder_->Finish(response_, grpc::Status::OK, this);
+    } else {
+      // Only this queue's lock, which its thread alone takes otherwise.
+      std::lock_guard<std::mutex> lock(queue_->mutex);
+      if (!queue_->shutdown) {
+        Request();
+      }
+    }
+  }
+
+ private:
+  GetFeatureCallPool* const pool_;
+  Queue* const queue_;
+  std::optional<grpc::ServerContext> context_;
+  std::optional<grpc::ServerAsyncResponseWriter<Feature>> responder_;
+  Point request_;
+  Feature response_;
+  bool finishing_ = false;
+};
+
+GetFeatureCallPool::GetFeatureCallPool(
+    Handler handler,
+    Prefetcher prefetcher)
+  : handler_(std::move(handler)),
+    prefetcher_(std::move(prefetcher)) {}
+
+std::unique_ptr<GetFeatureCallPool> GetFeatureCallPool::Start(
+    const std::string& address,
+    size_t completion_queues,
+    size_t calls_per_queue,
+    Handler handler,
+    Prefetcher prefetcher,
+    std::string* error) {
+  std::unique_ptr<GetFeatureCallPool> pool(
+      new GetFeatureCallPool(std::move(handler), std::move(prefetcher)));
+
+  grpc::ServerBuilder builder;
+  int port = 0;
+  builder.AddListeningPort(
+      address,
+      grpc::InsecureServerCredentials(),
+      &port);
+  // Fail, rather than share the port, if 'address' is taken.
+  builder.AddChannelArgument(GRPC_ARG_ALLOW_REUSEPORT, 0);
+  builder.RegisterService(&pool->service_);
+  for (size_t i = 0; i < std::max<size_t>(completion_queues, 1); i++) {
+    pool->queues_.push_back(std::make_unique<Queue>());
+    pool->queues_.back()->queue = builder.AddCompletionQueue();
+  }
+  pool->server_ = builder.BuildAndStart();
+  if (!pool->server_ || port == 0) {
+    *error = "failed to listen on " + address;
+    // Nothing was requested yet, so the queues just need draining.
+    if (pool->server_) {
+      pool->server_->Shutdown();
+      pool->server_.reset();
+    }
+    for (auto& queue : pool->queues_) {
+      queue->queue->Shutdown();
+      void* tag;
+      bool ok;
+      while (queue->queue->Next(&tag, &ok)) {}
+    }
+    pool->queues_.clear();
+    return nullptr;
+  }
+
+  for (auto& queue : pool->queues_) {
+    for (size_t i = 0; i < std::max<size_t>(calls_per_queue, 1); i++) {
+      pool->calls_.push_back(std::make_unique<Call>(pool.get(), queue.get()));
+      pool->calls_.back()->Request();
+    }
+  }
+  for (auto& queue : pool->queues_) {
+    pool->threads_.emplace_back(
+        [pool = pool.get(), queue = queue.get()]() {
+          pool->Poll(queue);
+        });
+  }
+  return pool;
+}
+
+GetFeatureCallPool::~GetFeatureCallPool() {
+  if (!server_) {
+    return;
+  }
+  // Calls that finish from now on aren't requested again, and those
+  // still requested complete (not ok) as the server shuts down. The
+  // locks aren't held while shutting down, which waits for calls that
+  // the polling threads (taking them) finish.
+  for (auto& queue : queues_) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->shutdown = true;
+  }
+  server_->Shutdown();
+  for (auto& queue : queues_) {
+    queue->queue->Shutdown();
+  }
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void GetFeatureCallPool::Poll(Queue* queue) {
+  std::pair<Call*, bool> events[kBatchSize];
+  void* tag;
+  bool ok;
+  while (queue->queue->Next(&tag, &ok)) {
+    size_t count = 0;
+    events[count++] = {static_cast<Call*>(tag), ok};
+    // Take whatever else is ready without waiting for more.
+    while (count < kBatchSize
+           && queue->queue->AsyncNext(
+                  &tag,
+                  &ok,
+                  gpr_inf_past(GPR_CLOCK_MONOTONIC))
+               == grpc::CompletionQueue::GOT_EVENT) {
+      events[count++] = {static_cast<Call*>(tag), ok};
+    }
+    if (prefetcher_) {
+      for (size_t i = 0; i < count; i++) {
+        if (events[i].second && events[i].first->arriving()) {
+          prefetcher_(events[i].first->request());
+        }
+      }
+    }
+    for (size_t i = 0; i < count; i++) {
+      events[i].first->Proceed(events[i].second);
+    }
+  }
+}
+
+}  // namespace routeguide
@@ -0,0 +1,111 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_UNARY_CALL_POOL_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_UNARY_CALL_POOL_H_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "grpcpp/server.h"
+#include "grpcpp/server_context.h"
+#include "protos/route_guide.grpc.pb.h"
+
+namespace routeguide {
+
+// Serves unary 'GetFeature' calls on 'address' (apart from the eventuals
+// server, which accepts every call through generic request-a-call
+// machinery that allocates the call's state anew each time).
+//
+// Each of 'completion_queues' queues, polled by a thread of its own,
+// keeps 'calls_per_queue' calls requested up front. A call's response
+// writer, request and response live in a slot allocated once: when the
+// call finishes the slot is reset in place and requested again, so the
+// messages keep their buffers. Its 'ServerContext' can't be reused and
+// is rebuilt in the slot, which still allocates the context's own state
+// (e.g., metadata) per call. The other 'RouteGuide' methods are
+// answered UNIMPLEMENTED.
+//
+// A polling thread takes up to 'kBatchSize' ready events at a time and
+// passes each arriving call's point to 'prefetcher' before handling any
+// of them, so that their feature lookups miss in parallel.
+class GetFeatureCallPool {
+ public:
+  // Fills in 'feature' (cleared, but with the buffers of an earlier
+  // response) for 'point'. Runs on the polling threads.
+  using Handler = std::function<void(
+      grpc::ServerContext* context,
+      const Point& point,
+      Feature* feature)>;
+
+  // Starts loading whatever 'Handler' will look up for 'point'.
+  using Prefetcher = std::function<void(const Point& point)>;
+
+  static constexpr size_t kBatchSize = 16;
+
+  // Returns nullptr (and sets 'error') if the server can't be started,
+  // e.g., because 'address' is taken.
+  static std::unique_ptr<GetFeatureCallPool> Start(
+      const std::string& address,
+      size_t completion_queues,
+      size_t calls_per_queue,
+      Handler handler,
+      Prefetcher prefetcher,
+      std::string* error);
+
+  // Shuts down the server, waiting for the calls in flight.
+  ~GetFeatureCallPool();
+
+ private:
+  class Call;
+
+  // A completion queue and what its calls check before being requested
+  // again, locked only by its polling thread and the destructor.
+  struct Queue {
+    std::unique_ptr<grpc::ServerCompletionQueue> queue;
+    // Held while a call is requested again, so that once the destructor
+    // has set 'shutdown' no call is requested from a server shutting
+    // down.
+    std::mutex mutex;
+    bool shutdown = false;
+  };
+
+  using Service = RouteGuide::WithAsyncMethod_GetFeature<RouteGuide::Service>;
+
+  GetFeatureCallPool(Handler handler, Prefetcher prefetcher);
+
+  void Poll(Queue* queue);
+
+  const Handler handler_;
+  const Prefetcher prefetcher_;
+  Service service_;
+  // Destroyed after the server, which uses them until then.
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::unique_ptr<grpc::Server> server_;
+  std::vector<std::unique_ptr<Call>> calls_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace routeguide
+
+#endif  // GRPC_COMMON_CPP_ROUTE_GUIDE_UNARY_CALL_POOL_H_